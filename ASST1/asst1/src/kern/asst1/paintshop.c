@@ -6,6 +6,19 @@
 
 #include "paintshop.h"
 
+/*
+ * Set to 0 to run the shop on ordinary semaphores, so the sleep and
+ * wakeup counts printed at closing time can be compared with FIFO
+ * handoff semaphores.
+ */
+#define PAINTSHOP_FIFO_SEMS 1
+
+#if PAINTSHOP_FIFO_SEMS
+#define shop_sem_create sem_create_fifo
+#else
+#define shop_sem_create sem_create
+#endif
+
 
 void order_paint(paint_can *can);
 void go_home(void);
@@ -37,18 +50,18 @@ void paintshop_open()
     remaining_customers = NCUSTOMERS;
 
     /* binary semaphores for accessing critical region */
-    access_orders = sem_create("access_orders", 1);
-    access_shipments   = sem_create("access_shipments", 1);
-    access_tints  = sem_create("access_tints", 1);
-    stuff_exit = sem_create("stuff_exit", 1);
+    access_orders = shop_sem_create("access_orders", 1);
+    access_shipments   = shop_sem_create("access_shipments", 1);
+    access_tints  = shop_sem_create("access_tints", 1);
+    stuff_exit = shop_sem_create("stuff_exit", 1);
 
     /* counting semaphores for controlling access to full or empty buffer */
 
-    full_shipment = sem_create("full_shipment", 0);
-    full_order = sem_create("full_order", 0);
+    full_shipment = shop_sem_create("full_shipment", 0);
+    full_order = shop_sem_create("full_order", 0);
 
-    empty_shipment = sem_create("empty_shipment", NCUSTOMERS);
-    empty_order = sem_create("empty_order", NCUSTOMERS);
+    empty_shipment = shop_sem_create("empty_shipment", NCUSTOMERS);
+    empty_order = shop_sem_create("empty_order", NCUSTOMERS);
 
     /* buffer initialization */
     int i;
@@ -68,6 +81,15 @@ void paintshop_open()
 
 void paintshop_close()
 {
+    sem_printstats(access_orders);
+    sem_printstats(access_shipments);
+    sem_printstats(full_shipment);
+    sem_printstats(full_order);
+    sem_printstats(empty_order);
+    sem_printstats(empty_shipment);
+    sem_printstats(access_tints);
+    sem_printstats(stuff_exit);
+
     // cleanup
     sem_destroy(access_orders);
     sem_destroy(access_shipments);
@@ -40,6 +40,15 @@
 /*
  * Dijkstra-style semaphore.
  *
+ * A semaphore made with sem_create_fifo hands each V directly to the
+ * longest-waiting thread instead of bumping the count and letting the
+ * woken thread race for it. Waiters are served strictly in order, and
+ * a woken waiter never has to go back to sleep. sem_create gives the
+ * classic behavior.
+ *
+ * The counters are for measuring how much of that racing goes on:
+ * sem_nrechecks counts wakeups that found the count already taken.
+ *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
  */
@@ -48,10 +57,16 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile unsigned sem_count;
+	bool sem_fifo;			/* hand V to the first waiter */
+	unsigned sem_nsleeps;		/* times P went to sleep */
+	unsigned sem_nwakeups;		/* times V woke a waiter */
+	unsigned sem_nrechecks;		/* wakeups that found count 0 */
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
+struct semaphore *sem_create_fifo(const char *name, unsigned initial_count);
 void sem_destroy(struct semaphore *);
+void sem_printstats(struct semaphore *);
 
 /*
  * Operations (both atomic):
@@ -44,8 +44,9 @@
 //
 // Semaphore.
 
+static
 struct semaphore *
-sem_create(const char *name, unsigned initial_count)
+sem_create_common(const char *name, unsigned initial_count, bool fifo)
 {
         struct semaphore *sem;
 
@@ -69,10 +70,26 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+	sem->sem_fifo = fifo;
+	sem->sem_nsleeps = 0;
+	sem->sem_nwakeups = 0;
+	sem->sem_nrechecks = 0;
 
         return sem;
 }
 
+struct semaphore *
+sem_create(const char *name, unsigned initial_count)
+{
+	return sem_create_common(name, initial_count, false);
+}
+
+struct semaphore *
+sem_create_fifo(const char *name, unsigned initial_count)
+{
+	return sem_create_common(name, initial_count, true);
+}
+
 void
 sem_destroy(struct semaphore *sem)
 {
@@ -100,6 +117,25 @@ P(struct semaphore *sem)
 
 	/* Use the semaphore spinlock to protect the wchan as well. */
 	spinlock_acquire(&sem->sem_lock);
+
+	if (sem->sem_fifo) {
+		/*
+		 * The count is only nonzero when nobody is waiting,
+		 * so taking it can't jump the queue. Otherwise wait
+		 * our turn; V wakes us instead of raising the count,
+		 * so when we wake up the unit is already ours.
+		 */
+		if (sem->sem_count > 0) {
+			sem->sem_count--;
+		}
+		else {
+			sem->sem_nsleeps++;
+			wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+		}
+		spinlock_release(&sem->sem_lock);
+		return;
+	}
+
         while (sem->sem_count == 0) {
 		/*
 		 *
@@ -111,9 +147,13 @@ P(struct semaphore *sem)
 		 * strict ordering. Too bad. :-)
 		 *
 		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * ordering? (Answer: sem_create_fifo.)
 		 */
+		sem->sem_nsleeps++;
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+		if (sem->sem_count == 0) {
+			sem->sem_nrechecks++;
+		}
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
@@ -127,11 +167,39 @@ V(struct semaphore *sem)
 
 	spinlock_acquire(&sem->sem_lock);
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	if (wchan_isempty(sem->sem_wchan, &sem->sem_lock)) {
+		sem->sem_count++;
+		KASSERT(sem->sem_count > 0);
+	}
+	else {
+		if (!sem->sem_fifo) {
+			sem->sem_count++;
+			KASSERT(sem->sem_count > 0);
+		}
+		/* else pass it straight to the first waiter */
+		sem->sem_nwakeups++;
+		wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	}
+
+	spinlock_release(&sem->sem_lock);
+}
 
+void
+sem_printstats(struct semaphore *sem)
+{
+	unsigned nsleeps, nwakeups, nrechecks;
+
+        KASSERT(sem != NULL);
+
+	spinlock_acquire(&sem->sem_lock);
+	nsleeps = sem->sem_nsleeps;
+	nwakeups = sem->sem_nwakeups;
+	nrechecks = sem->sem_nrechecks;
 	spinlock_release(&sem->sem_lock);
+
+	kprintf("%s (%s): %u sleeps, %u wakeups, %u failed rechecks\n",
+		sem->sem_name, sem->sem_fifo ? "fifo" : "plain",
+		nsleeps, nwakeups, nrechecks);
 }
 
 ////////////////////////////////////////////////////////////
@@ -67,6 +67,9 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/* And the reverse, for a kseg0 address. */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -118,9 +121,10 @@ paddr_t ram_getfirstfree(void);
 
 struct tlbshootdown {
 	/*
-	 * Change this to what you need for your VM design.
+	 * The whole TLB is always flushed; ts_done, if not NULL, is
+	 * V'd once it has been.
 	 */
-	int ts_placeholder;
+	struct semaphore *ts_done;
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -38,6 +38,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,15 +60,10 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
-/*
- * Wrap ram_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
-
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	coremap_bootstrap();
 }
 
 /*
@@ -94,14 +90,7 @@ static
 paddr_t
 getppages(unsigned long npages)
 {
-	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
-	addr = ram_stealmem(npages);
-
-	spinlock_release(&stealmem_lock);
-	return addr;
+	return coremap_alloc(npages);
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -121,9 +110,7 @@ alloc_kpages(unsigned npages)
 void
 free_kpages(vaddr_t addr)
 {
-	/* nothing - leak the memory. */
-
-	(void)addr;
+	coremap_free(KVADDR_TO_PADDR(addr));
 }
 
 void
@@ -257,6 +244,17 @@ void
 as_destroy(struct addrspace *as)
 {
 	dumbvm_can_sleep();
+
+	/* Any of these may be missing if as_prepare_load failed. */
+	if (as->as_pbase1 != 0) {
+		coremap_free(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_free(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_free(as->as_stackpbase);
+	}
 	kfree(as);
 }
 
@@ -383,6 +381,25 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_pin(struct addrspace *as, vaddr_t vaddr, size_t len, bool write)
+{
+	/* Everything's in memory all the time. */
+	(void)as;
+	(void)vaddr;
+	(void)len;
+	(void)write;
+	return 0;
+}
+
+void
+as_unpin(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	(void)as;
+	(void)vaddr;
+	(void)len;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -0,0 +1,306 @@
+/*
+ * MIPS part of the VM system: the TLB, and the kernel's page
+ * allocator. The machine-independent parts are in vm/addrspace.c,
+ * vm/pagetable.c, and vm/coremap.c.
+ *
+ * Used when dumbvm is off.
+ *
+ * TLB entries are tagged with the address space ID of the address
+ * space they belong to, so switching address spaces only means
+ * loading a different ID, and a process's entries are still there
+ * when it runs again. There are only NUM_TLBASID-1 IDs (0 is never
+ * handed out), so each cpu hands them out in generations: when it
+ * runs out it flushes its TLB and starts a new generation, and an
+ * address space holding an ID from an old one gets a new ID the next
+ * time it's activated.
+ *
+ * An ID is only good on the cpu that handed it out; an address space
+ * that moves to another cpu gets a new one there. So the only TLB
+ * that can have entries an address space will use is the one on the
+ * cpu it's running on, and when a fault changes one of its mappings,
+ * fixing that TLB is enough.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <synch.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vmstats.h>
+
+/* For vm_tlbflush_all; one shootdown at a time. */
+static struct lock *vm_shootdownlock;
+static struct semaphore *vm_shootdownsem;
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vmstats_reset();
+
+	vm_shootdownlock = lock_create("shootdown");
+	if (vm_shootdownlock == NULL) {
+		panic("vm: Could not create shootdown lock\n");
+	}
+	vm_shootdownsem = sem_create("shootdown", 0);
+	if (vm_shootdownsem == NULL) {
+		panic("vm: Could not create shootdown semaphore\n");
+	}
+	as_bootstrap();
+	swap_bootstrap();
+}
+
+/*
+ * Check that we're in a context that can sleep, since allocating
+ * pages and handling faults may.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	vm_can_sleep();
+	pa = coremap_alloc(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+void
+vm_tlbflush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(curcpu->c_asid);
+	splx(spl);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	/* Nothing asks for particular pages yet; drop everything. */
+	vm_tlbflush();
+	if (ts->ts_done != NULL) {
+		V(ts->ts_done);
+	}
+}
+
+void
+vm_tlbflush_all(void)
+{
+	struct tlbshootdown ts;
+	unsigned i, n;
+	int spl;
+
+	lock_acquire(vm_shootdownlock);
+	ts.ts_done = vm_shootdownsem;
+
+	/* Stay on this cpu until it's flushed and the others are told. */
+	spl = splhigh();
+	vm_tlbflush();
+	n = ipi_tlbshootdown_broadcast(&ts);
+	splx(spl);
+
+	for (i=0; i<n; i++) {
+		P(vm_shootdownsem);
+	}
+	lock_release(vm_shootdownlock);
+}
+
+void
+vm_tlbactivate(struct addrspace *as)
+{
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (as->as_asidcpu != c->c_number || as->as_asidgen != c->c_asidgen) {
+		if (c->c_asidnext == NUM_TLBASID) {
+			/* Out of IDs; none of the old ones are used after this. */
+			c->c_asid = 0;
+			vm_tlbflush();
+			c->c_asidnext = 1;
+			c->c_asidgen++;
+			if (c->c_asidgen == 0) {
+				/* 0 means no ID in an address space. */
+				c->c_asidgen = 1;
+			}
+			vmstats_inc(VMSTAT_ASIDFLUSHES);
+		}
+		as->as_asid = c->c_asidnext++;
+		as->as_asidcpu = c->c_number;
+		as->as_asidgen = c->c_asidgen;
+	}
+	c->c_asid = as->as_asid;
+	tlb_setasid(c->c_asid);
+	splx(spl);
+}
+
+void
+vm_tlbdeactivate(void)
+{
+	int spl;
+
+	spl = splhigh();
+	curcpu->c_asid = 0;
+	tlb_setasid(0);
+	splx(spl);
+}
+
+void
+vm_tlbforget(struct addrspace *as)
+{
+	struct cpu *c;
+	bool loaded;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	loaded = as->as_asidcpu == c->c_number &&
+		as->as_asidgen == c->c_asidgen && as->as_asid == c->c_asid;
+	as->as_asidgen = 0;
+	if (loaded) {
+		/* It's still current, so give it a new ID right away. */
+		vm_tlbactivate(as);
+	}
+	splx(spl);
+}
+
+/*
+ * Load the current address space's TLB entry mapping VADDR to PADDR,
+ * after a fault of type FAULTTYPE. Call with interrupts off.
+ */
+static
+void
+vm_tlbload(int faulttype, vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	uint32_t ehi, elo;
+	int index;
+
+	ehi = vaddr | (curcpu->c_asid << TLBHI_PIDSHIFT);
+	elo = paddr | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/*
+	 * Never load two entries for the same page. There can only be
+	 * one already if the page was mapped read-only, and not even
+	 * then if we've slept and moved cpus or been shot down since.
+	 */
+	index = -1;
+	if (faulttype == VM_FAULT_READONLY) {
+		index = tlb_probe(ehi, 0);
+	}
+	if (index >= 0) {
+		tlb_write(ehi, elo, index);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	paddr_t paddr;
+	bool writeable;
+	int result, spl;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	vmstats_inc(VMSTAT_FAULTS);
+
+	/*
+	 * Most faults are for pages that are in memory and just aren't
+	 * in the TLB; load those straight from the page table. Keep
+	 * interrupts off until the entry is in, so if the page is about
+	 * to be paged out, the shootdown for it comes afterwards.
+	 */
+	spl = splhigh();
+	if (as_quickfault(as, faultaddress, faulttype, &paddr, &writeable)) {
+		vm_tlbload(faulttype, faultaddress, paddr, writeable);
+		splx(spl);
+		vmstats_inc(VMSTAT_QUICKFAULTS);
+		return 0;
+	}
+	splx(spl);
+
+	vm_can_sleep();
+	result = as_fault(as, faultaddress, faulttype, &paddr, &writeable);
+	if (result) {
+		return result;
+	}
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, paddr);
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	vm_tlbload(faulttype, faultaddress, paddr, writeable);
+	splx(spl);
+
+	/* It's in the TLB; paging it out will shoot it down from here. */
+	coremap_unpin(paddr);
+	return 0;
+}
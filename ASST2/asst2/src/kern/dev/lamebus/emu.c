@@ -1089,6 +1089,7 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_fsync = emufs_fsync,
 	.vop_mmap = emufs_mmap,
 	.vop_truncate = emufs_truncate,
+	.vop_readahead = vopfail_readahead_nosys,
 	.vop_namefile = emufs_uio_op_notdir,
 
 	.vop_creat = emufs_creat_notdir,
@@ -1123,6 +1124,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_fsync = emufs_void_op_isdir,
 	.vop_mmap = emufs_void_op_isdir,
 	.vop_truncate = emufs_truncate_isdir,
+	.vop_readahead = vopfail_readahead_nosys,
 	.vop_namefile = emufs_namefile,
 
 	.vop_creat = emufs_creat,
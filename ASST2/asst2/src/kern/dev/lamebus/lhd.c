@@ -29,6 +29,14 @@
 
 /*
  * LAMEbus hard disk (lhd) driver.
+ *
+ * I/O goes through a request queue (see struct devreq in device.h).
+ * Pending requests are kept sorted by sector and served in C-SCAN
+ * order: sweep upward from the last sector done, then jump back to
+ * the lowest pending request and sweep again. The hardware moves one
+ * sector at a time through the on-card buffer, so the interrupt for
+ * each sector starts the next one itself; whoever submitted the
+ * request hears about it once, when the whole thing is done.
  */
 
 #include <types.h>
@@ -36,7 +44,6 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -60,6 +67,9 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/* Most sectors lhd_io bounces through memory per request. */
+#define LHD_MAXCHUNK    16
+
 /*
  * Shortcut for reading a register.
  */
@@ -96,41 +106,158 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Skip past any empty iovecs at the current position of the active
+ * request.
+ */
+static
+void
+lhd_skipempty(struct lhd_softc *lh)
+{
+	struct devreq *req = lh->lh_active;
+
+	while (lh->lh_iov < req->dr_iovcnt &&
+	       lh->lh_iovoff == req->dr_iov[lh->lh_iov].iov_len) {
+		lh->lh_iov++;
+		lh->lh_iovoff = 0;
+	}
+}
+
+/*
+ * Start the current sector of the active request.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_startsect(struct lhd_softc *lh)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct devreq *req = lh->lh_active;
+	char *data;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	/* If writing, transfer the data to the on-card buffer first. */
+	if (req->dr_write) {
+		data = req->dr_iov[lh->lh_iov].iov_kbase;
+		memcpy(lh->lh_buf, data + lh->lh_iovoff, LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want, and start the operation. */
+	lhd_wreg(lh, LHD_REG_SECT, lh->lh_sect);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * The current sector of the active request went through. If reading,
+ * transfer the data out of the on-card buffer. Then move on to the
+ * next sector; return false if there isn't one.
+ */
+static
+bool
+lhd_advance(struct lhd_softc *lh)
+{
+	struct devreq *req = lh->lh_active;
+	char *data;
+
+	if (!req->dr_write) {
+		membar_load_load();
+		data = req->dr_iov[lh->lh_iov].iov_kbase;
+		memcpy(data + lh->lh_iovoff, lh->lh_buf, LHD_SECTSIZE);
+	}
+	lh->lh_sect++;
+	lh->lh_iovoff += LHD_SECTSIZE;
+	lhd_skipempty(lh);
+	return lh->lh_iov < req->dr_iovcnt;
+}
+
+/*
+ * The disk is idle: pick the next request in C-SCAN order and start
+ * it. That's the first one at or after the sector we last did, or if
+ * there's none, the first in the queue.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct devreq **pp, **pick;
+	struct devreq *req;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+	KASSERT(lh->lh_active == NULL);
+
+	if (lh->lh_queue == NULL) {
+		return;
+	}
+
+	pick = &lh->lh_queue;
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->dr_next) {
+		if ((*pp)->dr_block >= lh->lh_sect) {
+			pick = pp;
+			break;
+		}
+	}
+	req = *pick;
+	*pick = req->dr_next;
+	req->dr_next = NULL;
+
+	lh->lh_active = req;
+	lh->lh_sect = req->dr_block;
+	lh->lh_iov = 0;
+	lh->lh_iovoff = 0;
+	lhd_skipempty(lh);
+	lhd_startsect(lh);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, then either start the next sector of the same request or
+ * report the request done and start the next one.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct devreq *req;
 	uint32_t val;
+	int err;
+
+	spinlock_acquire(&lh->lh_lock);
 
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
-	    case LHD_IDLE:
-	    case LHD_WORKING:
-		break;
 	    case LHD_OK:
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
-		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
+	    default:
+		spinlock_release(&lh->lh_lock);
+		return;
+	}
+
+	lhd_wreg(lh, LHD_REG_STAT, 0);
+	err = lhd_code_to_errno(lh, val);
+
+	req = lh->lh_active;
+	if (req == NULL) {
+		/* Nothing was running; ignore it. */
+		spinlock_release(&lh->lh_lock);
+		return;
+	}
+
+	if (err == 0 && lhd_advance(lh)) {
+		lhd_startsect(lh);
+		spinlock_release(&lh->lh_lock);
+		return;
 	}
+
+	lh->lh_active = NULL;
+	lhd_start(lh);
+	spinlock_release(&lh->lh_lock);
+
+	devreq_done(req, err);
 }
 
 /*
@@ -180,21 +307,73 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * Queue a request. Called by dev_submit.
+ */
+static
+void
+lhd_submit(struct device *d, struct devreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct devreq **pp;
+	uint32_t len = 0;
+	unsigned i;
+
+	/* Don't allow I/O that isn't whole sectors. */
+	for (i=0; i<req->dr_iovcnt; i++) {
+		if (req->dr_iov[i].iov_len % LHD_SECTSIZE != 0) {
+			devreq_done(req, EINVAL);
+			return;
+		}
+		len += req->dr_iov[i].iov_len / LHD_SECTSIZE;
+	}
+
+	/* Don't allow I/O past the end of the disk, or nothing at all. */
+	if (len == 0 || req->dr_block + len < req->dr_block ||
+	    req->dr_block + len > lh->lh_dev.d_blocks) {
+		devreq_done(req, EINVAL);
+		return;
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+
+	/* Insert in sector order, after any requests for the same sector. */
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->dr_next) {
+		if ((*pp)->dr_block > req->dr_block) {
+			break;
+		}
+	}
+	req->dr_next = *pp;
+	*pp = req;
+
+	if (lh->lh_active == NULL) {
+		lhd_start(lh);
+	}
+
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * I/O function (for both reads and writes), for callers with a uio.
+ * The data goes through a bounce buffer, up to LHD_MAXCHUNK sectors
+ * at a time, each chunk as one request, so we sleep once per chunk
+ * rather than once per sector.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct devbatch db;
+	struct devreq req;
+	struct iovec iov;
+	void *bounce;
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
+	uint32_t n;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -207,67 +386,57 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	bounce = kmalloc((len < LHD_MAXCHUNK ? len : LHD_MAXCHUNK) *
+			 LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	while (len > 0) {
+		n = len < LHD_MAXCHUNK ? len : LHD_MAXCHUNK;
+		iov.iov_kbase = bounce;
+		iov.iov_len = n * LHD_SECTSIZE;
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
 		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+			result = uiomove(bounce, iov.iov_len, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		devreq_init(&req, sector, &iov, 1, uio->uio_rw == UIO_WRITE);
+		devbatch_init(&db);
+		devbatch_submit(&db, d, &req);
+		devbatch_wait(&db);
+		result = req.dr_result;
+		if (result) {
+			break;
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, iov.iov_len, uio);
+			if (result) {
+				break;
+			}
 		}
+
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	kfree(bounce);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_submit = lhd_submit,
 };
 
 /*
@@ -284,17 +453,13 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_queue = NULL;
+	lh->lh_active = NULL;
+	lh->lh_sect = 0;
+	lh->lh_iov = 0;
+	lh->lh_iovoff = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
 
 /*
@@ -51,9 +52,18 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+
+	/*
+	 * Request queue, protected by lh_lock. lh_queue is sorted by
+	 * starting sector. lh_sect, lh_iov and lh_iovoff say where in
+	 * lh_active the sector now in progress is.
+	 */
+	struct spinlock lh_lock;
+	struct devreq *lh_queue;	/* Pending requests */
+	struct devreq *lh_active;	/* Request in progress, or NULL */
+	uint32_t lh_sect;		/* Sector in progress */
+	unsigned lh_iov;		/* lh_active->dr_iov index */
+	size_t lh_iovoff;		/* Offset into that iovec */
 
 	struct device lh_dev;		/* VFS device structure */
 };
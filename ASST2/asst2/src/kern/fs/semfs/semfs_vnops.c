@@ -665,6 +665,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
+	.vop_readahead = vopfail_readahead_nosys,
 	.vop_namefile = semfs_namefile,
 
 	.vop_creat = semfs_creat,
@@ -698,6 +699,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
+	.vop_readahead = vopfail_readahead_nosys,
 	.vop_namefile = vopfail_uio_notdir,
 
 	.vop_creat = vopfail_creat_notdir,
@@ -31,13 +31,27 @@
  * SFS filesystem
  *
  * Block allocation.
+ *
+ * Inodes and indirect blocks come from sfs_balloc, which takes the
+ * first free block on the disk. File data comes from sfs_balloc_file,
+ * which tries to keep each file contiguous: it searches forward from
+ * the last block the file got, and when a file is being appended to
+ * it looks for a free run and reserves the next SFS_PREALLOC blocks
+ * of it for the following appends. The reserved blocks are marked
+ * in the freemap so nobody else takes them, and go back when the
+ * file is truncated or its vnode is reclaimed.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Blocks reserved past each appending allocation. */
+#define SFS_PREALLOC  8
+
 /*
  * Zero out a disk block.
  */
@@ -59,33 +73,187 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
+		lock_release(sfs->sfs_freemaplock);
 		return result;
 	}
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
 
-	/* Clear block before returning it */
+	/*
+	 * Clear block before returning it. The block is ours, so this
+	 * doesn't need the freemap lock.
+	 */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
+		lock_acquire(sfs->sfs_freemaplock);
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		lock_release(sfs->sfs_freemaplock);
 	}
 	return result;
 }
 
+/*
+ * Find a run of COUNT free blocks from HINT onward, wrapping around
+ * at the end of the disk. The bitmap's range search skips whole words
+ * of allocated blocks at a time, so this doesn't test the blocks one
+ * by one.
+ */
+static
+int
+sfs_findrun(struct sfs_fs *sfs, daddr_t hint, unsigned count,
+	    daddr_t *ret)
+{
+	uint32_t nblocks = sfs->sfs_sb.sb_nblocks;
+	unsigned index;
+
+	/* The freemap can have more bits than the disk has blocks. */
+	if ((bitmap_findrange(sfs->sfs_freemap, hint, count, &index) == 0
+	     && index + count <= nblocks) ||
+	    (bitmap_findrange(sfs->sfs_freemap, 0, count, &index) == 0
+	     && index + count <= nblocks)) {
+		KASSERT(index != 0);
+		*ret = index;
+		return 0;
+	}
+	return ENOSPC;
+}
+
+/*
+ * Look for free blocks from HINT onward, wrapping around at the end
+ * of the disk, and return the start of the first run of at least
+ * WANT of them. If there's no run that long, settle for the first
+ * free block. Runs don't wrap. Call with the freemap lock held.
+ */
+static
+int
+sfs_findfree(struct sfs_fs *sfs, daddr_t hint, unsigned want,
+	     daddr_t *ret)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (hint >= sfs->sfs_sb.sb_nblocks) {
+		hint = 0;
+	}
+	result = sfs_findrun(sfs, hint, want, ret);
+	if (result == ENOSPC && want > 1) {
+		result = sfs_findrun(sfs, hint, 1, ret);
+	}
+	return result;
+}
+
+/*
+ * Allocate a block for FILEBLOCK of the file SV. Takes the next
+ * reserved block if there is one; otherwise searches forward from
+ * the file's last block, and if FILEBLOCK is at or past the end of
+ * the file, reserves the free blocks that follow.
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, uint32_t fileblock, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block, hint;
+	bool append;
+	unsigned n;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	append = (off_t)fileblock * SFS_BLOCKSIZE >= sv->sv_i.sfi_size;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sv->sv_nprealloc > 0) {
+		/* Already marked in the freemap */
+		block = sv->sv_prealloc++;
+		sv->sv_nprealloc--;
+	}
+	else {
+		/* Start near the file, or right after the inode */
+		hint = sv->sv_allochint != 0 ?
+			sv->sv_allochint + 1 : sv->sv_ino + 1;
+		result = sfs_findfree(sfs, hint,
+				      append ? SFS_PREALLOC + 1 : 1, &block);
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+		bitmap_mark(sfs->sfs_freemap, block);
+
+		if (append) {
+			for (n = 0; n < SFS_PREALLOC; n++) {
+				if (block + 1 + n >= sfs->sfs_sb.sb_nblocks ||
+				    bitmap_isset(sfs->sfs_freemap,
+						 block + 1 + n)) {
+					break;
+				}
+				bitmap_mark(sfs->sfs_freemap, block + 1 + n);
+			}
+			sv->sv_prealloc = block + 1;
+			sv->sv_nprealloc = n;
+		}
+		sfs->sfs_freemapdirty = true;
+	}
+	sv->sv_allochint = block;
+	lock_release(sfs->sfs_freemaplock);
+
+	if (block >= sfs->sfs_sb.sb_nblocks) {
+		panic("sfs: %s: balloc: invalid block %u\n",
+		      sfs->sfs_sb.sb_volname, block);
+	}
+
+	/* As in sfs_balloc, the block is ours; clear it unlocked. */
+	result = sfs_clearblock(sfs, block);
+	if (result) {
+		sfs_bfree(sfs, block);
+		return result;
+	}
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Give back the blocks reserved for SV.
+ */
+void
+sfs_prealloc_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_nprealloc == 0) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+	while (sv->sv_nprealloc > 0) {
+		bitmap_unmark(sfs->sfs_freemap, sv->sv_prealloc);
+		sv->sv_prealloc++;
+		sv->sv_nprealloc--;
+	}
+	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -94,10 +262,15 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
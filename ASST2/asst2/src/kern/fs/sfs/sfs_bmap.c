@@ -35,10 +35,103 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Levels of indirection; the triple indirect block is level 3. */
+#define SFS_IDLEVELS  3
+
+/*
+ * Indirect blocks the vnode has used recently, one for each level of
+ * indirection. Reading a file in order walks the same indirect
+ * blocks over and over, so this saves a buffer cache lookup and a
+ * copy for nearly every data block. Entries are changed here and
+ * written through to disk at once, so the cache is never dirty.
+ * Allocated the first time a file goes past its direct blocks and
+ * covered by sv_lock.
+ */
+struct sfs_idcache {
+	daddr_t ic_block[SFS_IDLEVELS];
+	uint32_t ic_data[SFS_IDLEVELS][SFS_DBPERIDB];
+};
+
+void
+sfs_idcache_destroy(struct sfs_vnode *sv)
+{
+	kfree(sv->sv_idcache);
+	sv->sv_idcache = NULL;
+}
+
+/*
+ * Get the contents of indirect block IDBLOCK, which is LEVEL steps
+ * above the data blocks. If ISNEW, it has just been allocated and is
+ * all zeros, so there's no need to read it.
+ */
+static
+int
+sfs_idget(struct sfs_vnode *sv, daddr_t idblock, unsigned level, bool isnew,
+	  uint32_t **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_idcache *ic;
+	unsigned i;
+	int result;
+
+	KASSERT(level >= 1 && level <= SFS_IDLEVELS);
+
+	if (sv->sv_idcache == NULL) {
+		sv->sv_idcache = kmalloc(sizeof(struct sfs_idcache));
+		if (sv->sv_idcache == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<SFS_IDLEVELS; i++) {
+			sv->sv_idcache->ic_block[i] = 0;
+		}
+	}
+	ic = sv->sv_idcache;
+	i = level - 1;
+
+	if (isnew) {
+		bzero(ic->ic_data[i], SFS_BLOCKSIZE);
+	}
+	else if (ic->ic_block[i] != idblock) {
+		ic->ic_block[i] = 0;
+		result = sfs_readblock(sfs, idblock, ic->ic_data[i],
+				       SFS_BLOCKSIZE);
+		if (result) {
+			return result;
+		}
+	}
+	ic->ic_block[i] = idblock;
+	*ret = ic->ic_data[i];
+	return 0;
+}
+
+/*
+ * Write back indirect block IDBLOCK, LEVEL steps above the data,
+ * after changing its cached contents.
+ */
+static
+int
+sfs_idput(struct sfs_vnode *sv, daddr_t idblock, unsigned level)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_idcache *ic = sv->sv_idcache;
+	int result;
+
+	KASSERT(ic != NULL && ic->ic_block[level - 1] == idblock);
+
+	result = sfs_writeblock(sfs, idblock, ic->ic_data[level - 1],
+				SFS_BLOCKSIZE);
+	if (result) {
+		/* The disk and the cache disagree now; trust the disk. */
+		ic->ic_block[level - 1] = 0;
+	}
+	return result;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
@@ -49,25 +142,16 @@ int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t block;
-	daddr_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t *idbuf;
+	uint32_t *slot;
+	uint32_t offset, span, idx;
+	unsigned level, levels;
+	daddr_t block, idblock;
+	bool isnew;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -82,7 +166,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc_file(sv, fileblock, &block);
 			if (result) {
 				return result;
 			}
@@ -105,86 +189,87 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
-	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * It's not a direct block, so it's under the single, double,
+	 * or triple indirect block. Work out which, and the offset
+	 * within the range of file blocks that one covers.
 	 */
-	if (idnum >= SFS_NINDIRECT) {
+	offset = fileblock - SFS_NDIRECT;
+	span = SFS_DBPERIDB;
+	for (levels = 1; levels <= SFS_IDLEVELS; levels++) {
+		if (offset < span) {
+			break;
+		}
+		offset -= span;
+		span *= SFS_DBPERIDB;
+	}
+	if (levels > SFS_IDLEVELS) {
 		return EFBIG;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
-
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
-		return 0;
+	switch (levels) {
+	    case 1: slot = &sv->sv_i.sfi_indirect; break;
+	    case 2: slot = &sv->sv_i.sfi_dindirect; break;
+	    default: slot = &sv->sv_i.sfi_tindirect; break;
 	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
+
+	/* Get the top indirect block, allocating it if need be. */
+	idblock = *slot;
+	isnew = false;
+	if (idblock == 0) {
+		if (!doalloc) {
+			/*
+			 * Nothing allocated here, and we weren't asked
+			 * to allocate; it reads as all zeros.
+			 */
+			*diskblock = 0;
+			return 0;
+		}
 		result = sfs_balloc(sfs, &idblock);
 		if (result) {
 			return result;
 		}
-
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
-
-		/* Mark the inode dirty */
+		*slot = idblock;
 		sv->sv_dirty = true;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+		isnew = true;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
-
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+	/* Walk down one indirect block per level. */
+	for (level = levels; level >= 1; level--) {
+		result = sfs_idget(sv, idblock, level, isnew, &idbuf);
 		if (result) {
 			return result;
 		}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		span /= SFS_DBPERIDB;
+		idx = offset / span;
+		offset %= span;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+		block = idbuf[idx];
+		isnew = false;
+		if (block == 0) {
+			if (!doalloc) {
+				*diskblock = 0;
+				return 0;
+			}
+			if (level > 1) {
+				result = sfs_balloc(sfs, &block);
+				isnew = true;
+			}
+			else {
+				result = sfs_balloc_file(sv, fileblock, &block);
+			}
+			if (result) {
+				return result;
+			}
+
+			/* Remember the block and write the indirect block */
+			idbuf[idx] = block;
+			result = sfs_idput(sv, idblock, level);
+			if (result) {
+				return result;
+			}
 		}
+		idblock = block;
 	}
 
 	/* Hand back the result and return. */
@@ -198,34 +283,115 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Free the blocks past file block BLOCKLEN under indirect block
+ * *SLOT, which is LEVEL steps above the data and maps the file blocks
+ * starting at BASE. If nothing is left under it, free it too and
+ * clear *SLOT; *CHANGED is set if *SLOT changes.
  */
+static
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_itrunc_indirect(struct sfs_vnode *sv, uint32_t *slot, unsigned level,
+		    uint32_t base, uint32_t blocklen, bool *changed)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t *idbuf;
+	uint32_t span, j;
+	daddr_t idblock = *slot;
+	bool hasnonzero, iddirty, childchanged;
+	int result;
+
+	/* Number of file blocks under each entry */
+	span = 1;
+	for (j=1; j<level; j++) {
+		span *= SFS_DBPERIDB;
+	}
+
+	if (idblock == 0 || blocklen >= base + span * SFS_DBPERIDB) {
+		/* Nothing here, or all of it is before the new EOF */
+		return 0;
+	}
+
+	/* Our own copy; the per-vnode cache slots get reused below us. */
+	idbuf = kmalloc(SFS_BLOCKSIZE);
+	if (idbuf == NULL) {
+		return ENOMEM;
+	}
+	result = sfs_readblock(sfs, idblock, idbuf, SFS_BLOCKSIZE);
+	if (result) {
+		kfree(idbuf);
+		return result;
+	}
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (level > 1) {
+			childchanged = false;
+			result = sfs_itrunc_indirect(sv, &idbuf[j], level - 1,
+						     base + j * span, blocklen,
+						     &childchanged);
+			if (result) {
+				kfree(idbuf);
+				return result;
+			}
+			if (childchanged) {
+				iddirty = true;
+			}
+		}
+		else if (blocklen <= base + j && idbuf[j] != 0) {
+			/* Discard any blocks that are past the new EOF */
+			sfs_bfree(sfs, idbuf[j]);
+			idbuf[j] = 0;
+			iddirty = true;
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, idblock);
+		*slot = 0;
+		*changed = true;
+	}
+	else if (iddirty) {
+		/* The indirect block is dirty; write it back */
+		result = sfs_writeblock(sfs, idblock, idbuf, SFS_BLOCKSIZE);
+		if (result) {
+			kfree(idbuf);
+			return result;
+		}
+	}
+	kfree(idbuf);
+	return 0;
+}
 
+/*
+ * Called for ftruncate() and from sfs_reclaim, with the vnode locked.
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	uint32_t i;
+	daddr_t block;
+	uint32_t base;
+	bool changed;
 	int result;
-	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	/* The file isn't growing past here any time soon. */
+	sfs_prealloc_release(sv);
 
-	vfs_biglock_acquire();
+	/* Indirect blocks may be freed and reused; drop our copies. */
+	sfs_idcache_destroy(sv);
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -240,55 +406,26 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			vfs_biglock_release();
-			return result;
-		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+	/* Then the single, double, and triple indirect trees. */
+	changed = false;
+	base = SFS_NDIRECT;
+	result = sfs_itrunc_indirect(sv, &sv->sv_i.sfi_indirect, 1,
+				     base, blocklen, &changed);
+	if (result == 0) {
+		base += SFS_DBPERIDB;
+		result = sfs_itrunc_indirect(sv, &sv->sv_i.sfi_dindirect, 2,
+					     base, blocklen, &changed);
+	}
+	if (result == 0) {
+		base += SFS_DBPERIDB * SFS_DBPERIDB;
+		result = sfs_itrunc_indirect(sv, &sv->sv_i.sfi_tindirect, 3,
+					     base, blocklen, &changed);
+	}
+	if (changed) {
+		sv->sv_dirty = true;
+	}
+	if (result) {
+		return result;
 	}
 
 	/* Set the file size */
@@ -297,7 +434,5 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
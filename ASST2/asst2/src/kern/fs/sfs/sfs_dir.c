@@ -35,6 +35,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -95,13 +96,310 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Name index.
+
+/* Initial number of index chains; must be a power of 2. */
+#define SFS_DIRHASH_INITIAL  16
+
 /*
- * Search a directory for a particular filename in a directory, and
- * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * An in-memory index of a directory, built the first time the
+ * directory is searched and kept until the vnode is reclaimed. It
+ * maps each name to its slot and inode number, and keeps the empty
+ * slots in a min-heap, so creates reuse the lowest one and neither
+ * lookups nor creates have to read the directory. Everything is under
+ * the directory's sv_lock.
+ *
+ * The index is only a cache. If it can't be built or kept up to date
+ * for lack of memory, it is thrown away and searches go back to
+ * reading the directory until it can be built again.
+ */
+struct sfs_dirname {
+	struct sfs_dirname *dn_next;	/* next in hash chain */
+	char *dn_name;			/* name (kmalloc'd) */
+	int dn_slot;			/* slot it lives in */
+	uint32_t dn_ino;		/* inode it links to */
+};
+
+struct sfs_dirindex {
+	struct sfs_dirname **di_hash;	/* chains, by name hash */
+	unsigned di_hashsize;		/* number of chains */
+	unsigned di_count;		/* number of names */
+	int *di_free;			/* empty slots, a min-heap */
+	unsigned di_nfree;		/* number of empty slots */
+	unsigned di_maxfree;		/* allocated size of di_free */
+};
+
+static
+unsigned
+sfs_dirhash(const char *name)
+{
+	unsigned h = 5381;
+
+	while (*name != 0) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+void
+sfs_dirindex_destroy(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	struct sfs_dirname *dn, *next;
+	unsigned i;
+
+	if (di == NULL) {
+		return;
+	}
+	for (i=0; i<di->di_hashsize; i++) {
+		for (dn = di->di_hash[i]; dn != NULL; dn = next) {
+			next = dn->dn_next;
+			kfree(dn->dn_name);
+			kfree(dn);
+		}
+	}
+	kfree(di->di_hash);
+	kfree(di->di_free);
+	kfree(di);
+	sv->sv_dirindex = NULL;
+}
+
+static
+struct sfs_dirname *
+sfs_dirindex_find(struct sfs_dirindex *di, const char *name)
+{
+	struct sfs_dirname *dn;
+
+	dn = di->di_hash[sfs_dirhash(name) & (di->di_hashsize - 1)];
+	while (dn != NULL && strcmp(dn->dn_name, name)) {
+		dn = dn->dn_next;
+	}
+	return dn;
+}
+
+/*
+ * Double the number of chains. Failing is harmless; the chains just
+ * get longer.
  */
+static
+void
+sfs_dirindex_grow(struct sfs_dirindex *di)
+{
+	struct sfs_dirname **newhash, *dn, *next;
+	unsigned newsize, i, h;
+
+	newsize = di->di_hashsize * 2;
+	newhash = kmalloc(newsize * sizeof(struct sfs_dirname *));
+	if (newhash == NULL) {
+		return;
+	}
+	bzero(newhash, newsize * sizeof(struct sfs_dirname *));
+
+	for (i=0; i<di->di_hashsize; i++) {
+		for (dn = di->di_hash[i]; dn != NULL; dn = next) {
+			next = dn->dn_next;
+			h = sfs_dirhash(dn->dn_name) & (newsize - 1);
+			dn->dn_next = newhash[h];
+			newhash[h] = dn;
+		}
+	}
+	kfree(di->di_hash);
+	di->di_hash = newhash;
+	di->di_hashsize = newsize;
+}
+
+static
 int
-sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+sfs_dirindex_add(struct sfs_dirindex *di, const char *name, int slot,
+		 uint32_t ino)
+{
+	struct sfs_dirname *dn;
+	unsigned h;
+
+	dn = kmalloc(sizeof(*dn));
+	if (dn == NULL) {
+		return ENOMEM;
+	}
+	dn->dn_name = kstrdup(name);
+	if (dn->dn_name == NULL) {
+		kfree(dn);
+		return ENOMEM;
+	}
+	dn->dn_slot = slot;
+	dn->dn_ino = ino;
+
+	if (di->di_count >= di->di_hashsize) {
+		sfs_dirindex_grow(di);
+	}
+	h = sfs_dirhash(name) & (di->di_hashsize - 1);
+	dn->dn_next = di->di_hash[h];
+	di->di_hash[h] = dn;
+	di->di_count++;
+	return 0;
+}
+
+static
+void
+sfs_dirindex_remove(struct sfs_dirindex *di, const char *name)
+{
+	struct sfs_dirname **p, *dn;
+
+	p = &di->di_hash[sfs_dirhash(name) & (di->di_hashsize - 1)];
+	while (*p != NULL && strcmp((*p)->dn_name, name)) {
+		p = &(*p)->dn_next;
+	}
+	KASSERT(*p != NULL);
+	dn = *p;
+	*p = dn->dn_next;
+	kfree(dn->dn_name);
+	kfree(dn);
+	KASSERT(di->di_count > 0);
+	di->di_count--;
+}
+
+static
+int
+sfs_dirindex_pushfree(struct sfs_dirindex *di, int slot)
+{
+	int *newfree;
+	unsigned newmax, i;
+
+	if (di->di_nfree == di->di_maxfree) {
+		newmax = di->di_maxfree > 0 ? di->di_maxfree * 2 : 8;
+		newfree = kmalloc(newmax * sizeof(int));
+		if (newfree == NULL) {
+			return ENOMEM;
+		}
+		if (di->di_nfree > 0) {
+			memcpy(newfree, di->di_free, di->di_nfree * sizeof(int));
+		}
+		kfree(di->di_free);
+		di->di_free = newfree;
+		di->di_maxfree = newmax;
+	}
+
+	/* Move it up past any bigger parents. */
+	i = di->di_nfree++;
+	while (i > 0 && di->di_free[(i - 1) / 2] > slot) {
+		di->di_free[i] = di->di_free[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	di->di_free[i] = slot;
+	return 0;
+}
+
+/*
+ * Take the lowest empty slot off the heap.
+ */
+static
+void
+sfs_dirindex_popfree(struct sfs_dirindex *di)
+{
+	unsigned i, child;
+	int last;
+
+	KASSERT(di->di_nfree > 0);
+	last = di->di_free[--di->di_nfree];
+
+	/* Move the last one down from the top past any smaller children. */
+	i = 0;
+	while ((child = 2 * i + 1) < di->di_nfree) {
+		if (child + 1 < di->di_nfree &&
+		    di->di_free[child + 1] < di->di_free[child]) {
+			child++;
+		}
+		if (di->di_free[child] >= last) {
+			break;
+		}
+		di->di_free[i] = di->di_free[child];
+		i = child;
+	}
+	di->di_free[i] = last;
+}
+
+/*
+ * Build the index for a directory by reading it a block at a time.
+ */
+static
+int
+sfs_dirindex_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di;
+	struct sfs_direntry *sds;
+	int nentries, perblock, base, i, n, result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(sv->sv_dirindex == NULL);
+
+	nentries = sfs_dir_nentries(sv);
+	perblock = SFS_BLOCKSIZE / sizeof(struct sfs_direntry);
+
+	sds = kmalloc(SFS_BLOCKSIZE);
+	if (sds == NULL) {
+		return ENOMEM;
+	}
+	di = kmalloc(sizeof(*di));
+	if (di == NULL) {
+		kfree(sds);
+		return ENOMEM;
+	}
+	di->di_hashsize = SFS_DIRHASH_INITIAL;
+	di->di_hash = kmalloc(di->di_hashsize * sizeof(struct sfs_dirname *));
+	if (di->di_hash == NULL) {
+		kfree(di);
+		kfree(sds);
+		return ENOMEM;
+	}
+	bzero(di->di_hash, di->di_hashsize * sizeof(struct sfs_dirname *));
+	di->di_count = 0;
+	di->di_free = NULL;
+	di->di_nfree = 0;
+	di->di_maxfree = 0;
+	sv->sv_dirindex = di;
+
+	result = 0;
+	for (base = 0; base < nentries && result == 0; base += perblock) {
+		n = nentries - base;
+		if (n > perblock) {
+			n = perblock;
+		}
+		result = sfs_metaio(sv, base * sizeof(struct sfs_direntry),
+				    sds, n * sizeof(struct sfs_direntry),
+				    UIO_READ);
+		for (i=0; i<n && result == 0; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				result = sfs_dirindex_pushfree(di, base + i);
+				continue;
+			}
+			/* Ensure null termination, just in case */
+			sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+
+			/* Each name may legally appear only once... */
+			KASSERT(sfs_dirindex_find(di, sds[i].sfd_name) == NULL);
+
+			result = sfs_dirindex_add(di, sds[i].sfd_name,
+						  base + i, sds[i].sfd_ino);
+		}
+	}
+	kfree(sds);
+
+	if (result) {
+		sfs_dirindex_destroy(sv);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Directory operations.
+
+/*
+ * Search a directory the slow way, reading every slot, for when the
+ * index can't be built.
+ */
+static
+int
+sfs_dir_scan(struct sfs_vnode *sv, const char *name,
 		uint32_t *ino, int *slot, int *emptyslot)
 {
 	struct sfs_direntry tsd;
@@ -146,6 +444,40 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Search a directory for a particular filename in a directory, and
+ * return its inode number, its slot, and/or the slot number of an
+ * empty directory slot if one is found.
+ */
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirindex *di;
+	struct sfs_dirname *dn;
+
+	if (sv->sv_dirindex == NULL && sfs_dirindex_build(sv) != 0) {
+		return sfs_dir_scan(sv, name, ino, slot, emptyslot);
+	}
+	di = sv->sv_dirindex;
+
+	if (emptyslot != NULL && di->di_nfree > 0) {
+		*emptyslot = di->di_free[0];
+	}
+
+	dn = sfs_dirindex_find(di, name);
+	if (dn == NULL) {
+		return ENOENT;
+	}
+	if (slot != NULL) {
+		*slot = dn->dn_slot;
+	}
+	if (ino != NULL) {
+		*ino = dn->dn_ino;
+	}
+	return 0;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
@@ -153,6 +485,7 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
+	struct sfs_dirindex *di;
 	int emptyslot = -1;
 	int result;
 	struct sfs_direntry sd;
@@ -186,7 +519,22 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Update the index to match. */
+	di = sv->sv_dirindex;
+	if (di != NULL) {
+		if (di->di_nfree > 0 && di->di_free[0] == emptyslot) {
+			sfs_dirindex_popfree(di);
+		}
+		if (sfs_dirindex_add(di, name, emptyslot, ino)) {
+			sfs_dirindex_destroy(sv);
+		}
+	}
+	return 0;
 }
 
 /*
@@ -195,19 +543,42 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
-	struct sfs_direntry sd;
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	struct sfs_direntry sd, old;
+	int result;
+
+	/* Get the name being removed, to take it out of the index. */
+	if (di != NULL) {
+		result = sfs_readdir(sv, slot, &old);
+		if (result) {
+			return result;
+		}
+		KASSERT(old.sfd_ino != SFS_NOINO);
+		old.sfd_name[sizeof(old.sfd_name)-1] = 0;
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+
+	if (di != NULL) {
+		sfs_dirindex_remove(di, old.sfd_name);
+		if (sfs_dirindex_pushfree(di, slot)) {
+			sfs_dirindex_destroy(sv);
+		}
+	}
+	return 0;
 }
 
 /*
  * Look for a name in a directory and hand back a vnode for the
- * file, if there is one.
+ * file, if there is one. The directory must be locked.
  */
 int
 sfs_lookonce(struct sfs_vnode *sv, const char *name,
@@ -228,11 +599,13 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		return result;
 	}
 
+	lock_acquire((*ret)->sv_lock);
 	if ((*ret)->sv_i.sfi_linkcount == 0) {
 		panic("sfs: %s: name %s (inode %u) in dir %u has "
 		      "linkcount 0\n", sfs->sfs_sb.sb_volname,
 		      name, (*ret)->sv_ino, sv->sv_ino);
 	}
+	lock_release((*ret)->sv_lock);
 
 	return 0;
 }
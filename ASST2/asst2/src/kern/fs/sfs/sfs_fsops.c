@@ -39,8 +39,10 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -107,19 +109,60 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 
 /*
  * Sync routine for the vnode table.
+ *
+ * We can't hold sfs_vnlock while syncing an inode: that takes the
+ * vnode's own lock, and the lock order is the other way around. So
+ * take a reference to each loaded vnode under the table lock, then
+ * sync and release them with the table unlocked.
+ *
+ * This only gets the inodes into the buffer cache; sfs_sync flushes
+ * the cache once everything is in it.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
+	struct vnodearray *snap;
+	struct vnode *v;
+	struct sfs_vnode *sv;
 	unsigned i, num;
+	int result;
+
+	snap = vnodearray_create();
+	if (snap == NULL) {
+		return ENOMEM;
+	}
+
+	lock_acquire(sfs->sfs_vnlock);
+	result = vnodearray_setsize(snap, sfs->sfs_nvnodes);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		vnodearray_destroy(snap);
+		return result;
+	}
+	num = 0;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL;
+		     sv = sv->sv_hashnext) {
+			VOP_INCREF(&sv->sv_absvn);
+			vnodearray_set(snap, num++, &sv->sv_absvn);
+		}
+	}
+	KASSERT(num == sfs->sfs_nvnodes);
+	lock_release(sfs->sfs_vnlock);
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	/* Go over the snapshot, syncing as we go. */
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		v = vnodearray_get(snap, i);
+		sv = v->vn_data;
+		lock_acquire(sv->sv_lock);
+		sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		VOP_DECREF(v);
 	}
+
+	vnodearray_setsize(snap, 0);
+	vnodearray_destroy(snap);
 	return 0;
 }
 
@@ -132,13 +175,16 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
@@ -152,14 +198,17 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_superlock);
 	if (sfs->sfs_superdirty) {
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
+			lock_release(sfs->sfs_superlock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
+	lock_release(sfs->sfs_superlock);
 	return 0;
 }
 
@@ -174,8 +223,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,25 +258,27 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
+	/* All of that may still be sitting in the buffer cache. */
+	result = buf_flush(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
+
 	return 0;
 }
 
@@ -243,13 +292,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* The volume name is set at mount time and never changes. */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -262,7 +307,10 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	sfs_vnhash_cleanup(sfs);
+	lock_destroy(sfs->sfs_superlock);
+	lock_destroy(sfs->sfs_freemaplock);
+	lock_destroy(sfs->sfs_vnlock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -277,19 +325,30 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-
-	vfs_biglock_acquire();
+	int result;
 
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/*
+	 * A vnode reclaimed since then may have left its inode dirty
+	 * in the buffer cache; write it before dropping our blocks.
+	 */
+	result = buf_flush(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
+	buf_invalidate(sfs->sfs_device);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +356,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -351,17 +409,36 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	if (sfs_vnhash_init(sfs)) {
 		goto cleanup_object;
 	}
+	sfs->sfs_vnlock = lock_create("sfs_vnodes");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_vnodes;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemaplock = lock_create("sfs_freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnlock;
+	}
+
+	/* superblock lock */
+	sfs->sfs_superlock = lock_create("sfs_super");
+	if (sfs->sfs_superlock == NULL) {
+		goto cleanup_freemaplock;
+	}
 
 	return sfs;
 
+cleanup_freemaplock:
+	lock_destroy(sfs->sfs_freemaplock);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
+cleanup_vnodes:
+	sfs_vnhash_cleanup(sfs);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -388,8 +465,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -402,7 +477,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -410,20 +484,24 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
 	/* Set the device so we can use sfs_readblock() */
 	sfs->sfs_device = dev;
 
+	/*
+	 * The raw device may have been written (by mksfs, say) since
+	 * we last had it mounted; don't trust anything cached.
+	 */
+	buf_invalidate(dev);
+
 	/* Load superblock */
 	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 			       sizeof(sfs->sfs_sb));
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,7 +514,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -453,21 +530,19 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (sfs->sfs_freemap == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
+	bitmap_datachanged(sfs->sfs_freemap);
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -35,13 +35,137 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
+#include "opt-sfscheck.h"
+
+/* Initial number of vnode table chains; must be a power of 2. */
+#define SFS_VNHASH_INITIAL  64
+
+////////////////////////////////////////////////////////////
+// Vnode table.
+
+/*
+ * Loaded vnodes live in a chained hash table keyed by inode number,
+ * under sfs_vnlock. Inode numbers are block numbers and tend to come
+ * in runs, so the low bits make a fine hash. The table doubles when
+ * there are more vnodes than chains; if it can't, chains just get
+ * longer.
+ */
+
+int
+sfs_vnhash_init(struct sfs_fs *sfs)
+{
+	sfs->sfs_vnhashsize = SFS_VNHASH_INITIAL;
+	sfs->sfs_vnhash = kmalloc(sfs->sfs_vnhashsize *
+				  sizeof(struct sfs_vnode *));
+	if (sfs->sfs_vnhash == NULL) {
+		return ENOMEM;
+	}
+	bzero(sfs->sfs_vnhash, sfs->sfs_vnhashsize * sizeof(struct sfs_vnode *));
+	sfs->sfs_nvnodes = 0;
+	return 0;
+}
+
+void
+sfs_vnhash_cleanup(struct sfs_fs *sfs)
+{
+	KASSERT(sfs->sfs_nvnodes == 0);
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = NULL;
+}
+
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	sv = sfs->sfs_vnhash[ino & (sfs->sfs_vnhashsize - 1)];
+	while (sv != NULL && sv->sv_ino != ino) {
+		sv = sv->sv_hashnext;
+	}
+	return sv;
+}
+
+static
+void
+sfs_vnhash_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **newhash, *sv, *next;
+	unsigned newsize, i, h;
+
+	newsize = sfs->sfs_vnhashsize * 2;
+	newhash = kmalloc(newsize * sizeof(struct sfs_vnode *));
+	if (newhash == NULL) {
+		return;
+	}
+	bzero(newhash, newsize * sizeof(struct sfs_vnode *));
+
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = next) {
+			next = sv->sv_hashnext;
+			h = sv->sv_ino & (newsize - 1);
+			sv->sv_hashnext = newhash[h];
+			newhash[h] = sv;
+		}
+	}
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = newhash;
+	sfs->sfs_vnhashsize = newsize;
+}
+
+static
+void
+sfs_vnhash_insert(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned h;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	if (sfs->sfs_nvnodes >= sfs->sfs_vnhashsize) {
+		sfs_vnhash_grow(sfs);
+	}
+	h = sv->sv_ino & (sfs->sfs_vnhashsize - 1);
+	sv->sv_hashnext = sfs->sfs_vnhash[h];
+	sfs->sfs_vnhash[h] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **p;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	p = &sfs->sfs_vnhash[sv->sv_ino & (sfs->sfs_vnhashsize - 1)];
+	while (*p != NULL && *p != sv) {
+		p = &(*p)->sv_hashnext;
+	}
+	if (*p == NULL) {
+		panic("sfs: %s: reclaim vnode %u not in vnode table\n",
+		      sfs->sfs_sb.sb_volname, sv->sv_ino);
+	}
+	*p = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+	KASSERT(sfs->sfs_nvnodes > 0);
+	sfs->sfs_nvnodes--;
+}
+
+////////////////////////////////////////////////////////////
+// Inodes.
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out to disk. The vnode must
+ * be locked.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,6 +173,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -70,15 +196,21 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	/*
+	 * Lock order is vnode first, then the table. Nobody else can
+	 * hold the vnode lock for long: they'd need a reference, and
+	 * we'll see it below and back off.
+	 */
+	lock_acquire(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. sfs_loadvnode hands out
+	 * references only while holding sfs_vnlock, so once we have
+	 * it the count can't go up.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,16 +220,24 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/*
+	 * Keep the vnode in the table until it's written back, so a
+	 * concurrent load waits for us instead of reading a stale
+	 * inode from disk.
+	 */
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_vnlock);
+			lock_release(sv->sv_lock);
 			return result;
 		}
 	}
@@ -105,35 +245,36 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
+	/* Give back any blocks reserved for appends that never came */
+	sfs_prealloc_release(sv);
+
+	/* Drop the directory name index and indirect blocks, if any */
+	sfs_dirindex_destroy(sv);
+	sfs_idcache_destroy(sv);
+
+	/* The inode block can leave the buffer cache now */
+	buf_unpin(sfs->sfs_device, sv->sv_ino);
+
 	/* If there are no on-disk references, discard the inode */
 	if (sv->sv_i.sfi_linkcount==0) {
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnhash_remove(sfs, sv);
+
+	lock_release(sfs->sfs_vnlock);
 
 	vnode_cleanup(&sv->sv_absvn);
 
-	vfs_biglock_release();
+	/* Nobody can find the vnode any more; tear down its lock. */
+	lock_release(sv->sv_lock);
+	lock_destroy(sv->sv_lock);
 
 	/* Release the storage for the vnode structure itself. */
 	kfree(sv);
@@ -143,43 +284,36 @@ sfs_reclaim(struct vnode *v)
 }
 
 /*
- * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * Guts of sfs_loadvnode.
  */
+static
 int
-sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
-		 struct sfs_vnode **ret)
+sfs_loadvnode_locked(struct sfs_fs *sfs, uint32_t ino, int forcetype,
+		     struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
 
+	/* Look in the vnodes table */
+	sv = sfs_vnhash_find(sfs, ino);
+	if (sv != NULL) {
+#if OPT_SFSCHECK
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
+#endif
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
@@ -202,6 +336,16 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		return result;
 	}
 
+	/*
+	 * Keep the inode block in the buffer cache while the vnode is
+	 * loaded; we rewrite it on every sync.
+	 */
+	result = buf_pin(sfs->sfs_device, ino);
+	if (result) {
+		kfree(sv);
+		return result;
+	}
+
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
@@ -232,29 +376,60 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		      ino, sv->sv_i.sfi_type);
 	}
 
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		buf_unpin(sfs->sfs_device, ino);
+		kfree(sv);
+		return ENOMEM;
+	}
+
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
+		buf_unpin(sfs->sfs_device, ino);
 		kfree(sv);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_allochint = 0;
+	sv->sv_prealloc = 0;
+	sv->sv_nprealloc = 0;
+	sv->sv_hashnext = NULL;
+	sv->sv_dirindex = NULL;
+	sv->sv_idcache = NULL;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnhash_insert(sfs, sv);
 
 	/* Hand it back */
 	*ret = sv;
 	return 0;
 }
 
+/*
+ * Function to load a inode into memory as a vnode, or dig up one
+ * that's already resident.
+ *
+ * The whole thing runs under sfs_vnlock, so two loads of the same
+ * inode can't both miss in the table, and sfs_reclaim can't discard
+ * a vnode we're handing a new reference to.
+ */
+int
+sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
+		 struct sfs_vnode **ret)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+	result = sfs_loadvnode_locked(sfs, ino, forcetype, ret);
+	lock_release(sfs->sfs_vnlock);
+
+	return result;
+}
+
 /*
  * Create a new filesystem object and hand back its vnode.
  */
@@ -296,25 +471,21 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
+	/* The type never changes once loaded; no need to lock */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
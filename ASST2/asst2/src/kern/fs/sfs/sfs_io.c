@@ -36,8 +36,10 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -53,23 +55,31 @@
  */
 
 /*
- * Read or write a block, retrying I/O errors.
+ * Read or write a block through the buffer cache, retrying I/O
+ * errors.
+ *
+ * No SFS lock is needed: the cache and the device serialize
+ * requests themselves.
  */
 static
 int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+sfs_rwblock(struct sfs_fs *sfs, daddr_t block, void *data, enum uio_rw rw)
 {
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	DEBUG(DB_SFS, "sfs: %s %u\n",
+	      rw == UIO_READ ? "read" : "write", block);
 
  retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
+	if (rw == UIO_READ) {
+		result = buf_read(sfs->sfs_device, block, data,
+				  SFS_BLOCKSIZE);
+	}
+	else {
+		result = buf_write(sfs->sfs_device, block, data,
+				   SFS_BLOCKSIZE);
+	}
 	if (result == EINVAL) {
 		/*
 		 * This means the sector we requested was out of range,
@@ -82,9 +92,8 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	if (result == EIO) {
 		if (tries == 0) {
 			tries++;
-			kprintf("sfs: %s: block %llu I/O error, retrying\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE);
+			kprintf("sfs: %s: block %u I/O error, retrying\n",
+				sfs->sfs_sb.sb_volname, block);
 			goto retry;
 		}
 		else if (tries < 10) {
@@ -92,10 +101,9 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 			goto retry;
 		}
 		else {
-			kprintf("sfs: %s: block %llu I/O error, giving up "
+			kprintf("sfs: %s: block %u I/O error, giving up "
 				"after %d retries\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
+				sfs->sfs_sb.sb_volname, block, tries);
 		}
 	}
 	return result;
@@ -107,13 +115,9 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
-
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	return sfs_rwblock(sfs, block, data, UIO_READ);
 }
 
 /*
@@ -122,13 +126,9 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
-
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	return sfs_rwblock(sfs, block, data, UIO_WRITE);
 }
 
 ////////////////////////////////////////////////////////////
@@ -151,13 +151,10 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
 	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
+	 * I/O buffer for handling partial sectors. Allocated per call
+	 * so that I/O on different files doesn't share it.
 	 */
-	static char iobuf[SFS_BLOCKSIZE];
+	char *iobuf;
 
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t diskblock;
@@ -168,9 +165,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -181,21 +176,26 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		return result;
 	}
 
+	iobuf = kmalloc(SFS_BLOCKSIZE);
+	if (iobuf == NULL) {
+		return ENOMEM;
+	}
+
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
 		 * Zero the buffer.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		bzero(iobuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
 		 * Read the block.
 		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
+		result = sfs_readblock(sfs, diskblock, iobuf, SFS_BLOCKSIZE);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
@@ -204,20 +204,19 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	result = uiomove(iobuf+skipstart, len, uio);
 	if (result) {
-		return result;
+		goto out;
 	}
 
 	/*
 	 * If it was a write, write back the modified block.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		result = sfs_writeblock(sfs, diskblock, iobuf, SFS_BLOCKSIZE);
 	}
 
-	return 0;
+ out:
+	kfree(iobuf);
+	return result;
 }
 
 /*
@@ -230,12 +229,9 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t diskblock;
 	uint32_t fileblock;
+	char *iobuf;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -258,35 +254,38 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
+	 * The block has to pass through the buffer cache, so we can't
+	 * hand the uio region to the device directly; copy through a
+	 * kernel buffer instead.
 	 */
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
 
-	result = sfs_rwblock(sfs, uio);
+	iobuf = kmalloc(SFS_BLOCKSIZE);
+	if (iobuf == NULL) {
+		return ENOMEM;
+	}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_readblock(sfs, diskblock, iobuf, SFS_BLOCKSIZE);
+		if (result == 0) {
+			result = uiomove(iobuf, SFS_BLOCKSIZE, uio);
+		}
+	}
+	else {
+		result = uiomove(iobuf, SFS_BLOCKSIZE, uio);
+		if (result == 0) {
+			result = sfs_writeblock(sfs, diskblock, iobuf,
+						SFS_BLOCKSIZE);
+		}
+	}
 
+	kfree(iobuf);
 	return result;
 }
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ * The vnode must be locked.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
@@ -296,6 +295,8 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	origresid = uio->uio_resid;
 
 	/*
@@ -414,17 +415,10 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
+	/* I/O buffer for metadata ops; allocated per call. */
+	char *metaiobuf;
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
@@ -446,15 +440,22 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
+	metaiobuf = kmalloc(SFS_BLOCKSIZE);
+	if (metaiobuf == NULL) {
+		return ENOMEM;
+	}
+
 	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	result = sfs_readblock(sfs, diskblock, metaiobuf, SFS_BLOCKSIZE);
 	if (result) {
+		kfree(metaiobuf);
 		return result;
 	}
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
 		memcpy(data, metaiobuf + blockoffset, len);
+		kfree(metaiobuf);
 	}
 	else {
 		/* Update the selected region */
@@ -462,7 +463,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 
 		/* Write the block back */
 		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
+					metaiobuf, SFS_BLOCKSIZE);
+		kfree(metaiobuf);
 		if (result) {
 			return result;
 		}
@@ -39,13 +39,37 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
 
 
+#if !OPT_DUMBVM
+/*
+ * Size of the user stack region, in pages. Nothing is allocated for
+ * it until it's touched, so it can be generous.
+ */
+#define VM_STACKPAGES    1024
+
+/*
+ * A region of the address space: a segment of the executable, or the
+ * stack. Pages in it are filled in when first touched: from the
+ * executable if they overlap the part of the segment in the file,
+ * with zeros otherwise.
+ */
+struct region {
+        vaddr_t rg_base;                /* first page */
+        vaddr_t rg_top;                 /* page after the last */
+        bool rg_writeable;
+        struct vnode *rg_vn;            /* file the data is in, or NULL */
+        vaddr_t rg_fileva;              /* where the file data starts */
+        off_t rg_fileoffset;            /* and where it is in the file */
+        size_t rg_filesize;             /* and how much of it there is */
+        struct region *rg_next;
+};
+#endif
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
- *
- * You write this.
  */
 
 struct addrspace {
@@ -58,7 +82,11 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct region *as_regions;      /* segments and stack */
+        struct pagetable *as_pt;        /* where the pages are */
+        unsigned as_asid;               /* TLB address space ID, */
+        unsigned as_asidcpu;            /*   good on this cpu */
+        unsigned as_asidgen;            /*   in this generation */
 #endif
 };
 
@@ -99,6 +127,41 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_pin    - make sure the pages from VADDR to VADDR+LEN are in
+ *                memory, for writing if WRITE, and keep them there
+ *                until as_unpin is called on the same range. For moving
+ *                data to or from user memory while holding locks a
+ *                fault might need. EFAULT if they aren't all there to
+ *                be had; nothing is left pinned then.
+ *
+ *    as_unpin  - undo as_pin.
+ *
+ *    as_define_file - like as_define_region, but the first FILESIZE
+ *                bytes of the region are at OFFSET in the file V, and
+ *                are read in a page at a time as they're touched.
+ *                Holds a reference to V.
+ *
+ *    as_fault  - make sure the page at VADDR is in memory, reading it
+ *                in from swap or the executable, or zero-filling it if
+ *                it's never been touched. Hands back its physical
+ *                address and whether it may be written yet. EFAULT if
+ *                VADDR isn't in a region or FAULTTYPE is a write to a
+ *                read-only region. The page comes back pinned, so it
+ *                can't be paged out before it's mapped; call
+ *                coremap_unpin when done.
+ *
+ *    as_quickfault - vm_fault's fast path: if the page at VADDR is in
+ *                memory and as_fault would hand it back as it is,
+ *                hand it back without taking any locks; otherwise
+ *                return false. Must be called with interrupts off,
+ *                and the page loaded into the TLB before they're
+ *                turned back on. Not pinned.
+ *
+ *    as_bootstrap - set up the locks; called from vm_bootstrap.
+ *
+ *    as_pageout - page out up to MAX pages; called by the pageout
+ *                thread in swap.c. Returns how many it freed.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +180,25 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_pin(struct addrspace *as, vaddr_t vaddr, size_t len,
+                         bool write);
+void              as_unpin(struct addrspace *as, vaddr_t vaddr, size_t len);
+#if !OPT_DUMBVM
+int               as_define_file(struct addrspace *as,
+                                 vaddr_t vaddr, size_t memsize,
+                                 struct vnode *v, off_t offset,
+                                 size_t filesize,
+                                 int readable,
+                                 int writeable,
+                                 int executable);
+int               as_fault(struct addrspace *as, vaddr_t vaddr,
+                           int faulttype, paddr_t *paddr, bool *writeable);
+bool              as_quickfault(struct addrspace *as, vaddr_t vaddr,
+                                int faulttype, paddr_t *paddr,
+                                bool *writeable);
+void              as_bootstrap(void);
+unsigned          as_pageout(unsigned max);
+#endif
 
 
 /*
@@ -37,7 +37,14 @@
  *     bitmap_create  - allocate a new bitmap object.
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
- *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *     bitmap_alloc   - locate the lowest cleared bit, set it, and return
+ *                      its index.
+ *     bitmap_alloc_range - locate the lowest run of COUNT cleared bits,
+ *                      set them, and return the index of the first.
+ *     bitmap_findrange - locate the first run of COUNT cleared bits at
+ *                      or after START without setting them.
+ *     bitmap_datachanged - call after changing the data returned by
+ *                      bitmap_getdata (e.g. reading it in from disk).
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
@@ -49,7 +56,12 @@ struct bitmap;  /* Opaque. */
 
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
+void           bitmap_datachanged(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_range(struct bitmap *, unsigned count,
+                                  unsigned *index);
+int            bitmap_findrange(struct bitmap *, unsigned start,
+                                unsigned count, unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
 int            bitmap_isset(struct bitmap *, unsigned index);
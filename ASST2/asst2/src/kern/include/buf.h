@@ -0,0 +1,108 @@
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Buffer cache.
+ *
+ * Caches disk blocks in memory, keyed by (device, block number).
+ * Filesystems call buf_read and buf_write instead of issuing
+ * DEVOP_IO themselves.
+ *
+ * In write-back mode (the default) buf_write just updates the cached
+ * copy. A syncer thread writes dirty blocks out every few seconds,
+ * or sooner if most of the cache is dirty; blocks that are next to
+ * each other on disk go out in a single request. buf_flush forces
+ * them out at once. In write-through mode buf_write goes straight
+ * to the disk.
+ *
+ * buf_readahead asks for a block to be loaded in the background, for
+ * filesystems that can tell what will be read next. Requests for
+ * consecutive blocks are read from the disk together.
+ *
+ * The cache holds up to buf_getmax() blocks and replaces the least
+ * recently used one when it is full. A pinned block is never
+ * replaced; this is for metadata the filesystem knows it will keep
+ * coming back to. If every buffer is pinned or in use, the cache
+ * grows past its limit rather than wait, and shrinks back as
+ * buffers are released. A limit of 0 turns caching off: every read
+ * misses and goes to the disk.
+ *
+ * Functions:
+ *     buf_bootstrap   - initialize; called from vfs_bootstrap.
+ *     buf_start_threads - start the syncer and read-ahead threads;
+ *                       called from boot.
+ *     buf_timerclock  - called once a second from timerclock.
+ *     buf_read        - read a block, from the cache if possible.
+ *     buf_write       - write a block through the cache.
+ *     buf_readahead   - start loading a block into the cache without
+ *                       waiting for it. Only a hint: may be dropped.
+ *     buf_flush       - write back the dirty blocks of a device, or of
+ *                       every device if given NULL.
+ *     buf_pin         - read a block and keep it in the cache.
+ *     buf_unpin       - undo one buf_pin.
+ *     buf_invalidate  - discard every cached block of a device. No
+ *                       block of the device may be pinned or dirty.
+ *     buf_getmax      - get the size limit, in blocks.
+ *     buf_setmax      - set the size limit, in blocks.
+ *     buf_getwriteback - get the write mode and syncer interval.
+ *     buf_setwriteback - set them. An interval of 0 means the syncer
+ *                       only runs when the cache fills with dirty
+ *                       blocks. Turning write-back off flushes.
+ *     buf_getstats    - copy out the counters.
+ *     buf_printstats  - print the counters.
+ *     buf_resetstats  - zero the counters.
+ *
+ * Hits and misses count reads only; a full-block write doesn't care
+ * what was in the buffer before.
+ */
+
+/* Size of a cached block. Devices using the cache must match. */
+#define BUF_BLOCKSIZE      512
+
+/* Default size limit, in blocks. */
+#define BUF_DEFAULT_NBUFS  256
+
+/* Default syncer interval, in seconds. */
+#define BUF_DEFAULT_SYNCSECS  5
+
+struct device;
+
+struct bufstats {
+	unsigned bs_nbufs;		/* buffers currently allocated */
+	unsigned bs_npinned;		/* of those, how many pinned */
+	unsigned bs_ndirty;		/* of those, how many dirty */
+	unsigned bs_hits;		/* reads satisfied from memory */
+	unsigned bs_misses;		/* reads that went to the disk */
+	unsigned bs_evictions;		/* valid blocks thrown out */
+	unsigned bs_devreads;		/* DEVOP_IO reads issued */
+	unsigned bs_devwrites;		/* DEVOP_IO writes issued */
+	unsigned bs_writeblocks;	/* blocks those writes covered */
+	unsigned bs_syncs;		/* times the syncer ran */
+	unsigned bs_rablocks;		/* blocks read ahead */
+	unsigned bs_rahits;		/* of those, how many then read */
+};
+
+void buf_bootstrap(void);
+void buf_start_threads(void);
+void buf_timerclock(void);
+
+int buf_read(struct device *dev, daddr_t block, void *data, size_t len);
+int buf_write(struct device *dev, daddr_t block, const void *data,
+	      size_t len);
+void buf_readahead(struct device *dev, daddr_t block);
+int buf_flush(struct device *dev);
+int buf_pin(struct device *dev, daddr_t block);
+void buf_unpin(struct device *dev, daddr_t block);
+void buf_invalidate(struct device *dev);
+
+unsigned buf_getmax(void);
+void buf_setmax(unsigned nbufs);
+bool buf_getwriteback(unsigned *syncsecs);
+void buf_setwriteback(bool writeback, unsigned syncsecs);
+
+void buf_getstats(struct bufstats *stats);
+void buf_printstats(void);
+void buf_resetstats(void);
+
+
+#endif /* _BUF_H_ */
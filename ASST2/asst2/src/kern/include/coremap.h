@@ -0,0 +1,96 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page frame allocator.
+ *
+ * The coremap has one entry for every page of physical memory. Free
+ * pages are kept on a list so single pages can be allocated and freed
+ * in constant time; runs of several contiguous pages (for kmalloc of
+ * large blocks) are found by scanning the map. Each cpu also keeps a
+ * small cache of free pages of its own, so most single-page
+ * allocations and frees don't touch the global lock.
+ *
+ * Pages handed out before coremap_bootstrap (with ram_stealmem) are
+ * never managed; freeing one of them does nothing.
+ *
+ * Functions:
+ *     coremap_bootstrap  - take over physical memory from ram.c;
+ *                          called from vm_bootstrap.
+ *     coremap_alloc      - allocate NPAGES contiguous pages for the
+ *                          kernel. Returns the physical address of
+ *                          the first, or 0 if there's no room.
+ *     coremap_alloc_user - allocate one page for user address space AS
+ *                          at VADDR. Returns 0 if there's no room. The
+ *                          page comes back busy.
+ *     coremap_share      - add a reference to a user page, for another
+ *                          address space sharing it copy-on-write.
+ *     coremap_claim      - if AS is the only one left using a shared
+ *                          user page, make it the owner (at VADDR)
+ *                          and return true.
+ *     coremap_free       - free pages allocated with coremap_alloc or
+ *                          coremap_alloc_user. A shared user page is
+ *                          only freed when the last reference goes.
+ *     coremap_unbusy     - a busy user page is ready for use.
+ *     coremap_isbusy     - check whether a user page is busy; it's
+ *                          being filled or paged out.
+ *     coremap_pin        - keep a user page from being paged out while
+ *                          a fault maps it, and note it's been used.
+ *     coremap_unpin      - undo coremap_pin.
+ *     coremap_touch      - note a user page has been used, unless it's
+ *                          busy or not a user page; returns whether
+ *                          it was. Safe to call on a page that may
+ *                          have just been freed.
+ *     coremap_getslot    - get the swap slot holding a copy of a user
+ *                          page, or COREMAP_NOSLOT.
+ *     coremap_setslot    - set it.
+ *     coremap_getowner   - get the owner of a user page and where it is
+ *                          there. AS is NULL if the page is shared.
+ *     coremap_pickvictims - choose up to MAX user pages to page out,
+ *                          by clock, and mark them busy. Returns how
+ *                          many it found.
+ *     coremap_countfree  - roughly how many pages are free.
+ *     coremap_getstats   - copy out the counters.
+ *     coremap_printstats - print the counters.
+ */
+
+struct addrspace;
+
+/* No swap slot. */
+#define COREMAP_NOSLOT	((unsigned)-1)
+
+struct coremapstats {
+	unsigned cs_npages;		/* pages managed */
+	unsigned cs_nfree;		/* of those, how many free */
+	unsigned cs_ncached;		/* of those, how many in cpu caches */
+	unsigned cs_nkernel;		/* pages allocated to the kernel */
+	unsigned cs_nuser;		/* pages allocated to processes */
+	unsigned cs_allocs;		/* successful coremap_alloc calls */
+	unsigned cs_frees;		/* coremap_free calls */
+	unsigned cs_failures;		/* coremap_alloc calls that failed */
+	unsigned cs_cachehits;		/* allocs served from a cpu cache */
+};
+
+void coremap_bootstrap(void);
+
+paddr_t coremap_alloc(unsigned npages);
+paddr_t coremap_alloc_user(struct addrspace *as, vaddr_t vaddr);
+void coremap_share(paddr_t paddr);
+bool coremap_claim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_free(paddr_t paddr);
+void coremap_unbusy(paddr_t paddr);
+bool coremap_isbusy(paddr_t paddr);
+void coremap_pin(paddr_t paddr);
+void coremap_unpin(paddr_t paddr);
+bool coremap_touch(paddr_t paddr);
+unsigned coremap_getslot(paddr_t paddr);
+void coremap_setslot(paddr_t paddr, unsigned slot);
+void coremap_getowner(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr);
+unsigned coremap_pickvictims(paddr_t *victims, unsigned max);
+unsigned coremap_countfree(void);
+
+void coremap_getstats(struct coremapstats *stats);
+void coremap_printstats(void);
+
+
+#endif /* _COREMAP_H_ */
@@ -62,6 +62,17 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 *
+	 * TLB address space IDs (not used by dumbvm). Those from 1 up
+	 * to c_asidnext have been handed out in generation c_asidgen,
+	 * and c_asid is the one loaded now, or 0 for none.
+	 */
+	unsigned c_asid;
+	unsigned c_asidnext;
+	unsigned c_asidgen;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -69,6 +80,9 @@ struct cpu {
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
+	unsigned c_migrated_out;	/* Threads moved to other cpus */
+	unsigned c_migrated_in;		/* Threads pushed here */
+	unsigned c_stolen;		/* Threads this cpu stole */
 
 	/*
 	 * Accessed by other cpus.
@@ -155,6 +169,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends that to all CPUs except the current
+ * one, and returns how many it sent.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +185,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,81 @@
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+/*
+ * Name cache.
+ *
+ * Remembers what vfs_lookup found for each (directory vnode, name)
+ * pair it looked up one component at a time, so repeated lookups of
+ * the same path don't go back to the filesystem. An entry either
+ * names a vnode or records that the name doesn't exist (a negative
+ * entry). Entries hold a reference to the directory and to the vnode
+ * they name.
+ *
+ * The VFS pathname operations tell the cache when they change a
+ * directory; anything that changes names behind their back (a
+ * filesystem shared with another machine, say) will be seen late.
+ * The cache holds up to dcache_getmax() entries and throws out the
+ * least recently used one when full. A limit of 0 turns it off.
+ *
+ * Functions:
+ *     dcache_bootstrap  - initialize; called from vfs_bootstrap.
+ *     dcache_lookup     - look up NAME in DIR. Returns true on a hit,
+ *                         handing back a referenced vnode, or NULL
+ *                         for a negative entry.
+ *     dcache_generation - get the invalidation count; pass it to
+ *                         dcache_enter.
+ *     dcache_enter      - remember what a lookup found (NULL for
+ *                         ENOENT). Ignored if anything has been
+ *                         invalidated since GEN was read, since the
+ *                         answer may already be stale.
+ *     dcache_invalidate - forget NAME in DIR after it was created,
+ *                         removed, or renamed. If ISDIR, NAME may
+ *                         have been a directory that is now gone, so
+ *                         forget what was cached under it too.
+ *     dcache_purgefs    - forget everything on a filesystem, so its
+ *                         vnodes can be released before unmounting.
+ *     dcache_getmax     - get the size limit, in entries.
+ *     dcache_setmax     - set the size limit, in entries.
+ *     dcache_getstats   - copy out the counters.
+ *     dcache_printstats - print the counters.
+ *     dcache_resetstats - zero the counters.
+ */
+
+/*
+ * Default size limit, in entries. An entry keeps its vnode loaded, and
+ * SFS keeps a loaded vnode's inode block pinned in the buffer cache,
+ * so this has to stay well under BUF_DEFAULT_NBUFS.
+ */
+#define DCACHE_DEFAULT_MAX  64
+
+struct fs;
+struct vnode;
+
+struct dcachestats {
+	unsigned ds_nentries;		/* entries currently cached */
+	unsigned ds_nnegative;		/* of those, how many negative */
+	unsigned ds_hits;		/* lookups answered with a vnode */
+	unsigned ds_neghits;		/* lookups answered with ENOENT */
+	unsigned ds_misses;		/* lookups sent to the filesystem */
+	unsigned ds_evictions;		/* entries thrown out for space */
+	unsigned ds_invalidations;	/* entries dropped as stale */
+};
+
+void dcache_bootstrap(void);
+
+bool dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret);
+unsigned dcache_generation(void);
+void dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		  unsigned gen);
+void dcache_invalidate(struct vnode *dir, const char *name, bool isdir);
+void dcache_purgefs(struct fs *fs);
+
+unsigned dcache_getmax(void);
+void dcache_setmax(unsigned max);
+
+void dcache_getstats(struct dcachestats *stats);
+void dcache_printstats(void);
+void dcache_resetstats(void);
+
+
+#endif /* _DCACHE_H_ */
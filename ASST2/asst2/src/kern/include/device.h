@@ -36,6 +36,8 @@
 
 
 struct uio;  /* in <uio.h> */
+struct iovec;  /* in <uio.h> */
+struct devreq;
 
 /*
  * Filesystem-namespace-accessible device.
@@ -56,11 +58,14 @@ struct device {
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_submit - start an asynchronous block transfer (optional;
+ *                     see below)
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	void (*devop_submit)(struct device *, struct devreq *);
 };
 
 /*
@@ -70,6 +75,53 @@ struct device_ops {
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
 
+/*
+ * Asynchronous block I/O.
+ *
+ * A devreq moves whole blocks between the device, starting at
+ * dr_block, and kernel memory scattered over dr_iov; every piece
+ * must be a multiple of the block size. dev_submit starts it and
+ * returns. When it finishes, the driver calls devreq_done, which
+ * stores the result in dr_result and calls dr_done if it is set.
+ * That may happen in an interrupt handler, so dr_done must not sleep.
+ * The driver leaves dr_iov alone.
+ *
+ * A devbatch lets a thread start several requests and then sleep
+ * once until all of them have finished. devbatch_submit counts the
+ * request and submits it; devbatch_wait waits for every request
+ * submitted to the batch. Each request's dr_result says how it went.
+ *
+ * Devices without devop_submit still work: dev_submit does the
+ * transfer with devop_io and completes the request before returning.
+ */
+struct devbatch;
+
+struct devreq {
+	daddr_t dr_block;		/* first block */
+	struct iovec *dr_iov;		/* kernel memory to transfer */
+	unsigned dr_iovcnt;
+	bool dr_write;			/* true to write, false to read */
+	void (*dr_done)(struct devreq *); /* completion callback, or NULL */
+	void *dr_arg;			/* for dr_done */
+	int dr_result;			/* set on completion */
+	struct devbatch *dr_batch;	/* set by devbatch_submit */
+	struct devreq *dr_next;		/* for the driver's queue */
+};
+
+struct devbatch {
+	unsigned db_pending;		/* requests not yet done */
+};
+
+void devreq_bootstrap(void);
+void devreq_init(struct devreq *req, daddr_t block, struct iovec *iov,
+		 unsigned iovcnt, bool write);
+void dev_submit(struct device *dev, struct devreq *req);
+void devreq_done(struct devreq *req, int result);
+void devbatch_init(struct devbatch *db);
+void devbatch_submit(struct devbatch *db, struct device *dev,
+		     struct devreq *req);
+void devbatch_wait(struct devbatch *db);
+
 
 /* Create vnode for a vfs-level device. */
 struct vnode *dev_create_vnode(struct device *dev);
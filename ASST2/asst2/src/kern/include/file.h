@@ -5,33 +5,95 @@
 #define __FILE_H
 
 #include <types.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <vnode.h>
 /* Some limits  */
 
 /* This is the maximum number of files that can be opened per
  * process */
-#define MAX_PROCESS_OPEN_FILES  16
+#define MAX_PROCESS_OPEN_FILES  4096
 
 /* This is the maximum number of files that can be open in the system
  * at any one time */
-#define MAX_SYSTEM_OPEN_FILES   64 
+#define MAX_SYSTEM_OPEN_FILES   16384
+
+/* Descriptor tables start this big and double as they fill up. Keep
+ * it a multiple of 8 so the free-descriptor bitmap has no padding. */
+#define FDTABLE_INITIAL_SIZE    16
+
+/* Sequential read-ahead starts with this window, in bytes, and
+ * doubles on every sequential read up to file_getreadahead(). */
+#define FILE_RA_MIN             4096
+#define FILE_RA_DEFAULT_MAX     65536
 struct vnode;
 struct lock;
+struct proc;
 /*
  * Put your function declarations and data types here ...
  */
 
+/*
+ * Open file object.
+ *
+ * f_offlock protects references and offset. While only one descriptor
+ * refers to the file (references == 1) that is all sys_read/sys_write
+ * take; once sys_dup2 has shared it, flock is held across the I/O so
+ * the offset update stays atomic with the transfer.
+ *
+ * The read-ahead fields go with the offset: f_ranext is where the
+ * next read starts if the file is being read sequentially, f_raend
+ * is how far ahead we've already asked for, and f_rawindow is how far
+ * ahead to keep asking. A read anywhere else, or an lseek, drops the
+ * window back to zero.
+ */
 struct File {
 	struct vnode *v_ptr;
     int open_flags;
 	int references;
 	struct lock *flock;
+	struct spinlock f_offlock;
     off_t offset;
+	off_t f_ranext;
+	off_t f_raend;
+	off_t f_rawindow;
+	struct File *f_next;	/* free-list link while in the pool */
 };
 
+/*
+ * System-wide open file table.
+ *
+ * File objects come from a pool that is grown a page of objects at a
+ * time and never shrunk. Objects keep their flock and f_offlock while
+ * they sit on the free list, so opening a file costs no allocation
+ * once the pool has warmed up.
+ *
+ *    file_alloc - take a File from the pool; NULL if the system limit
+ *                 (MAX_SYSTEM_OPEN_FILES) is reached or memory is out.
+ *    file_free  - return a File whose vnode has been closed.
+ *
+ *    file_getreadahead - get the largest read-ahead window, in bytes.
+ *    file_setreadahead - set it; 0 turns read-ahead off.
+ */
+struct File *file_alloc(void);
+void file_free(struct File *file);
+off_t file_getreadahead(void);
+void file_setreadahead(off_t maxbytes);
+
+/*
+ * Per-process descriptor tables. The table itself is an array that
+ * doubles on demand up to MAX_PROCESS_OPEN_FILES; a bitmap of the
+ * descriptors in use makes finding the lowest free one a word scan.
+ *
+ *    filetable_init    - set up an empty table for a new process.
+ *    filetable_destroy - close everything still open and free the table.
+ *    fd_install        - put FILE at the lowest free descriptor.
+ */
+int filetable_init(struct proc *newproc);
+void filetable_destroy(struct proc *proc);
+int fd_install(struct proc *proc, struct File *file, int *ret);
+
 //void open_std(void);
-//int filetable_init(struct proc *newproc);
 int sys_open(userptr_t filename, int flags, int *ret);
 int sys_read(int filehandler, userptr_t buf, size_t size, int *ret);
 int sys_write(int filehandler, userptr_t buf, size_t size, int *ret);
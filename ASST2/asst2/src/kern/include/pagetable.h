@@ -0,0 +1,56 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table.
+ *
+ * The top 10 bits of a user virtual address pick an entry in the
+ * directory, which points to a page of 1024 page table entries; the
+ * next 10 bits pick the entry. Second-level pages are allocated the
+ * first time something in their 4M of address space is touched.
+ *
+ * A PTE of 0 means the page has never been touched. Otherwise, if
+ * PTE_PRESENT is set, the page is in memory and the top 20 bits are
+ * its physical page. PTE_COW means the page is shared with another
+ * address space and must be copied before it's written. PTE_DIRTY
+ * means it has to be written to swap before it can be paged out;
+ * pages that aren't are mapped read-only until they're written. A
+ * clean page with no copy in swap is one nobody can write, and is
+ * just dropped, to be filled in again when next touched. If
+ * PTE_SWAPPED is set instead, the page is on disk and the top 20 bits
+ * are its swap slot.
+ *
+ * Functions:
+ *     pt_create   - make an empty page table. Returns NULL if out of
+ *                   memory.
+ *     pt_destroy  - free the table itself. Doesn't touch the pages
+ *                   the entries point to; free those first.
+ *     pt_lookup   - find the entry for VADDR. If CREATE, allocate a
+ *                   second-level page if needed (ENOMEM if that
+ *                   fails); otherwise hand back NULL if there isn't
+ *                   one.
+ *     pt_next     - find the first nonzero entry at or after *VADDR,
+ *                   updating *VADDR to its address. Returns NULL when
+ *                   there are no more. Skips untouched 4M chunks
+ *                   without looking at them.
+ */
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	/* physical page, if present */
+#define PTE_PRESENT	0x00000001	/* page is in memory */
+#define PTE_COW		0x00000002	/* shared; copy before writing */
+#define PTE_DIRTY	0x00000004	/* swap copy missing or stale */
+#define PTE_SWAPPED	0x00000008	/* page is in swap */
+#define PTE_SLOTSHIFT	12		/* where the slot is, if swapped */
+
+struct pagetable;
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+int pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create,
+	      pte_t **ret);
+pte_t *pt_next(struct pagetable *pt, vaddr_t *vaddr);
+
+
+#endif /* _PAGETABLE_H_ */
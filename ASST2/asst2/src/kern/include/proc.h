@@ -42,6 +42,7 @@
 struct addrspace;
 struct thread;
 struct vnode;
+struct bitmap;
 struct open_file;
 
 /*
@@ -75,7 +76,9 @@ struct proc {
 	struct vnode *p_cwd;		/* current working directory */
 
 	/* add more material here as needed */
-	struct File *file_table[MAX_PROCESS_OPEN_FILES];
+	struct File **file_table;	/* descriptor table (see file.h) */
+	unsigned file_tablesize;	/* number of slots in file_table */
+	struct bitmap *file_fdmap;	/* descriptors in use */
 	struct proc *par;
 	struct proc *childlist[MAX_CHILD];
 	int count;
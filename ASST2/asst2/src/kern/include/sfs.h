@@ -48,6 +48,35 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking.
+ *
+ * Each sfs_vnode has a sleep lock, sv_lock, covering the in-memory
+ * inode (sv_i, sv_dirty) and the file's contents, which for a
+ * directory means its slots and the in-memory index of them. The
+ * inode type and number never change once the vnode is loaded and
+ * may be read without it.
+ *
+ * Each sfs_fs has three more: sfs_vnlock for the table of loaded
+ * vnodes, sfs_freemaplock for the free block bitmap, and
+ * sfs_superlock for the superblock. The volume name is set at mount
+ * time and may be read without locking.
+ *
+ * Lock order:
+ *     directory sv_lock
+ *     file sv_lock
+ *     sfs_vnlock
+ *     sfs_freemaplock, sfs_superlock (never held together)
+ *
+ * Nothing in SFS takes vfs_biglock; device I/O is serialized by the
+ * device driver.
+ *
+ * sfs_read and sfs_write copy to and from user memory holding
+ * sv_lock. That memory must not fault, since a fault may read a file,
+ * maybe this one: read() and write() pin the buffer with as_pin
+ * before calling down.
+ */
+
 /*
  * In-memory inode
  */
@@ -56,6 +85,13 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct lock *sv_lock;		/* protects sv_i, sv_dirty, data */
+	daddr_t sv_allochint;		/* last block allocated to the file */
+	daddr_t sv_prealloc;		/* next block reserved for the file */
+	unsigned sv_nprealloc;		/* number of blocks reserved */
+	struct sfs_vnode *sv_hashnext;	/* next in sfs_vnhash chain */
+	struct sfs_dirindex *sv_dirindex; /* name index, for directories */
+	struct sfs_idcache *sv_idcache;	/* recently used indirect blocks */
 };
 
 /*
@@ -66,9 +102,14 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode **sfs_vnhash;	/* vnodes loaded into memory, */
+	unsigned sfs_vnhashsize;	/*   hashed by inode number */
+	unsigned sfs_nvnodes;		/* how many vnodes are loaded */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct lock *sfs_vnlock;	/* protects the vnode table */
+	struct lock *sfs_freemaplock;	/* protects freemap and its flag */
+	struct lock *sfs_superlock;	/* protects sfs_sb, superdirty */
 };
 
 /*
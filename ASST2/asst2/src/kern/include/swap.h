@@ -0,0 +1,47 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space, and the pageout thread that keeps memory free by
+ * pushing user pages out to it.
+ *
+ * Functions:
+ *     swap_bootstrap  - attach the swap disk and start the pageout
+ *                       thread; called from vm_bootstrap. Without a
+ *                       swap disk nothing is ever paged out.
+ *     swap_alloc      - allocate COUNT consecutive swap slots and
+ *                       return the first. ENOSPC if there isn't such
+ *                       a run.
+ *     swap_share      - add a reference to a slot, for another
+ *                       address space sharing the page in it.
+ *     swap_free       - drop a reference to a slot, freeing it with
+ *                       the last one.
+ *     swap_read       - read a page in from SLOT.
+ *     swap_write      - write N pages out, page I to SLOTS[I], all
+ *                       at once, and wait for them. RESULTS[I] says
+ *                       how page I went. N is at most SWAP_BATCH.
+ *     swap_wake       - wake the pageout thread if memory is low.
+ *     swap_waitforpages - wait for the pageout thread to make a pass.
+ *                       Returns false if it didn't free anything.
+ *     swap_printstats - print slot usage.
+ */
+
+/* Most pages the pageout thread writes at once. */
+#define SWAP_BATCH	16
+
+void swap_bootstrap(void);
+
+int swap_alloc(unsigned count, unsigned *slot);
+void swap_share(unsigned slot);
+void swap_free(unsigned slot);
+int swap_read(unsigned slot, paddr_t paddr);
+void swap_write(const unsigned *slots, const paddr_t *paddrs, int *results,
+		unsigned n);
+
+void swap_wake(void);
+bool swap_waitforpages(void);
+
+void swap_printstats(void);
+
+
+#endif /* _SWAP_H_ */
@@ -37,9 +37,21 @@
 
 #include <spinlock.h>
 
+struct thread;			/* from <thread.h> */
+struct cpu;			/* from <cpu.h> */
+
 /*
  * Dijkstra-style semaphore.
  *
+ * A semaphore made with sem_create_fifo hands each V directly to the
+ * longest-waiting thread instead of bumping the count and letting the
+ * woken thread race for it. Waiters are served strictly in order, and
+ * a woken waiter never has to go back to sleep. sem_create gives the
+ * classic behavior.
+ *
+ * The counters are for measuring how much of that racing goes on:
+ * sem_nrechecks counts wakeups that found the count already taken.
+ *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
  */
@@ -48,10 +60,16 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile unsigned sem_count;
+	bool sem_fifo;			/* hand V to the first waiter */
+	unsigned sem_nsleeps;		/* times P went to sleep */
+	unsigned sem_nwakeups;		/* times V woke a waiter */
+	unsigned sem_nrechecks;		/* wakeups that found count 0 */
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
+struct semaphore *sem_create_fifo(const char *name, unsigned initial_count);
 void sem_destroy(struct semaphore *);
+void sem_printstats(struct semaphore *);
 
 /*
  * Operations (both atomic):
@@ -69,14 +87,22 @@ void V(struct semaphore *);
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
+ * The lock is adaptive: a thread that finds it held spins for a while
+ * if the holder is running on another cpu, since it will probably let
+ * go soon, and sleeps on lk_wchan otherwise. lk_holdercpu is the cpu
+ * the holder took the lock on; spinners only look at that cpu's
+ * c_curthread and never dereference the holder itself.
+ *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
  */
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *lk_wchan;
+	struct spinlock lk_lock;	/* protects lk_wchan and holder */
+	struct thread *volatile lk_holder;
+	struct cpu *volatile lk_holdercpu;
 };
 
 struct lock *lock_create(const char *name);
@@ -108,14 +134,21 @@ bool lock_do_i_hold(struct lock *);
  * These CVs are expected to support Mesa semantics, that is, no
  * guarantees are made about scheduling.
  *
+ * Signal and broadcast don't wake anyone directly. Since the waiters
+ * could not run anyway until the signaller releases the lock, they
+ * are moved straight onto the lock's wait channel ("wait morphing")
+ * and lock_release wakes them one at a time. A broadcast to many
+ * waiters thus costs one wakeup per lock handoff instead of a
+ * stampede of threads that mostly go back to sleep on the lock.
+ *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
  */
 
 struct cv {
         char *cv_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *cv_wchan;
+	struct spinlock cv_lock;	/* protects cv_wchan */
 };
 
 struct cv *cv_create(const char *name);
@@ -139,4 +172,55 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers have preference: once a writer is waiting, new readers
+ * wait behind it, so a steady stream of readers can't starve writers.
+ * A consequence is that taking a read lock you already hold can
+ * deadlock if a writer shows up in between; don't do that.
+ *
+ * The deadlock detector knows who holds the write side. Readers are
+ * tracked only while waiting, since a lockable has only one holder.
+ *
+ * When the lock is created, no thread should be holding it. Likewise,
+ * when the lock is destroyed, no thread should be holding it.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+        HANGMAN_LOCKABLE(rwlock_hangman);	/* Deadlock detector hook. */
+	struct spinlock rwlock_lock;	/* protects everything below */
+	struct wchan *rwlock_rwchan;	/* readers wait here */
+	struct wchan *rwlock_wwchan;	/* writers wait here */
+	volatile unsigned rwlock_readers;	/* readers holding the lock */
+	volatile unsigned rwlock_wwaiting;	/* writers waiting */
+	struct thread *volatile rwlock_writer;	/* writer holding the lock */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Blocks while a
+ *                           writer holds or is waiting for the lock.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing. Blocks until
+ *                           there are no readers and no other writer.
+ *    rwlock_release_write - Give up the write hold. Only the thread
+ *                           holding it may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
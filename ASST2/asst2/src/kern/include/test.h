@@ -44,6 +44,10 @@
 int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
+int coremaptest(int, char **);
+int cowbench(int, char **);
+int swaptest(int, char **);
+int tlbbench(int, char **);
 int threadlisttest(int, char **);
 
 /* thread tests */
@@ -52,9 +56,15 @@ int threadtest2(int, char **);
 int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
+int lockbench(int, char **);
 int cvtest(int, char **);
+int cvbench(int, char **);
+int rwbench(int, char **);
 int cvtest2(int, char **);
 
+/* scheduler benchmarks */
+int cpubench(int, char **);
+
 /* semaphore unit tests */
 int semu1(int, char **);
 int semu2(int, char **);
@@ -79,6 +89,20 @@ int semu20(int, char **);
 int semu21(int, char **);
 int semu22(int, char **);
 
+/* rwlock unit tests */
+int rwu1(int, char **);
+int rwu2(int, char **);
+int rwu3(int, char **);
+int rwu4(int, char **);
+int rwu5(int, char **);
+int rwu6(int, char **);
+int rwu7(int, char **);
+int rwu8(int, char **);
+int rwu9(int, char **);
+int rwu10(int, char **);
+int rwu11(int, char **);
+int rwu12(int, char **);
+
 /* filesystem tests */
 int fstest(int, char **);
 int readstress(int, char **);
@@ -86,6 +110,9 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int bufbench(int, char **);
+int vnodebench(int, char **);
+int dcachebench(int, char **);
 int printfile(int, char **);
 
 /* other tests */
@@ -55,6 +55,15 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/*
+ * Multi-level feedback queue scheduling. Level 0 is the highest
+ * priority. A thread at level L may run for MLFQ_QUANTUM(L) hardclocks
+ * (counted across sleeps) before it is demoted a level; being woken
+ * from a wait channel promotes it a level.
+ */
+#define MLFQ_LEVELS		4
+#define MLFQ_QUANTUM(level)	(1U << (level))
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -102,6 +111,15 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields. Changed only by the cpu the thread is on,
+	 * or while the thread is on no list at all.
+	 */
+	unsigned t_priority;		/* MLFQ level, 0..MLFQ_LEVELS-1 */
+	unsigned t_quantum_used;	/* Hardclocks used at this level */
+	struct cpu *t_lastcpu;		/* CPU it last ran on, or NULL */
+	unsigned t_lastran;		/* t_lastcpu's c_hardclocks then */
+
 	/*
 	 * Public fields
 	 */
@@ -163,11 +181,33 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for one hardclock. Returns true if it
+ * should give up the cpu: its quantum is used up, or a higher
+ * priority thread is waiting. Called from the timer interrupt.
+ */
+bool thread_quantum_tick(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Cache affinity window, in hardclocks: a ready thread that ran on its
+ * cpu less than this long ago is considered cache-hot and is not
+ * pushed elsewhere by thread_consider_migration.
+ */
+unsigned thread_get_affinity_window(void);
+void thread_set_affinity_window(unsigned hardclocks);
+
+/*
+ * Per-cpu migration statistics: print them (with rates since the last
+ * reset) or zero them.
+ */
+void thread_printcpustats(void);
+void thread_resetcpustats(void);
+
 
 #endif /* _THREAD_H_ */
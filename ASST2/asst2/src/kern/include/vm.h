@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -58,5 +60,19 @@ void free_kpages(vaddr_t addr);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Invalidate this cpu's whole TLB (not in dumbvm) */
+void vm_tlbflush(void);
+
+/* Invalidate every cpu's TLB, and wait until they have (not in dumbvm) */
+void vm_tlbflush_all(void);
+
+/*
+ * TLB address space IDs (not in dumbvm): use AS's TLB entries, use
+ * nobody's, and make sure AS's current entries are never used again.
+ */
+void vm_tlbactivate(struct addrspace *as);
+void vm_tlbdeactivate(void);
+void vm_tlbforget(struct addrspace *as);
+
 
 #endif /* _VM_H_ */
@@ -0,0 +1,34 @@
+#ifndef _VMSTATS_H_
+#define _VMSTATS_H_
+
+/*
+ * VM event counters.
+ *
+ * Functions:
+ *     vmstats_inc    - count one event of type WHICH (a VMSTAT_*).
+ *     vmstats_get    - get the count for WHICH.
+ *     vmstats_print  - print all the counts, and how many per second
+ *                      since they were last reset.
+ *     vmstats_reset  - zero the counts.
+ */
+
+#define VMSTAT_FAULTS		0	/* TLB faults handled */
+#define VMSTAT_ZEROFILLS	1	/* pages filled with zeros */
+#define VMSTAT_FILELOADS	2	/* pages read from an executable */
+#define VMSTAT_COWFAULTS	3	/* writes to copy-on-write pages */
+#define VMSTAT_COWCOPIES	4	/* of those, how many copied the page */
+#define VMSTAT_PAGEINS		5	/* pages read from swap */
+#define VMSTAT_PAGEOUTS		6	/* pages written to swap */
+#define VMSTAT_EVICTIONS	7	/* pages paged out, written or not */
+#define VMSTAT_SWAPWRITES	8	/* device requests for page-outs */
+#define VMSTAT_QUICKFAULTS	9	/* TLB faults done from the page table */
+#define VMSTAT_ASIDFLUSHES	10	/* TLB flushes to reuse address space IDs */
+#define VMSTAT_NUM		11
+
+void vmstats_inc(unsigned which);
+unsigned vmstats_get(unsigned which);
+void vmstats_print(void);
+void vmstats_reset(void);
+
+
+#endif /* _VMSTATS_H_ */
@@ -127,6 +127,11 @@ struct vnode {
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
  *
+ *    vop_readahead   - Hint that LEN bytes at POS are about to be
+ *                      read, so the file system can start loading
+ *                      them. Does not wait for the data. Failure is
+ *                      harmless and callers may ignore it.
+ *
  *    vop_namefile    - Compute pathname relative to filesystem root
  *                      of the file and copy to the specified
  *                      uio. Need not work on objects that are not
@@ -195,6 +200,7 @@ struct vnode_ops {
 	int (*vop_fsync)(struct vnode *object);
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
+	int (*vop_readahead)(struct vnode *file, off_t pos, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
 
 
@@ -239,6 +245,7 @@ struct vnode_ops {
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_READAHEAD(vn, pos, len)     (__VOP(vn, readahead)(vn, pos, len))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -290,6 +297,7 @@ int vopfail_mmap_isdir(struct vnode *vn /* add stuff */);
 int vopfail_mmap_perm(struct vnode *vn /* add stuff */);
 int vopfail_mmap_nosys(struct vnode *vn /* add stuff */);
 int vopfail_truncate_isdir(struct vnode *vn, off_t pos);
+int vopfail_readahead_nosys(struct vnode *vn, off_t pos, off_t len);
 int vopfail_creat_notdir(struct vnode *vn, const char *name, bool excl,
 			 mode_t mode, struct vnode **result);
 int vopfail_symlink_notdir(struct vnode *vn, const char *contents,
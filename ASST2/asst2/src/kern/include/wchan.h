@@ -76,5 +76,17 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move one thread, or all threads, sleeping on wait channel FROM to
+ * wait channel TO without waking them; they wake when TO is woken.
+ * Both associated spinlocks must be locked. A moved thread still
+ * relocks FROMLK when it wakes up, since that's the lock it went to
+ * sleep with.
+ */
+void wchan_moveone(struct wchan *from, struct spinlock *fromlk,
+		   struct wchan *to, struct spinlock *tolk);
+void wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+		   struct wchan *to, struct spinlock *tolk);
+
 
 #endif /* _WCHAN_H_ */
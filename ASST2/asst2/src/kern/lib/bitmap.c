@@ -47,28 +47,121 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * For searching, though, we assemble the bytes four at a time into
+ * 32-bit chunks (byte k of a chunk is bits 8k..8k+7, whatever the
+ * machine's byte order) so a whole chunk can be tested at once. The
+ * data is padded out to a whole number of chunks with bits marked in
+ * use.
+ *
+ * A summary bitmap has one bit per chunk, set when the chunk is
+ * full, so searches skip 1024 allocated bits per summary word. And
+ * there are never any clear bits in chunks below b->hint, so
+ * bitmap_alloc doesn't rescan the front of a mostly full map every
+ * time.
+ */
+#define CHUNK_BITS      32
+#define CHUNK_BYTES     (CHUNK_BITS / BITS_PER_WORD)
+#define CHUNK_ALLBITS   (0xffffffffU)
+
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
+        unsigned nchunks;       /* number of chunks in v */
+        uint32_t *full;         /* summary: one bit per full chunk */
+        unsigned nfull;         /* number of words in full */
+        unsigned hint;          /* no clear bits in chunks below this */
 };
 
+/*
+ * Index of the lowest set bit of X, which must not be 0. MIPS-I has
+ * no count-zeros instruction, so isolate the bit and look it up with
+ * a de Bruijn multiply instead of looping over the 32 positions.
+ */
+static
+inline
+unsigned
+bitmap_ctz(uint32_t x)
+{
+        static const unsigned char debruijn[32] = {
+                0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+                31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
+        };
+
+        KASSERT(x != 0);
+        return debruijn[((x & -x) * 0x077cb531U) >> 27];
+}
+
+static
+inline
+uint32_t
+bitmap_chunk(const struct bitmap *b, unsigned c)
+{
+        const WORD_TYPE *p = &b->v[c * CHUNK_BYTES];
+
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Bring the summary bit for chunk C up to date.
+ */
+static
+void
+bitmap_summarize(struct bitmap *b, unsigned c)
+{
+        uint32_t mask = (uint32_t)1 << (c % CHUNK_BITS);
+
+        if (bitmap_chunk(b, c) == CHUNK_ALLBITS) {
+                b->full[c / CHUNK_BITS] |= mask;
+        }
+        else {
+                b->full[c / CHUNK_BITS] &= ~mask;
+        }
+}
+
+/*
+ * Rebuild the whole summary, after the data has been changed behind
+ * our back through bitmap_getdata.
+ */
+void
+bitmap_datachanged(struct bitmap *b)
+{
+        unsigned c;
+
+        /* Summary bits past the last chunk read as full. */
+        memset(b->full, 0xff, b->nfull * sizeof(uint32_t));
+        for (c=0; c<b->nchunks; c++) {
+                bitmap_summarize(b, c);
+        }
+        b->hint = 0;
+}
 
 struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b;
-        unsigned words;
+        unsigned words, nbytes;
 
         words = DIVROUNDUP(nbits, BITS_PER_WORD);
         b = kmalloc(sizeof(struct bitmap));
         if (b == NULL) {
                 return NULL;
         }
-        b->v = kmalloc(words*sizeof(WORD_TYPE));
+        b->nchunks = DIVROUNDUP(nbits, CHUNK_BITS);
+        nbytes = b->nchunks * CHUNK_BYTES;
+        b->v = kmalloc(nbytes*sizeof(WORD_TYPE));
         if (b->v == NULL) {
                 kfree(b);
                 return NULL;
         }
+        b->nfull = DIVROUNDUP(b->nchunks, CHUNK_BITS);
+        b->full = kmalloc(b->nfull * sizeof(uint32_t));
+        if (b->full == NULL) {
+                kfree(b->v);
+                kfree(b);
+                return NULL;
+        }
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
@@ -86,6 +179,10 @@ bitmap_create(unsigned nbits)
                 }
         }
 
+        /* And the padding out to a whole chunk */
+        memset(b->v + words, WORD_ALLBITS, nbytes - words);
+
+        bitmap_datachanged(b);
         return b;
 }
 
@@ -95,31 +192,158 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+/*
+ * Return the first chunk at or after C that isn't full, or
+ * b->nchunks if there isn't one.
+ */
+static
+unsigned
+bitmap_nextchunk(const struct bitmap *b, unsigned c)
+{
+        unsigned s = c / CHUNK_BITS;
+        uint32_t w;
+
+        if (s >= b->nfull) {
+                return b->nchunks;
+        }
+        w = ~b->full[s] & (CHUNK_ALLBITS << (c % CHUNK_BITS));
+        while (w == 0) {
+                if (++s >= b->nfull) {
+                        return b->nchunks;
+                }
+                w = ~b->full[s];
+        }
+        return s * CHUNK_BITS + bitmap_ctz(w);
+}
+
+/*
+ * Return the first clear bit at or after START, or b->nbits if there
+ * isn't one.
+ */
+static
+unsigned
+bitmap_findclear(const struct bitmap *b, unsigned start)
+{
+        unsigned c = start / CHUNK_BITS;
+        uint32_t w;
+
+        if (start >= b->nbits) {
+                return b->nbits;
+        }
+        w = ~bitmap_chunk(b, c) & (CHUNK_ALLBITS << (start % CHUNK_BITS));
+        if (w == 0) {
+                c = bitmap_nextchunk(b, c + 1);
+                if (c >= b->nchunks) {
+                        return b->nbits;
+                }
+                w = ~bitmap_chunk(b, c);
+        }
+        /* Bits past nbits are all set, so this is in range */
+        return c * CHUNK_BITS + bitmap_ctz(w);
+}
+
+/*
+ * Return the first set bit at or after START and before LIMIT, or
+ * LIMIT if there isn't one. LIMIT must be at most b->nbits.
+ */
+static
+unsigned
+bitmap_findset(const struct bitmap *b, unsigned start, unsigned limit)
+{
+        unsigned c = start / CHUNK_BITS;
+        uint32_t w;
+
+        if (start >= limit) {
+                return limit;
+        }
+        w = bitmap_chunk(b, c) & (CHUNK_ALLBITS << (start % CHUNK_BITS));
+        while (w == 0) {
+                if (++c * CHUNK_BITS >= limit) {
+                        return limit;
+                }
+                w = bitmap_chunk(b, c);
+        }
+        start = c * CHUNK_BITS + bitmap_ctz(w);
+        return start < limit ? start : limit;
+}
+
+/*
+ * Set COUNT bits starting at INDEX, which must all be clear.
+ */
+static
+void
+bitmap_markrange(struct bitmap *b, unsigned index, unsigned count)
+{
+        unsigned i, ix;
+
+        for (i=index; i<index+count; i++) {
+                ix = i / BITS_PER_WORD;
+                KASSERT((b->v[ix] & ((WORD_TYPE)1 << (i % BITS_PER_WORD)))==0);
+                b->v[ix] |= (WORD_TYPE)1 << (i % BITS_PER_WORD);
+        }
+        for (i=index/CHUNK_BITS; i<=(index+count-1)/CHUNK_BITS; i++) {
+                bitmap_summarize(b, i);
+        }
+}
+
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned i;
+
+        i = bitmap_findclear(b, b->hint * CHUNK_BITS);
+        if (i >= b->nbits) {
+                b->hint = b->nchunks;
+                return ENOSPC;
+        }
+        b->hint = i / CHUNK_BITS;
+
+        bitmap_markrange(b, i, 1);
+        *index = i;
+        return 0;
+}
+
+int
+bitmap_findrange(struct bitmap *b, unsigned start, unsigned count,
+                 unsigned *index)
+{
+        unsigned i, end;
+
+        KASSERT(count > 0);
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        if (start <= b->hint * CHUNK_BITS) {
+                start = b->hint * CHUNK_BITS;
+                i = bitmap_findclear(b, start);
+                /* That was the lowest clear bit; remember where. */
+                b->hint = i < b->nbits ? i / CHUNK_BITS : b->nchunks;
+        }
+        else {
+                i = bitmap_findclear(b, start);
+        }
+        while (i < b->nbits && count <= b->nbits - i) {
+                end = bitmap_findset(b, i, i + count);
+                if (end == i + count) {
+                        *index = i;
+                        return 0;
                 }
+                i = bitmap_findclear(b, end);
         }
         return ENOSPC;
 }
 
+int
+bitmap_alloc_range(struct bitmap *b, unsigned count, unsigned *index)
+{
+        int result;
+
+        result = bitmap_findrange(b, 0, count, index);
+        if (result) {
+                return result;
+        }
+        bitmap_markrange(b, *index, count);
+        return 0;
+}
+
 static
 inline
 void
@@ -142,6 +366,7 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        bitmap_summarize(b, index / CHUNK_BITS);
 }
 
 void
@@ -155,6 +380,11 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        b->full[index / CHUNK_BITS / CHUNK_BITS] &=
+                ~((uint32_t)1 << (index / CHUNK_BITS % CHUNK_BITS));
+        if (index / CHUNK_BITS < b->hint) {
+                b->hint = index / CHUNK_BITS;
+        }
 }
 
 
@@ -171,6 +401,7 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
+        kfree(b->full);
         kfree(b->v);
         kfree(b);
 }
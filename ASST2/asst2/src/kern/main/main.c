@@ -46,6 +46,7 @@
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
@@ -127,6 +128,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	buf_start_threads();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
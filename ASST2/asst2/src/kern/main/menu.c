@@ -40,11 +40,18 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <buf.h>
+#include <dcache.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <swap.h>
+#include <file.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -465,6 +472,188 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_cpustats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		thread_printcpustats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		thread_resetcpustats();
+	}
+	else {
+		kprintf("Usage: cpus [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_affinity(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("Affinity window: %u hardclocks\n",
+			thread_get_affinity_window());
+	}
+	else if (nargs == 2) {
+		thread_set_affinity_window(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: affinity [hardclocks]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		buf_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		buf_resetstats();
+	}
+	else {
+		kprintf("Usage: bufs [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_bufsize(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("Buffer cache size: %u blocks\n", buf_getmax());
+	}
+	else if (nargs == 2) {
+		buf_setmax(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: bufsize [nblocks]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_bufwriteback(int nargs, char **args)
+{
+	unsigned secs;
+
+	if (nargs == 1) {
+		if (buf_getwriteback(&secs)) {
+			kprintf("Buffer cache: write-back, syncer every "
+				"%u seconds\n", secs);
+		}
+		else {
+			kprintf("Buffer cache: write-through\n");
+		}
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		buf_getwriteback(&secs);
+		buf_setwriteback(false, secs);
+	}
+	else if (nargs == 2) {
+		buf_setwriteback(true, atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: bufwb [off | seconds]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_readahead(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("Read-ahead: up to %lu bytes\n",
+			(unsigned long)file_getreadahead());
+	}
+	else if (nargs == 2) {
+		file_setreadahead(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: ra [maxbytes]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_dcachestats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		dcache_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		dcache_resetstats();
+	}
+	else {
+		kprintf("Usage: dcs [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_dcachesize(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("Name cache size: %u entries\n", dcache_getmax());
+	}
+	else if (nargs == 2) {
+		dcache_setmax(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: dcsize [nentries]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		vmstats_print();
+		swap_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vmstats_reset();
+	}
+	else {
+		kprintf("Usage: vms [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -555,6 +744,12 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[cmt] Coremap test and benchmark    ",
+#if !OPT_DUMBVM
+	"[cowb] Copy-on-write benchmark      ",
+	"[swt] Swap test and benchmark       ",
+	"[tlbb] TLB ping-pong benchmark      ",
+#endif
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
@@ -563,20 +758,28 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[cpub] CPU-bound makespan benchmark ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
+	"[sy2b] Lock contention benchmark    ",
 	"[sy3] CV test               (1)     ",
+	"[sy3b] CV broadcast benchmark       ",
 	"[sy4] CV test #2            (1)     ",
 	"[semu1-22] Semaphore unit tests     ",
+	"[rwu1-12] RW lock unit tests        ",
+	"[rwb] RW lock throughput benchmark  ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[bufb] Buffer cache benchmark       ",
+	"[vnb] Vnode table benchmark         ",
+	"[dcb] Name cache benchmark          ",
 	NULL
 };
 
@@ -601,6 +804,18 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[cm] Physical memory stats          ",
+#if !OPT_DUMBVM
+	"[vms] VM stats                      ",
+#endif
+	"[cpus] Per-cpu migration stats      ",
+	"[affinity] Cache affinity window    ",
+	"[bufs] Buffer cache stats           ",
+	"[bufsize] Buffer cache size         ",
+	"[bufwb] Buffer cache write-back     ",
+	"[ra] Read-ahead window              ",
+	"[dcs] Name cache stats              ",
+	"[dcsize] Name cache size            ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -652,11 +867,29 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "cm",		cmd_coremapstats },
+#if !OPT_DUMBVM
+	{ "vms",	cmd_vmstats },
+#endif
+	{ "cpus",	cmd_cpustats },
+	{ "affinity",	cmd_affinity },
+	{ "bufs",	cmd_bufstats },
+	{ "bufsize",	cmd_bufsize },
+	{ "bufwb",	cmd_bufwriteback },
+	{ "ra",		cmd_readahead },
+	{ "dcs",	cmd_dcachestats },
+	{ "dcsize",	cmd_dcachesize },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "cmt",	coremaptest },
+#if !OPT_DUMBVM
+	{ "cowb",	cowbench },
+	{ "swt",	swaptest },
+	{ "tlbb",	tlbbench },
+#endif
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
@@ -668,11 +901,14 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "cpub",	cpubench },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
+	{ "sy2b",	lockbench },
 	{ "sy3",	cvtest },
+	{ "sy3b",	cvbench },
 	{ "sy4",	cvtest2 },
 
 	/* semaphore unit tests */
@@ -698,6 +934,19 @@ static struct {
 	{ "semu20",	semu20 },
 	{ "semu21",	semu21 },
 	{ "semu22",	semu22 },
+	{ "rwu1",	rwu1 },
+	{ "rwu2",	rwu2 },
+	{ "rwu3",	rwu3 },
+	{ "rwu4",	rwu4 },
+	{ "rwu5",	rwu5 },
+	{ "rwu6",	rwu6 },
+	{ "rwu7",	rwu7 },
+	{ "rwu8",	rwu8 },
+	{ "rwu9",	rwu9 },
+	{ "rwu10",	rwu10 },
+	{ "rwu11",	rwu11 },
+	{ "rwu12",	rwu12 },
+	{ "rwb",	rwbench },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -706,6 +955,9 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "bufb",	bufbench },
+	{ "vnb",	vnodebench },
+	{ "dcb",	dcachebench },
 
 	{ NULL, NULL }
 };
@@ -57,29 +57,26 @@
  */
 struct proc *kproc;
 static int open2(struct proc *newproc,char *filename, int flags, int descriptor){
-	struct File *file = kmalloc(sizeof(struct File*));
-	int result;
+	struct File *file = file_alloc();
+	int result, fd;
 	if(!file){
 		return ENFILE;
 	}
  
 	result = vfs_open(filename, flags, 0, &file->v_ptr);
 	if (result) {
-		kfree(file);
+		file_free(file);
 		return result;
 	}
 
-	file->flock = lock_create("lock create");
-	if(!file->flock) {
+	file->open_flags = flags;
+	result = fd_install(newproc, file, &fd);
+	if (result) {
 		vfs_close(file->v_ptr);
-		kfree(file);
-		return ENFILE;
+		file_free(file);
+		return result;
 	}
-
-	file->offset = 0;
-	file->open_flags = flags;
-	file->references = 1;
-	newproc->file_table[descriptor] = file;
+	KASSERT(fd == descriptor);
 
 	return 0;
 }
@@ -111,7 +108,12 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
-	//int z=filetable_init(proc);
+	if (filetable_init(proc)) {
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 	//kprintf("Process Created");
 	return proc;
 }
@@ -147,6 +149,7 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+	filetable_destroy(proc);
 
 	/* VM fields */
 	if (proc->p_addrspace) {
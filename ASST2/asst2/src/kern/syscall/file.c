@@ -5,6 +5,7 @@
 #include <kern/seek.h>
 #include <limits.h>
 #include <lib.h>
+#include <bitmap.h>
 #include <uio.h>
 #include <thread.h>
 #include <current.h>
@@ -15,6 +16,8 @@
 #include <proc.h>
 #include <syscall.h>
 #include <copyinout.h>
+#include <vm.h>
+#include <addrspace.h>
 #include <machine/trapframe.h>
 /*
  * Add your file-related functions here ...
@@ -23,14 +26,400 @@
 // TODO: Take in 3rd argument register and give to vfs_open (mode_t)
 // Although this is not even implemented in OS161 so whatever...
 
-static int open_file_cnt=0;
 int dup2_helper(int oldfd,int newfd,int cnt);
 int seek_helper(int seek_cr);
 int write_util(int filehandler,int max_size);
 
+/*
+ * System-wide open file table.
+ *
+ * of_free is a stack of constructed File objects (flock and f_offlock
+ * already set up). When it runs dry we carve a fresh page into File
+ * objects; those pages are never given back, the objects just cycle
+ * between the free list and the descriptor tables.
+ */
+#define FILES_PER_SLAB	(PAGE_SIZE / sizeof(struct File))
+
+static struct {
+	struct spinlock of_lock;
+	struct File *of_free;		/* constructed, unused Files */
+	unsigned of_inuse;		/* Files handed out */
+	unsigned of_total;		/* Files constructed */
+} openfiles = { SPINLOCK_INITIALIZER, NULL, 0, 0 };
+
+/* Largest read-ahead window; 0 means no read-ahead. */
+static off_t file_ramax = FILE_RA_DEFAULT_MAX;
+
+/*
+ * Most of a user buffer one read or write pins in memory. Anything
+ * past it is left for the next call, as a short count.
+ */
+#define FILE_MAXPIN	(64 * PAGE_SIZE)
+
+/*
+ * Carve a new page into File objects and push them on the free list.
+ */
+static
+int
+file_pool_grow(void)
+{
+	struct File *slab, *head, *tail;
+	unsigned i, made;
+
+	slab = kmalloc(FILES_PER_SLAB * sizeof(struct File));
+	if (slab == NULL) {
+		return ENOMEM;
+	}
+
+	head = tail = NULL;
+	made = 0;
+	for (i=0; i<FILES_PER_SLAB; i++) {
+		slab[i].flock = lock_create("file");
+		if (slab[i].flock == NULL) {
+			break;
+		}
+		spinlock_init(&slab[i].f_offlock);
+		slab[i].v_ptr = NULL;
+		slab[i].f_next = head;
+		if (tail == NULL) {
+			tail = &slab[i];
+		}
+		head = &slab[i];
+		made++;
+	}
+	if (made == 0) {
+		kfree(slab);
+		return ENOMEM;
+	}
+	/* Any unconstructed tail of the page is simply left unused. */
+
+	spinlock_acquire(&openfiles.of_lock);
+	tail->f_next = openfiles.of_free;
+	openfiles.of_free = head;
+	openfiles.of_total += made;
+	spinlock_release(&openfiles.of_lock);
+	return 0;
+}
+
+struct File *
+file_alloc(void)
+{
+	struct File *file;
+
+	spinlock_acquire(&openfiles.of_lock);
+	while (openfiles.of_free == NULL) {
+		if (openfiles.of_inuse >= MAX_SYSTEM_OPEN_FILES) {
+			spinlock_release(&openfiles.of_lock);
+			return NULL;
+		}
+		spinlock_release(&openfiles.of_lock);
+		if (file_pool_grow()) {
+			return NULL;
+		}
+		spinlock_acquire(&openfiles.of_lock);
+	}
+	if (openfiles.of_inuse >= MAX_SYSTEM_OPEN_FILES) {
+		spinlock_release(&openfiles.of_lock);
+		return NULL;
+	}
+	file = openfiles.of_free;
+	openfiles.of_free = file->f_next;
+	openfiles.of_inuse++;
+	spinlock_release(&openfiles.of_lock);
+
+	file->f_next = NULL;
+	file->v_ptr = NULL;
+	file->open_flags = 0;
+	file->references = 1;
+	file->offset = 0;
+	file->f_ranext = 0;
+	file->f_raend = 0;
+	file->f_rawindow = 0;
+	return file;
+}
+
+void
+file_free(struct File *file)
+{
+	file->v_ptr = NULL;
+	spinlock_acquire(&openfiles.of_lock);
+	KASSERT(openfiles.of_inuse > 0);
+	openfiles.of_inuse--;
+	file->f_next = openfiles.of_free;
+	openfiles.of_free = file;
+	spinlock_release(&openfiles.of_lock);
+}
+
+/*
+ * Per-process descriptor tables.
+ *
+ * Processes are single-threaded, so a descriptor table is only ever
+ * touched by its own process's thread (or by whoever is setting the
+ * process up before it runs) and needs no lock of its own.
+ */
+
+int
+filetable_init(struct proc *newproc)
+{
+	newproc->file_table = kmalloc(FDTABLE_INITIAL_SIZE *
+				      sizeof(struct File *));
+	if (newproc->file_table == NULL) {
+		return ENOMEM;
+	}
+	newproc->file_fdmap = bitmap_create(FDTABLE_INITIAL_SIZE);
+	if (newproc->file_fdmap == NULL) {
+		kfree(newproc->file_table);
+		newproc->file_table = NULL;
+		return ENOMEM;
+	}
+	bzero(newproc->file_table, FDTABLE_INITIAL_SIZE * sizeof(struct File *));
+	newproc->file_tablesize = FDTABLE_INITIAL_SIZE;
+	return 0;
+}
+
+/*
+ * Grow PROC's descriptor table so that it has at least MINSIZE slots.
+ */
+static
+int
+filetable_grow(struct proc *proc, unsigned minsize)
+{
+	struct File **newtable;
+	struct bitmap *newmap;
+	unsigned newsize, i;
+
+	if (minsize > MAX_PROCESS_OPEN_FILES) {
+		return EMFILE;
+	}
+	newsize = proc->file_tablesize;
+	while (newsize < minsize) {
+		newsize *= 2;
+	}
+	if (newsize > MAX_PROCESS_OPEN_FILES) {
+		newsize = MAX_PROCESS_OPEN_FILES;
+	}
+
+	newtable = kmalloc(newsize * sizeof(struct File *));
+	if (newtable == NULL) {
+		return ENOMEM;
+	}
+	newmap = bitmap_create(newsize);
+	if (newmap == NULL) {
+		kfree(newtable);
+		return ENOMEM;
+	}
+	bzero(newtable, newsize * sizeof(struct File *));
+	for (i=0; i<proc->file_tablesize; i++) {
+		newtable[i] = proc->file_table[i];
+		if (newtable[i] != NULL) {
+			bitmap_mark(newmap, i);
+		}
+	}
+
+	kfree(proc->file_table);
+	bitmap_destroy(proc->file_fdmap);
+	proc->file_table = newtable;
+	proc->file_fdmap = newmap;
+	proc->file_tablesize = newsize;
+	return 0;
+}
+
+int
+fd_install(struct proc *proc, struct File *file, int *ret)
+{
+	unsigned fd;
+	int result;
+
+	if (bitmap_alloc(proc->file_fdmap, &fd)) {
+		if (proc->file_tablesize >= MAX_PROCESS_OPEN_FILES) {
+			return EMFILE;
+		}
+		result = filetable_grow(proc, proc->file_tablesize + 1);
+		if (result) {
+			return result;
+		}
+		result = bitmap_alloc(proc->file_fdmap, &fd);
+		KASSERT(result == 0);
+	}
+	KASSERT(proc->file_table[fd] == NULL);
+	proc->file_table[fd] = file;
+	*ret = fd;
+	return 0;
+}
+
+/*
+ * Look up descriptor FD in the current process. Returns NULL if it
+ * is out of range or not open.
+ */
+static
+struct File *
+fd_lookup(int fd)
+{
+	struct proc *proc = curproc;
+
+	if (fd < 0 || (unsigned)fd >= proc->file_tablesize) {
+		return NULL;
+	}
+	return proc->file_table[fd];
+}
+
+/*
+ * Drop one descriptor's reference to FILE, closing it on the last one.
+ */
+static
+void
+file_decref(struct File *file)
+{
+	int refs;
+
+	spinlock_acquire(&file->f_offlock);
+	refs = --file->references;
+	spinlock_release(&file->f_offlock);
+	if(refs<=0) {
+		vfs_close(file->v_ptr);
+		file_free(file);
+	}
+}
+
+void
+filetable_destroy(struct proc *proc)
+{
+	unsigned i;
+
+	if (proc->file_table == NULL) {
+		return;
+	}
+	for (i=0; i<proc->file_tablesize; i++) {
+		if (proc->file_table[i] != NULL) {
+			file_decref(proc->file_table[i]);
+			proc->file_table[i] = NULL;
+		}
+	}
+	kfree(proc->file_table);
+	bitmap_destroy(proc->file_fdmap);
+	proc->file_table = NULL;
+	proc->file_fdmap = NULL;
+	proc->file_tablesize = 0;
+}
+
+/*
+ * Offset management.
+ *
+ * User processes are single-threaded, so while a File has only one
+ * descriptor referring to it nobody else can be doing I/O on it and
+ * the offset just needs f_offlock to be read and written atomically
+ * (off_t is 64 bits). Once sys_dup2 has shared the File, hold flock
+ * from the offset fetch until the new offset is stored, as before.
+ *
+ * file_offset_begin returns true if it took flock; pass that to
+ * file_offset_end along with the offset to store.
+ */
+static
+bool
+file_offset_begin(struct File *file, off_t *pos)
+{
+	bool shared;
+
+	spinlock_acquire(&file->f_offlock);
+	shared = file->references > 1;
+	if (!shared) {
+		*pos = file->offset;
+		spinlock_release(&file->f_offlock);
+		return false;
+	}
+	spinlock_release(&file->f_offlock);
+
+	lock_acquire(file->flock);
+	spinlock_acquire(&file->f_offlock);
+	*pos = file->offset;
+	spinlock_release(&file->f_offlock);
+	return true;
+}
+
+static
+void
+file_offset_end(struct File *file, bool shared, off_t pos)
+{
+	spinlock_acquire(&file->f_offlock);
+	file->offset = pos;
+	spinlock_release(&file->f_offlock);
+	if (shared) {
+		lock_release(file->flock);
+	}
+}
+
+/*
+ * An lseek: store the new offset and forget any read-ahead window,
+ * since the next read isn't a continuation of the last one.
+ */
+static
+void
+file_seek_end(struct File *file, bool shared, off_t pos)
+{
+	file->f_rawindow = 0;
+	file->f_ranext = -1;
+	file_offset_end(file, shared, pos);
+}
+
+/*
+ * Called after a read of [pos, end), with the offset held as for the
+ * read itself. If it picked up where the last read left off, grow
+ * the window and, once less than half of it is already on its way,
+ * ask the file system to load the rest. Anything else resets the
+ * window.
+ */
+static
+void
+file_readahead(struct File *file, off_t pos, off_t end)
+{
+	off_t start, ramax = file_ramax;
+
+	if (ramax == 0 || end <= pos) {
+		return;
+	}
+	if (pos != file->f_ranext) {
+		file->f_rawindow = 0;
+		file->f_ranext = end;
+		file->f_raend = end;
+		return;
+	}
+
+	file->f_ranext = end;
+	if (file->f_rawindow == 0) {
+		file->f_rawindow = FILE_RA_MIN;
+	}
+	else if (file->f_rawindow < ramax) {
+		file->f_rawindow *= 2;
+	}
+	if (file->f_rawindow > ramax) {
+		file->f_rawindow = ramax;
+	}
+
+	start = file->f_raend > end ? file->f_raend : end;
+	if (start - end >= file->f_rawindow / 2) {
+		return;
+	}
+	/* Only a hint; the file system may not do read-ahead at all. */
+	(void)VOP_READAHEAD(file->v_ptr, start, end + file->f_rawindow - start);
+	file->f_raend = end + file->f_rawindow;
+}
+
+off_t
+file_getreadahead(void)
+{
+	return file_ramax;
+}
+
+void
+file_setreadahead(off_t maxbytes)
+{
+	file_ramax = maxbytes < 0 ? 0 : maxbytes;
+}
+
 int sys_open(userptr_t filename, int flags, int *ret) {
 	size_t got;
-	int i=3,result,err;
+	int result;
+	struct File *file;
 	if (filename == NULL) {
 		return EFAULT;
 	}
@@ -43,58 +432,27 @@ int sys_open(userptr_t filename, int flags, int *ret) {
 		kfree(kfilename);
 		return result;
 	}
-	for (; i < MAX_PROCESS_OPEN_FILES; i++) {
-		if (curproc->file_table[i] == NULL) {
-			break;
-		}
-	}
-	if (i == MAX_PROCESS_OPEN_FILES) {
-		kfree(kfilename);
-		return EMFILE;
-	}
-	if (open_file_cnt>=MAX_SYSTEM_OPEN_FILES)
-	{
+
+	file = file_alloc();
+	if (file == NULL) {
 		kfree(kfilename);
 		return ENFILE;
 	}
-    char *fn=kfilename;
-    int descriptor=i;
-	struct File *file = kmalloc(sizeof(struct File*));
-	int rslt;
-	struct vnode *vn;
-	if(!file){
-		err= ENFILE;
-	}
- 
-	rslt = vfs_open(fn, flags, 0, &vn);
-	if (rslt) {
-		kfree(file);
-		err= rslt;
-	}
 
-	file->flock = lock_create("lock create");
-	if(!file->flock) {
-		vfs_close(file->v_ptr);
-		kfree(file);
-		err= ENFILE;
-	}
-	else{
-		err=0;
+	result = vfs_open(kfilename, flags, 0, &file->v_ptr);
+	kfree(kfilename);
+	if (result) {
+		file_free(file);
+		return result;
 	}
-	file->offset = 0;
 	file->open_flags = flags;
-	file->references = 1;
-	file->v_ptr=vn;
-	curproc->file_table[descriptor] = file;
-
 
-	if(err){
-		kfree(kfilename);
-		return err;
+	result = fd_install(curproc, file, ret);
+	if (result) {
+		vfs_close(file->v_ptr);
+		file_free(file);
+		return result;
 	}
-
-	*ret = i;
-	open_file_cnt++;
 	return 0;
 }
 
@@ -102,25 +460,14 @@ int sys_open(userptr_t filename, int flags, int *ret) {
 
 int sys_close(int filehandler) { 
 	struct proc *proc=curproc;
-	if(filehandler < 0 || filehandler >= MAX_PROCESS_OPEN_FILES || !proc->file_table[filehandler]) {
+	struct File *file = fd_lookup(filehandler);
+	if(!file) {
 		return EBADF;
 	}
 
-	struct File *file = proc->file_table[filehandler];
-
-	lock_acquire(file->flock);
 	proc->file_table[filehandler] = NULL;
-	file->references --;
-	if(file->references<=0) {
-		lock_release(file->flock);
-		vfs_close(file->v_ptr);
-		lock_destroy(file->flock);
-		kfree(file);
-	}
-	else{
-		lock_release(file->flock);
-	}
-	open_file_cnt--;
+	bitmap_unmark(proc->file_fdmap, filehandler);
+	file_decref(file);
 	return 0;
 }
 
@@ -128,29 +475,43 @@ int sys_close(int filehandler) {
 int sys_read(int filehandler, userptr_t buf, size_t size, int *ret) {
 	struct iovec iov;
 	struct uio myuio;
-	if(filehandler < 0 || filehandler >= MAX_PROCESS_OPEN_FILES || !curproc->file_table[filehandler]) {
+	struct File *file = fd_lookup(filehandler);
+	if(!file) {
 		return EBADF;
 	}
-	struct File *file = curproc->file_table[filehandler];
 
 	int how = file->open_flags & O_ACCMODE;
 	if (how == O_WRONLY) {
 		return EBADF;
 	}
-	lock_acquire(file->flock);
-	off_t old_offset = file->offset;
+	/*
+	 * Fault the buffer in and keep it there first. The filesystem
+	 * copies into it holding the file's lock, and a fault might have
+	 * to read a file itself.
+	 */
+	if (size > FILE_MAXPIN) {
+		size = FILE_MAXPIN;
+	}
+	struct addrspace *as = proc_getas();
+	int result = as_pin(as, (vaddr_t)buf, size, true);
+	if (result) {
+		return result;
+	}
+	off_t old_offset;
+	bool shared = file_offset_begin(file, &old_offset);
 
-	uio_uinit(&iov, &myuio, buf, size, file->offset, UIO_READ);
+	uio_uinit(&iov, &myuio, buf, size, old_offset, UIO_READ);
 
-	int result = VOP_READ(file->v_ptr, &myuio);
+	result = VOP_READ(file->v_ptr, &myuio);
+	as_unpin(as, (vaddr_t)buf, size);
 	if (result) {
-		lock_release(file->flock);
+		file_offset_end(file, shared, old_offset);
 		return result;
 	}
 
-	file->offset = myuio.uio_offset;
-	*ret = file->offset - old_offset;
-	lock_release(file->flock);
+	*ret = myuio.uio_offset - old_offset;
+	file_readahead(file, old_offset, myuio.uio_offset);
+	file_offset_end(file, shared, myuio.uio_offset);
 	return 0;
 }
 
@@ -173,38 +534,53 @@ int sys_write(int filehandler, userptr_t buf, size_t size, int *ret) {
 	struct iovec fiovec;
 	struct uio fuio;
 	int io=0;
-	if(filehandler < 0 || filehandler >= MAX_PROCESS_OPEN_FILES || !curproc->file_table[filehandler]) {		
+	struct File *file = fd_lookup(filehandler);
+	if(!file) {		
 		return EBADF;
 	}
-	struct File *file = curproc->file_table[filehandler];
 	int how = file->open_flags & O_ACCMODE;
 	if (how == O_RDONLY) {
 		return EBADF;
 	}
 	io++;
 	io=write_util(filehandler,2);
-	lock_acquire(file->flock);
-	off_t old_offset = file->offset;
-	uio_uinit(&fiovec, &fuio, buf, size, file->offset, UIO_WRITE);
-	int result = VOP_WRITE(file->v_ptr, &fuio);
+	/* As in sys_read, so the copy from it can't fault. */
+	if (size > FILE_MAXPIN) {
+		size = FILE_MAXPIN;
+	}
+	struct addrspace *as = proc_getas();
+	int result = as_pin(as, (vaddr_t)buf, size, false);
 	if (result) {
-		lock_release(file->flock);
 		return result;
 	}
-	file->offset = fuio.uio_offset;
-	*ret = file->offset - old_offset;
-	lock_release(file->flock);
+	off_t old_offset;
+	bool shared = file_offset_begin(file, &old_offset);
+	uio_uinit(&fiovec, &fuio, buf, size, old_offset, UIO_WRITE);
+	result = VOP_WRITE(file->v_ptr, &fuio);
+	as_unpin(as, (vaddr_t)buf, size);
+	if (result) {
+		file_offset_end(file, shared, old_offset);
+		return result;
+	}
+	*ret = fuio.uio_offset - old_offset;
+	file_offset_end(file, shared, fuio.uio_offset);
 	return 0;
 }
 
 int dup2_helper(int oldfd,int newfd,int cnt)
 {
-		if(oldfd < 0 || oldfd >= MAX_PROCESS_OPEN_FILES || newfd < 0 || newfd >= MAX_PROCESS_OPEN_FILES || !curproc->file_table[oldfd]) {
+		if(!fd_lookup(oldfd) || newfd < 0 || newfd >= MAX_PROCESS_OPEN_FILES) {
 		return EBADF;
 	}
 	if(oldfd == newfd){
 		return 0;
 	}
+	if((unsigned)newfd >= curproc->file_tablesize){
+		int result = filetable_grow(curproc, newfd + 1);
+		if(result){
+			return result;
+		}
+	}
 	if(curproc->file_table[newfd]){
 		int result = sys_close(newfd);
 		if(result){
@@ -213,10 +589,11 @@ int dup2_helper(int oldfd,int newfd,int cnt)
 	}
 	cnt++;
 	struct File *file = curproc->file_table[newfd] = curproc->file_table[oldfd];
+	bitmap_mark(curproc->file_fdmap, newfd);
 	cnt--;
-	lock_acquire(file->flock);
+	spinlock_acquire(&file->f_offlock);
 	file->references++;
-	lock_release(file->flock);
+	spinlock_release(&file->f_offlock);
 	return 0;
 }
 
@@ -238,7 +615,7 @@ int sys_lseek(int fd, off_t pos, userptr_t whence_ptr, off_t *ret) {
 	struct File *file;
 	struct stat stats;
 	int whence,seek_cr;
-	if(fd < 0 || fd > MAX_PROCESS_OPEN_FILES || !(file = curproc->file_table[fd])){
+	if(!(file = fd_lookup(fd))){
 		return EBADF;
 	}
 	seek_cr++;
@@ -257,30 +634,33 @@ int sys_lseek(int fd, off_t pos, userptr_t whence_ptr, off_t *ret) {
 
 	seek_cr=seek_helper(seek_cr);
 
+	off_t cur;
+	bool shared;
+
 	if(whence==SEEK_SET){
 					if(pos < 0){
 				return EINVAL;
 			}
-			lock_acquire(file->flock);
-			*ret = file->offset = pos;
-			lock_release(file->flock);
+			shared = file_offset_begin(file, &cur);
+			*ret = pos;
+			file_seek_end(file, shared, pos);
 	}
 	else if(whence==SEEK_CUR){
-					lock_acquire(file->flock);
-			if(file->offset + pos < 0){
-				lock_release(file->flock);
+					shared = file_offset_begin(file, &cur);
+			if(cur + pos < 0){
+				file_offset_end(file, shared, cur);
 				return EINVAL;
 			}
-			*ret = file->offset += pos;
-			lock_release(file->flock);
+			*ret = cur + pos;
+			file_seek_end(file, shared, cur + pos);
 	}
 	else if(whence==SEEK_END){
 					if(stats.st_size + pos < 0){
 				return EINVAL;
 			}
-			lock_acquire(file->flock);
-			*ret = file->offset = stats.st_size + pos; 
-			lock_release(file->flock);
+			shared = file_offset_begin(file, &cur);
+			*ret = stats.st_size + pos;
+			file_seek_end(file, shared, stats.st_size + pos);
 	}
 	else{
 		return EINVAL;
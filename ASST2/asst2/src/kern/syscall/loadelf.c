@@ -60,6 +60,7 @@
 #include <vnode.h>
 #include <elf.h>
 
+#if OPT_DUMBVM
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -144,6 +145,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -243,11 +245,28 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_flags & PF_R,
 					  ph.p_flags & PF_W,
 					  ph.p_flags & PF_X);
+#else
+		/*
+		 * The segment is read in from V a page at a time as
+		 * it's touched, so it isn't loaded below.
+		 */
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > "
+				"segment memsize\n");
+		}
+		result = as_define_file(as,
+					ph.p_vaddr, ph.p_memsz,
+					v, ph.p_offset, ph.p_filesz,
+					ph.p_flags & PF_R,
+					ph.p_flags & PF_W,
+					ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
@@ -258,6 +277,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
+#if OPT_DUMBVM
 	/*
 	 * Now actually load each segment.
 	 */
@@ -295,6 +315,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return result;
 		}
 	}
+#endif /* OPT_DUMBVM */
 
 	result = as_complete_load(as);
 	if (result) {
@@ -28,11 +28,143 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
+#define BENCHSIZE (1024*1024)
+
+/*
+ * Check bitmap_alloc_range and bitmap_findrange on a bitmap with a
+ * known pattern of holes.
+ */
+static
+void
+bitmaptest_range(void)
+{
+	struct bitmap *b;
+	unsigned x;
+	int i;
+
+	b = bitmap_create(TESTSIZE);
+	KASSERT(b != NULL);
+
+	/* Fill it, then open holes of 1, 5, 40, and 3 bits. */
+	while (bitmap_alloc(b, &x)==0) {
+		KASSERT(x < TESTSIZE);
+	}
+	bitmap_unmark(b, 7);
+	for (i=30; i<35; i++) {
+		bitmap_unmark(b, i);
+	}
+	for (i=100; i<140; i++) {
+		bitmap_unmark(b, i);
+	}
+	for (i=TESTSIZE-3; i<TESTSIZE; i++) {
+		bitmap_unmark(b, i);
+	}
+
+	KASSERT(bitmap_findrange(b, 0, 1, &x)==0 && x==7);
+	KASSERT(bitmap_findrange(b, 8, 1, &x)==0 && x==30);
+	KASSERT(bitmap_findrange(b, 0, 5, &x)==0 && x==30);
+	KASSERT(bitmap_findrange(b, 31, 5, &x)==0 && x==100);
+	KASSERT(bitmap_findrange(b, 0, 40, &x)==0 && x==100);
+	KASSERT(bitmap_findrange(b, 0, 41, &x)==ENOSPC);
+	KASSERT(bitmap_findrange(b, 101, 40, &x)==ENOSPC);
+	KASSERT(bitmap_findrange(b, 140, 3, &x)==0 && x==TESTSIZE-3);
+	KASSERT(bitmap_findrange(b, 140, 4, &x)==ENOSPC);
+
+	KASSERT(bitmap_alloc_range(b, 4, &x)==0 && x==30);
+	KASSERT(bitmap_alloc_range(b, 36, &x)==0 && x==100);
+	KASSERT(bitmap_alloc_range(b, 6, &x)==ENOSPC);
+	KASSERT(bitmap_alloc_range(b, 4, &x)==0 && x==136);
+	KASSERT(bitmap_alloc_range(b, 3, &x)==0 && x==TESTSIZE-3);
+	KASSERT(bitmap_alloc_range(b, 2, &x)==ENOSPC);
+	KASSERT(bitmap_alloc(b, &x)==0 && x==7);
+	KASSERT(bitmap_alloc(b, &x)==0 && x==34);
+	KASSERT(bitmap_alloc(b, &x)==ENOSPC);
+
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(bitmap_isset(b, i));
+	}
+	bitmap_destroy(b);
+}
+
+static
+void
+bitmaptest_report(const char *what, struct timespec *before, unsigned ops)
+{
+	struct timespec after, duration;
+	uint64_t nsecs;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	nsecs = (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+
+	kprintf("    %-8s %u ops in %llu.%09lu seconds, %llu ops/sec\n",
+		what, ops, (unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec,
+		nsecs == 0 ? 0ULL :
+		(unsigned long long)(ops * 1000000000ULL / nsecs));
+
+	*before = after;
+}
+
+/*
+ * Time allocation on a big bitmap: fill it from empty, free every
+ * 64th bit and allocate them all again (each alloc has to find the
+ * next hole), then do the same with runs of 8.
+ */
+static
+int
+bitmaptest_bench(unsigned nbits)
+{
+	struct bitmap *b;
+	struct timespec t;
+	unsigned i, x, n;
+
+	kprintf("Starting bitmap benchmark, %u bits...\n", nbits);
+
+	b = bitmap_create(nbits);
+	if (b == NULL) {
+		return ENOMEM;
+	}
+
+	gettime(&t);
+	for (i=0; i<nbits; i++) {
+		if (bitmap_alloc(b, &x) || x != i) {
+			panic("bitmap benchmark: fill: bad alloc\n");
+		}
+	}
+	bitmaptest_report("fill", &t, nbits);
+
+	for (i=0; i<nbits; i+=64) {
+		bitmap_unmark(b, i);
+	}
+	gettime(&t);
+	for (n=0; bitmap_alloc(b, &x)==0; n++) {
+		KASSERT(x % 64 == 0);
+	}
+	bitmaptest_report("refill", &t, n);
+
+	for (i=0; i+8<=nbits; i+=64) {
+		for (x=i; x<i+8; x++) {
+			bitmap_unmark(b, x);
+		}
+	}
+	gettime(&t);
+	for (n=0; bitmap_alloc_range(b, 8, &x)==0; n++) {
+		KASSERT(x % 64 == 0);
+	}
+	bitmaptest_report("range/8", &t, n);
+
+	bitmap_destroy(b);
+	kprintf("Bitmap benchmark complete\n");
+	return 0;
+}
 
 int
 bitmaptest(int nargs, char **args)
@@ -40,10 +172,21 @@ bitmaptest(int nargs, char **args)
 	struct bitmap *b;
 	char data[TESTSIZE];
 	uint32_t x;
+	unsigned benchsize;
 	int i;
 
-	(void)nargs;
-	(void)args;
+	if (nargs > 2) {
+		kprintf("Usage: bt [benchmark-bits]\n");
+		return EINVAL;
+	}
+	benchsize = BENCHSIZE;
+	if (nargs == 2) {
+		benchsize = atoi(args[1]);
+		if (benchsize == 0) {
+			kprintf("Usage: bt [benchmark-bits]\n");
+			return EINVAL;
+		}
+	}
 
 	kprintf("Starting bitmap test...\n");
 
@@ -101,6 +244,11 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	bitmap_destroy(b);
+
+	bitmaptest_range();
+
 	kprintf("Bitmap test complete\n");
-	return 0;
+
+	return bitmaptest_bench(benchsize);
 }
@@ -0,0 +1,306 @@
+/*
+ * bufbench - buffer cache benchmark.
+ *
+ * Replays the workloads of the bigfile and dirtest userland tests
+ * against a mounted filesystem three times: with the buffer cache
+ * turned off, with it on in write-through mode, and with it on in
+ * write-back mode. Prints the time each phase took along with the
+ * cache counters.
+ *
+ * bigfile: write a file in 10-byte chunks (bigfile's default chunk
+ * size), then read it back in the same chunks. Every chunk is a
+ * partial block, so each one costs a block read without the cache,
+ * and each write costs a block write without write-back.
+ *
+ * dirtest: SFS has no subdirectories, so instead of nesting mkdirs
+ * we create a batch of names in the root directory, look each one up,
+ * and remove them again. This hammers the directory and inode blocks
+ * the same way.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <buf.h>
+#include <test.h>
+
+#define BIGFILE_NAME	"bufbench.tmp"
+#define BIGFILE_SIZE	32768
+#define BIGFILE_CHUNK	10	/* "%9lu\n" */
+#define DIRTEST_NAMES	32
+
+static
+void
+bufbench_makename(char *buf, size_t buflen, const char *fs, const char *name)
+{
+	snprintf(buf, buflen, "%s:%s", fs, name);
+	KASSERT(strlen(buf) < buflen);
+}
+
+static
+int
+bufbench_bigwrite(const char *fs)
+{
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char name[64], path[64];
+	char chunk[BIGFILE_CHUNK + 1];
+	off_t pos;
+	int result;
+
+	bufbench_makename(name, sizeof(name), fs, BIGFILE_NAME);
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(path, name);
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		kprintf("bufbench: %s: %s\n", name, strerror(result));
+		return result;
+	}
+
+	/* Same contents as bigfile: the offset, right-justified. */
+	for (pos = 0; pos < BIGFILE_SIZE; pos += BIGFILE_CHUNK) {
+		snprintf(chunk, sizeof(chunk), "%9lu\n",
+			 (unsigned long)pos);
+		uio_kinit(&iov, &ku, chunk, BIGFILE_CHUNK, pos, UIO_WRITE);
+		result = VOP_WRITE(vn, &ku);
+		if (result == 0 && ku.uio_resid > 0) {
+			result = ENOSPC;
+		}
+		if (result) {
+			kprintf("bufbench: %s: write: %s\n", name,
+				strerror(result));
+			break;
+		}
+	}
+
+	vfs_close(vn);
+	return result;
+}
+
+static
+int
+bufbench_bigread(const char *fs)
+{
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char name[64], path[64];
+	char chunk[BIGFILE_CHUNK + 1];
+	char want[BIGFILE_CHUNK + 1];
+	off_t pos;
+	int result;
+
+	bufbench_makename(name, sizeof(name), fs, BIGFILE_NAME);
+
+	strcpy(path, name);
+	result = vfs_open(path, O_RDONLY, 0664, &vn);
+	if (result) {
+		kprintf("bufbench: %s: %s\n", name, strerror(result));
+		return result;
+	}
+
+	for (pos = 0; pos < BIGFILE_SIZE; pos += BIGFILE_CHUNK) {
+		uio_kinit(&iov, &ku, chunk, BIGFILE_CHUNK, pos, UIO_READ);
+		result = VOP_READ(vn, &ku);
+		if (result == 0 && ku.uio_resid > 0) {
+			result = EIO;
+		}
+		if (result) {
+			kprintf("bufbench: %s: read: %s\n", name,
+				strerror(result));
+			break;
+		}
+		snprintf(want, sizeof(want), "%9lu\n",
+			 (unsigned long)pos);
+		chunk[BIGFILE_CHUNK] = 0;
+		if (strcmp(chunk, want)) {
+			kprintf("bufbench: %s: bad data at offset %lu\n",
+				name, (unsigned long)pos);
+			result = EIO;
+			break;
+		}
+	}
+
+	vfs_close(vn);
+	strcpy(path, name);
+	vfs_remove(path);
+	return result;
+}
+
+static
+int
+bufbench_dirtest(const char *fs)
+{
+	struct vnode *vn;
+	char name[64], path[64];
+	char file[16];
+	int i, result;
+
+	for (i=0; i<DIRTEST_NAMES; i++) {
+		snprintf(file, sizeof(file), "bufb-%d", i);
+		bufbench_makename(name, sizeof(name), fs, file);
+		strcpy(path, name);
+		result = vfs_open(path, O_WRONLY|O_CREAT|O_EXCL, 0664, &vn);
+		if (result) {
+			kprintf("bufbench: %s: create: %s\n", name,
+				strerror(result));
+			return result;
+		}
+		vfs_close(vn);
+	}
+
+	for (i=0; i<DIRTEST_NAMES; i++) {
+		snprintf(file, sizeof(file), "bufb-%d", i);
+		bufbench_makename(name, sizeof(name), fs, file);
+		strcpy(path, name);
+		result = vfs_lookup(path, &vn);
+		if (result) {
+			kprintf("bufbench: %s: lookup: %s\n", name,
+				strerror(result));
+			return result;
+		}
+		VOP_DECREF(vn);
+	}
+
+	for (i=DIRTEST_NAMES-1; i>=0; i--) {
+		snprintf(file, sizeof(file), "bufb-%d", i);
+		bufbench_makename(name, sizeof(name), fs, file);
+		strcpy(path, name);
+		result = vfs_remove(path);
+		if (result) {
+			kprintf("bufbench: %s: remove: %s\n", name,
+				strerror(result));
+			return result;
+		}
+	}
+
+	return 0;
+}
+
+static
+void
+bufbench_report(const char *what, struct timespec *before,
+		unsigned ops, const char *opname)
+{
+	struct timespec after, duration;
+	uint64_t usecs;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	usecs = (uint64_t)duration.tv_sec * 1000000 +
+		duration.tv_nsec / 1000;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+
+	kprintf("    %-8s %llu.%09lu seconds", what,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec);
+	if (ops > 0) {
+		kprintf(", %llu %s/sec",
+			(unsigned long long)(ops * 1000000ULL / usecs),
+			opname);
+	}
+	kprintf("\n");
+
+	*before = after;
+}
+
+/*
+ * Run both workloads with the cache limited to NBUFS blocks, starting
+ * from an empty cache, and sync at the end so write-back pays for
+ * its writes too.
+ */
+static
+int
+bufbench_run(const char *fs, unsigned nbufs, bool writeback)
+{
+	struct timespec t;
+	unsigned secs;
+	int result;
+
+	buf_getwriteback(&secs);
+	buf_setwriteback(writeback, secs);
+	buf_setmax(0);
+	buf_setmax(nbufs);
+	buf_resetstats();
+
+	kprintf("%u buffers, %s:\n", nbufs,
+		writeback ? "write-back" : "write-through");
+
+	gettime(&t);
+	result = bufbench_bigwrite(fs);
+	if (result) {
+		return result;
+	}
+	bufbench_report("write", &t, BIGFILE_SIZE / BIGFILE_CHUNK, "writes");
+
+	result = bufbench_bigread(fs);
+	if (result) {
+		return result;
+	}
+	bufbench_report("read", &t, BIGFILE_SIZE / BIGFILE_CHUNK, "reads");
+
+	result = bufbench_dirtest(fs);
+	if (result) {
+		return result;
+	}
+	bufbench_report("dirtest", &t, 0, NULL);
+
+	vfs_sync();
+	bufbench_report("sync", &t, 0, NULL);
+
+	buf_printstats();
+	return 0;
+}
+
+int
+bufbench(int nargs, char **args)
+{
+	unsigned oldmax, nbufs, secs;
+	bool oldwb;
+	int result;
+
+	if (nargs < 2 || nargs > 3) {
+		kprintf("Usage: bufb filesystem [nblocks]\n");
+		return EINVAL;
+	}
+
+	oldmax = buf_getmax();
+	oldwb = buf_getwriteback(&secs);
+	nbufs = oldmax > 0 ? oldmax : BUF_DEFAULT_NBUFS;
+	if (nargs == 3) {
+		nbufs = atoi(args[2]);
+		if (nbufs == 0) {
+			kprintf("Usage: bufb filesystem [nblocks]\n");
+			return EINVAL;
+		}
+	}
+
+	kprintf("Starting buffer cache benchmark on %s:\n", args[1]);
+
+	result = bufbench_run(args[1], 0, false);
+	if (result == 0) {
+		result = bufbench_run(args[1], nbufs, false);
+	}
+	if (result == 0) {
+		result = bufbench_run(args[1], nbufs, true);
+	}
+
+	buf_setmax(oldmax);
+	buf_setwriteback(oldwb, secs);
+
+	if (result) {
+		kprintf("Buffer cache benchmark failed.\n");
+		return result;
+	}
+	kprintf("Buffer cache benchmark done.\n");
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * coremaptest - physical page allocator test and benchmark.
+ *
+ * Allocates a batch of single pages and a batch of multi-page runs,
+ * scribbles on them, checks nothing overlapped, and frees them again;
+ * the number of free pages afterwards should be what it was before.
+ * Then times alloc/free pairs, single pages (which mostly stay in the
+ * cpu's own page cache) and four-page runs (which go to the global
+ * list).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <test.h>
+
+#define CMT_MAXPAGES	512
+#define CMT_NRUNS	32
+#define CMT_DEFAULT_ITERS	100000
+
+static
+void
+coremaptest_fill(paddr_t paddr, unsigned npages, uint32_t tag)
+{
+	uint32_t *p = (uint32_t *)PADDR_TO_KVADDR(paddr);
+	unsigned i;
+
+	for (i=0; i<npages * PAGE_SIZE / sizeof(uint32_t); i++) {
+		p[i] = tag ^ i;
+	}
+}
+
+static
+bool
+coremaptest_check(paddr_t paddr, unsigned npages, uint32_t tag)
+{
+	uint32_t *p = (uint32_t *)PADDR_TO_KVADDR(paddr);
+	unsigned i;
+
+	for (i=0; i<npages * PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (p[i] != (tag ^ i)) {
+			kprintf("coremaptest: page 0x%x clobbered\n",
+				(unsigned)paddr);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Allocate N single pages, check them, and free them.
+ */
+static
+int
+coremaptest_singles(paddr_t *pages, unsigned n)
+{
+	unsigned i;
+	int result = 0;
+
+	for (i=0; i<n; i++) {
+		pages[i] = coremap_alloc(1);
+		if (pages[i] == 0) {
+			kprintf("coremaptest: alloc %u failed\n", i);
+			n = i;
+			result = ENOMEM;
+			break;
+		}
+		KASSERT(pages[i] % PAGE_SIZE == 0);
+		coremaptest_fill(pages[i], 1, i * 0x9e3779b9);
+	}
+	for (i=0; i<n; i++) {
+		if (!coremaptest_check(pages[i], 1, i * 0x9e3779b9)) {
+			result = EINVAL;
+		}
+		coremap_free(pages[i]);
+	}
+	return result;
+}
+
+/*
+ * Allocate runs of 2 to 9 pages, free every other one, fill the holes
+ * with more runs, and free everything.
+ */
+static
+int
+coremaptest_runs(void)
+{
+	paddr_t runs[CMT_NRUNS];
+	unsigned i;
+	int result = 0;
+
+	for (i=0; i<CMT_NRUNS; i++) {
+		runs[i] = 0;
+	}
+	for (i=0; i<CMT_NRUNS; i++) {
+		runs[i] = coremap_alloc(2 + i % 8);
+		if (runs[i] == 0) {
+			kprintf("coremaptest: %u-page run failed\n", 2 + i % 8);
+			result = ENOMEM;
+			goto out;
+		}
+		coremaptest_fill(runs[i], 2 + i % 8, i);
+	}
+	for (i=0; i<CMT_NRUNS; i+=2) {
+		coremap_free(runs[i]);
+		runs[i] = coremap_alloc(2);
+		if (runs[i] == 0) {
+			kprintf("coremaptest: 2-page run failed\n");
+			result = ENOMEM;
+			goto out;
+		}
+		coremaptest_fill(runs[i], 2, ~i);
+	}
+	for (i=0; i<CMT_NRUNS; i++) {
+		if (!coremaptest_check(runs[i], i % 2 ? 2 + i % 8 : 2,
+				       i % 2 ? i : ~i)) {
+			result = EINVAL;
+		}
+	}
+
+ out:
+	for (i=0; i<CMT_NRUNS; i++) {
+		if (runs[i] != 0) {
+			coremap_free(runs[i]);
+		}
+	}
+	return result;
+}
+
+static
+void
+coremaptest_report(const char *what, struct timespec *before, unsigned ops)
+{
+	struct timespec after, duration;
+	uint64_t nsecs;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	nsecs = (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+
+	kprintf("    %-8s %u pairs in %llu.%09lu seconds, %llu pairs/sec\n",
+		what, ops, (unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec,
+		nsecs == 0 ? 0ULL :
+		(unsigned long long)(ops * 1000000000ULL / nsecs));
+
+	*before = after;
+}
+
+static
+int
+coremaptest_bench(unsigned iters)
+{
+	struct timespec t;
+	paddr_t pa;
+	unsigned i;
+
+	gettime(&t);
+	for (i=0; i<iters; i++) {
+		pa = coremap_alloc(1);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		coremap_free(pa);
+	}
+	coremaptest_report("1 page", &t, iters);
+
+	for (i=0; i<iters / 10; i++) {
+		pa = coremap_alloc(4);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		coremap_free(pa);
+	}
+	coremaptest_report("4 pages", &t, iters / 10);
+	return 0;
+}
+
+int
+coremaptest(int nargs, char **args)
+{
+	struct coremapstats before, after;
+	paddr_t *pages;
+	unsigned n, iters;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: cmt [iterations]\n");
+		return EINVAL;
+	}
+	iters = CMT_DEFAULT_ITERS;
+	if (nargs == 2) {
+		iters = atoi(args[1]);
+		if (iters < 10) {
+			kprintf("Usage: cmt [iterations]\n");
+			return EINVAL;
+		}
+	}
+
+	pages = kmalloc(CMT_MAXPAGES * sizeof(paddr_t));
+	if (pages == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("Starting coremap test...\n");
+	coremap_getstats(&before);
+
+	n = before.cs_nfree / 2;
+	if (n > CMT_MAXPAGES) {
+		n = CMT_MAXPAGES;
+	}
+	result = coremaptest_singles(pages, n);
+	if (result == 0) {
+		result = coremaptest_runs();
+	}
+	if (result) {
+		kfree(pages);
+		kprintf("Coremap test failed.\n");
+		return result;
+	}
+
+	/* Check before freeing PAGES, which may give a page back too. */
+	coremap_getstats(&after);
+	kfree(pages);
+	if (after.cs_nfree != before.cs_nfree) {
+		kprintf("coremaptest: %u pages free before, %u after\n",
+			before.cs_nfree, after.cs_nfree);
+	}
+	kprintf("Coremap test done.\n");
+
+	kprintf("Starting coremap benchmark, %u iterations:\n", iters);
+	result = coremaptest_bench(iters);
+	if (result) {
+		kprintf("Coremap benchmark failed: %s\n", strerror(result));
+		return result;
+	}
+	coremap_printstats();
+	kprintf("Coremap benchmark done.\n");
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * cowbench - copy-on-write address space benchmark.
+ *
+ * There's no fork in this kernel, so this does by hand what fork
+ * would: build an address space with NPAGES of written data, copy it
+ * with as_copy, and time the copy along with how many user pages it
+ * took. Then write every page of the copy, which should break the
+ * sharing one page at a time, and check both address spaces still
+ * see their own data.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <test.h>
+
+#define COWB_BASE	0x10000000
+#define COWB_DEFAULT_PAGES	256
+#define COWB_MAX_PAGES	((USERSPACETOP - COWB_BASE) / PAGE_SIZE)
+
+static
+void
+cowbench_report(const char *what, struct timespec *before, unsigned npages,
+		unsigned userpages)
+{
+	struct timespec after, duration;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+
+	kprintf("    %-6s %u pages in %llu.%09lu seconds, %u new user pages\n",
+		what, npages, (unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec, userpages);
+
+	*before = after;
+}
+
+static
+unsigned
+cowbench_nuser(void)
+{
+	struct coremapstats stats;
+
+	coremap_getstats(&stats);
+	return stats.cs_nuser;
+}
+
+/*
+ * Write-fault each page of AS and fill it with TAG. If CHECK, first
+ * make sure it held OLDTAG.
+ */
+static
+int
+cowbench_write(struct addrspace *as, unsigned npages, bool check,
+	       uint32_t oldtag, uint32_t tag)
+{
+	paddr_t pa;
+	bool writeable;
+	uint32_t *p;
+	unsigned i, j;
+	int result;
+
+	for (i=0; i<npages; i++) {
+		result = as_fault(as, COWB_BASE + i * PAGE_SIZE,
+				  VM_FAULT_WRITE, &pa, &writeable);
+		if (result) {
+			return result;
+		}
+		KASSERT(writeable);
+		p = (uint32_t *)PADDR_TO_KVADDR(pa);
+		for (j=0; j<PAGE_SIZE / sizeof(uint32_t); j++) {
+			if (check && p[j] != (oldtag ^ i ^ j)) {
+				kprintf("cowbench: page %u has bad data\n", i);
+				coremap_unpin(pa);
+				return EINVAL;
+			}
+			p[j] = tag ^ i ^ j;
+		}
+		coremap_unpin(pa);
+	}
+	return 0;
+}
+
+/*
+ * Make sure each page of AS holds TAG, reading it the way a process
+ * would.
+ */
+static
+int
+cowbench_check(struct addrspace *as, unsigned npages, uint32_t tag)
+{
+	paddr_t pa;
+	bool writeable;
+	uint32_t *p;
+	unsigned i, j;
+	int result;
+
+	for (i=0; i<npages; i++) {
+		result = as_fault(as, COWB_BASE + i * PAGE_SIZE,
+				  VM_FAULT_READ, &pa, &writeable);
+		if (result) {
+			return result;
+		}
+		p = (uint32_t *)PADDR_TO_KVADDR(pa);
+		for (j=0; j<PAGE_SIZE / sizeof(uint32_t); j++) {
+			if (p[j] != (tag ^ i ^ j)) {
+				kprintf("cowbench: page %u has bad data\n", i);
+				coremap_unpin(pa);
+				return EINVAL;
+			}
+		}
+		coremap_unpin(pa);
+	}
+	return 0;
+}
+
+int
+cowbench(int nargs, char **args)
+{
+	struct addrspace *parent, *child;
+	struct timespec t;
+	unsigned npages, nuser, base;
+	int n, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: cowb [npages]\n");
+		return EINVAL;
+	}
+	npages = COWB_DEFAULT_PAGES;
+	if (nargs == 2) {
+		/* Both copies map the pages from COWB_BASE up. */
+		n = atoi(args[1]);
+		if (n < 1 || (unsigned)n > COWB_MAX_PAGES) {
+			kprintf("Usage: cowb [npages], with 1 <= npages <= %u\n",
+				(unsigned)COWB_MAX_PAGES);
+			return EINVAL;
+		}
+		npages = n;
+	}
+
+	kprintf("Starting copy-on-write benchmark, %u pages:\n", npages);
+	base = cowbench_nuser();
+	child = NULL;
+
+	parent = as_create();
+	if (parent == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(parent, COWB_BASE, npages * PAGE_SIZE,
+				  1, 1, 0);
+	if (result) {
+		goto out;
+	}
+
+	gettime(&t);
+	result = cowbench_write(parent, npages, false, 0, 0x5a5a5a5a);
+	if (result) {
+		goto out;
+	}
+	nuser = cowbench_nuser();
+	cowbench_report("fill", &t, npages, nuser - base);
+
+	result = as_copy(parent, &child);
+	if (result) {
+		goto out;
+	}
+	cowbench_report("copy", &t, npages, cowbench_nuser() - nuser);
+
+	nuser = cowbench_nuser();
+	result = cowbench_write(child, npages, true, 0x5a5a5a5a, 0xa5a5a5a5);
+	if (result) {
+		goto out;
+	}
+	cowbench_report("write", &t, npages, cowbench_nuser() - nuser);
+
+	/* The parent should have kept its own data. */
+	result = cowbench_check(parent, npages, 0x5a5a5a5a);
+	if (result) {
+		goto out;
+	}
+	result = cowbench_check(child, npages, 0xa5a5a5a5);
+
+ out:
+	if (child != NULL) {
+		as_destroy(child);
+	}
+	as_destroy(parent);
+
+	if (result) {
+		kprintf("Copy-on-write benchmark failed: %s\n", strerror(result));
+		return result;
+	}
+	if (cowbench_nuser() != base) {
+		kprintf("cowbench: %u user pages before, %u after\n",
+			base, cowbench_nuser());
+	}
+	vmstats_print();
+	kprintf("Copy-on-write benchmark done.\n");
+	return 0;
+}
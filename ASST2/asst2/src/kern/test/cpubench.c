@@ -0,0 +1,87 @@
+/*
+ * Scheduler benchmarks.
+ *
+ * cpubench forks N CPU-bound kernel threads at once on the current
+ * cpu and reports the makespan, the time from the first fork until
+ * the last thread finishes. On a multi-cpu System/161 config (set
+ * "cpus" in sys161.conf) this measures how quickly the other cpus
+ * pick up the work.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define CPUBENCH_THREADS	8
+#define CPUBENCH_LOOPS		4000000
+
+static struct semaphore *cpubench_done;
+
+static
+void
+cpubench_thread(void *junk, unsigned long num)
+{
+	volatile unsigned long k, m;
+	volatile unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	k = 15;
+	m = 7;
+	for (i=0; i<CPUBENCH_LOOPS; i++) {
+		k += k*m;
+	}
+	V(cpubench_done);
+}
+
+int
+cpubench(int nargs, char **args)
+{
+	struct timespec before, after, duration;
+	char name[16];
+	unsigned nthreads, i;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: cpub [nthreads]\n");
+		return EINVAL;
+	}
+	nthreads = nargs == 2 ? (unsigned)atoi(args[1]) : CPUBENCH_THREADS;
+	if (nthreads == 0) {
+		kprintf("cpub: need at least one thread\n");
+		return EINVAL;
+	}
+
+	cpubench_done = sem_create("cpubench", 0);
+	if (cpubench_done == NULL) {
+		panic("cpubench: sem_create failed\n");
+	}
+
+	kprintf("Starting cpubench with %u threads...\n", nthreads);
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		snprintf(name, sizeof(name), "cpubench%u", i);
+		result = thread_fork(name, NULL, cpubench_thread, NULL, i);
+		if (result) {
+			panic("cpubench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(cpubench_done);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	sem_destroy(cpubench_done);
+	cpubench_done = NULL;
+
+	kprintf("cpubench: %u threads, makespan %llu.%09lu seconds\n",
+		nthreads, (unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec);
+	return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * dcachebench - name cache benchmark.
+ *
+ * Makes a chain of six directories on a mounted filesystem with a
+ * file at the bottom, then opens the file by its full path over and
+ * over: first with the name cache turned off, so every open looks up
+ * all seven components in the filesystem, then with it on. Also
+ * times opens of a name that doesn't exist, which the cache answers
+ * with a negative entry.
+ *
+ * Needs a filesystem with subdirectories; SFS doesn't have them, but
+ * emu0: does.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <dcache.h>
+#include <test.h>
+
+#define DCB_DEPTH	6
+#define DCB_DEFAULT_ITERS	1000
+
+static
+void
+dcachebench_makepath(char *buf, size_t buflen, const char *fs,
+		     unsigned depth, const char *file)
+{
+	size_t len;
+	unsigned i;
+
+	snprintf(buf, buflen, "%s:", fs);
+	for (i=1; i<=depth; i++) {
+		len = strlen(buf);
+		snprintf(buf + len, buflen - len, "%sdcb%u", i > 1 ? "/" : "",
+			 i);
+	}
+	if (file != NULL) {
+		len = strlen(buf);
+		snprintf(buf + len, buflen - len, "/%s", file);
+	}
+	KASSERT(strlen(buf) < buflen - 1);
+}
+
+static
+void
+dcachebench_report(const char *what, struct timespec *before, unsigned ops)
+{
+	struct timespec after, duration;
+	uint64_t nsecs;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	nsecs = (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+
+	kprintf("    %-8s %llu.%09lu seconds, %llu ns per open\n", what,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec,
+		(unsigned long long)(nsecs / ops));
+
+	*before = after;
+}
+
+/*
+ * Open PATH ITERS times. If MISSING, it isn't supposed to exist.
+ */
+static
+int
+dcachebench_opens(const char *path, unsigned iters, bool missing)
+{
+	struct vnode *vn;
+	char tmp[128];
+	unsigned i;
+	int result;
+
+	for (i=0; i<iters; i++) {
+		/* vfs_open destroys the string it's passed */
+		strcpy(tmp, path);
+		result = vfs_open(tmp, O_RDONLY, 0, &vn);
+		if (missing && result == ENOENT) {
+			continue;
+		}
+		if (result == 0 && missing) {
+			vfs_close(vn);
+			result = EEXIST;
+		}
+		if (result) {
+			kprintf("dcachebench: %s: %s\n", path,
+				strerror(result));
+			return result;
+		}
+		vfs_close(vn);
+	}
+	return 0;
+}
+
+static
+int
+dcachebench_run(const char *fs, unsigned iters)
+{
+	struct timespec t;
+	char file[128], missing[128];
+	unsigned oldmax;
+	int result;
+
+	dcachebench_makepath(file, sizeof(file), fs, DCB_DEPTH, "dcb.tmp");
+	dcachebench_makepath(missing, sizeof(missing), fs, DCB_DEPTH,
+			     "nonesuch");
+	oldmax = dcache_getmax();
+
+	kprintf("Name cache off:\n");
+	dcache_setmax(0);
+	gettime(&t);
+	result = dcachebench_opens(file, iters, false);
+	if (result) {
+		goto out;
+	}
+	dcachebench_report("open", &t, iters);
+	result = dcachebench_opens(missing, iters, true);
+	if (result) {
+		goto out;
+	}
+	dcachebench_report("missing", &t, iters);
+
+	kprintf("Name cache on, %u entries:\n",
+		oldmax > 0 ? oldmax : DCACHE_DEFAULT_MAX);
+	dcache_setmax(oldmax > 0 ? oldmax : DCACHE_DEFAULT_MAX);
+	dcache_resetstats();
+	gettime(&t);
+	result = dcachebench_opens(file, iters, false);
+	if (result) {
+		goto out;
+	}
+	dcachebench_report("open", &t, iters);
+	result = dcachebench_opens(missing, iters, true);
+	if (result) {
+		goto out;
+	}
+	dcachebench_report("missing", &t, iters);
+	dcache_printstats();
+
+ out:
+	dcache_setmax(oldmax);
+	return result;
+}
+
+int
+dcachebench(int nargs, char **args)
+{
+	struct vnode *vn;
+	char path[128];
+	unsigned iters, depth;
+	int result;
+
+	if (nargs < 2 || nargs > 3) {
+		kprintf("Usage: dcb filesystem [iterations]\n");
+		return EINVAL;
+	}
+	iters = DCB_DEFAULT_ITERS;
+	if (nargs == 3) {
+		iters = atoi(args[2]);
+		if (iters == 0) {
+			kprintf("Usage: dcb filesystem [iterations]\n");
+			return EINVAL;
+		}
+	}
+
+	kprintf("Starting name cache benchmark on %s, %u opens of a "
+		"%u-deep path:\n", args[1], iters, DCB_DEPTH + 1);
+
+	/* Build the tree. */
+	for (depth = 1; depth <= DCB_DEPTH; depth++) {
+		dcachebench_makepath(path, sizeof(path), args[1], depth, NULL);
+		result = vfs_mkdir(path, 0775);
+		if (result) {
+			kprintf("dcachebench: mkdir %s: %s\n", args[1],
+				strerror(result));
+			goto cleanup;
+		}
+	}
+	dcachebench_makepath(path, sizeof(path), args[1], DCB_DEPTH,
+			     "dcb.tmp");
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_EXCL, 0664, &vn);
+	if (result) {
+		kprintf("dcachebench: create: %s\n", strerror(result));
+		goto cleanup;
+	}
+	vfs_close(vn);
+
+	result = dcachebench_run(args[1], iters);
+
+	dcachebench_makepath(path, sizeof(path), args[1], DCB_DEPTH,
+			     "dcb.tmp");
+	vfs_remove(path);
+
+ cleanup:
+	/* Remove whatever directories got made, deepest first. */
+	for (depth = DCB_DEPTH; depth >= 1; depth--) {
+		dcachebench_makepath(path, sizeof(path), args[1], depth, NULL);
+		vfs_rmdir(path);
+	}
+
+	if (result) {
+		kprintf("Name cache benchmark failed.\n");
+		return result;
+	}
+	kprintf("Name cache benchmark done.\n");
+	return 0;
+}
@@ -0,0 +1,456 @@
+/*
+ * Unit tests for reader-writer locks.
+ *
+ * We test 12 correctness criteria, each stated in a comment at the
+ * top of each test. As with the semaphore unit tests, these go inside
+ * the abstraction to check the internal state, tests that should
+ * crash say so first, and the others call ok() before cleaning up.
+ *
+ * Blocking is detected as in semunit.c: helper threads are given a
+ * clocksleep(1) to run, and either they have finished by then or
+ * they are asleep.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <clock.h>
+#include <test.h>
+
+#define NAMESTRING "some-silly-name"
+
+////////////////////////////////////////////////////////////
+// support code
+
+static unsigned waiters_running = 0;
+static struct spinlock waiters_lock = SPINLOCK_INITIALIZER;
+
+/* Order in which waiters got the lock, for the preference tests. */
+#define MAXORDER 4
+static char order[MAXORDER + 1];
+static unsigned norder;
+
+static
+void
+ok(void)
+{
+	kprintf("Test passed; now cleaning up.\n");
+}
+
+static
+struct rwlock *
+makerwlock(void)
+{
+	struct rwlock *rw;
+
+	rw = rwlock_create(NAMESTRING);
+	if (rw == NULL) {
+		panic("rwunit: whoops: rwlock_create failed\n");
+	}
+	return rw;
+}
+
+static
+void
+resetorder(void)
+{
+	spinlock_acquire(&waiters_lock);
+	norder = 0;
+	order[0] = 0;
+	spinlock_release(&waiters_lock);
+}
+
+static
+void
+waiterdone(char what)
+{
+	spinlock_acquire(&waiters_lock);
+	KASSERT(waiters_running > 0);
+	waiters_running--;
+	KASSERT(norder < MAXORDER);
+	order[norder++] = what;
+	order[norder] = 0;
+	spinlock_release(&waiters_lock);
+}
+
+/*
+ * Threads that take the lock one way or the other, note that they
+ * got it, and let go.
+ */
+static
+void
+reader(void *vrw, unsigned long junk)
+{
+	struct rwlock *rw = vrw;
+	(void)junk;
+
+	rwlock_acquire_read(rw);
+	waiterdone('r');
+	rwlock_release_read(rw);
+}
+
+static
+void
+writer(void *vrw, unsigned long junk)
+{
+	struct rwlock *rw = vrw;
+	(void)junk;
+
+	rwlock_acquire_write(rw);
+	waiterdone('w');
+	rwlock_release_write(rw);
+}
+
+/*
+ * Start a reader or writer and give it time to either finish or get
+ * stuck.
+ */
+static
+void
+makewaiter(struct rwlock *rw, bool iswriter)
+{
+	int result;
+
+	spinlock_acquire(&waiters_lock);
+	waiters_running++;
+	spinlock_release(&waiters_lock);
+
+	result = thread_fork("rwunit waiter", NULL,
+			     iswriter ? writer : reader, rw, 0);
+	if (result) {
+		panic("rwunit: thread_fork failed\n");
+	}
+	kprintf("Sleeping for waiter to run\n");
+	clocksleep(1);
+}
+
+static
+unsigned
+getwaiters(void)
+{
+	unsigned ret;
+
+	spinlock_acquire(&waiters_lock);
+	ret = waiters_running;
+	spinlock_release(&waiters_lock);
+	return ret;
+}
+
+/* As in semunit.c; only meaningful under controlled conditions. */
+static
+bool
+spinlock_not_held(struct spinlock *splk)
+{
+	return splk->splk_holder == NULL;
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+/*
+ * 1. After a successful rwlock_create:
+ *     - rwlock_name compares equal to the passed-in name
+ *     - rwlock_name is not the same pointer as the passed-in name
+ *     - both wchans are not null
+ *     - rwlock_lock is not held and has no owner
+ *     - there are no readers, no writer and no waiting writers
+ */
+int
+rwu1(int nargs, char **args)
+{
+	struct rwlock *rw;
+	const char *name = NAMESTRING;
+
+	(void)nargs; (void)args;
+
+	rw = rwlock_create(name);
+	if (rw == NULL) {
+		panic("rwu1: whoops: rwlock_create failed\n");
+	}
+	KASSERT(!strcmp(rw->rwlock_name, name));
+	KASSERT(rw->rwlock_name != name);
+	KASSERT(rw->rwlock_rwchan != NULL);
+	KASSERT(rw->rwlock_wwchan != NULL);
+	KASSERT(spinlock_not_held(&rw->rwlock_lock));
+	KASSERT(rw->rwlock_readers == 0);
+	KASSERT(rw->rwlock_writer == NULL);
+	KASSERT(rw->rwlock_wwaiting == 0);
+
+	ok();
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 2. Passing a null name to rwlock_create asserts or crashes.
+ */
+int
+rwu2(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	kprintf("This should crash with a kernel null dereference\n");
+	rw = rwlock_create(NULL);
+	(void)rw;
+	panic("rwu2: rwlock_create accepted a null name\n");
+	return 0;
+}
+
+/*
+ * 3. Passing a null rwlock to rwlock_destroy asserts.
+ */
+int
+rwu3(int nargs, char **args)
+{
+	(void)nargs; (void)args;
+
+	kprintf("This should assert that the rwlock isn't null\n");
+	rwlock_destroy(NULL);
+	panic("rwu3: rwlock_destroy accepted a null rwlock\n");
+	return 0;
+}
+
+/*
+ * 4. Taking a read lock on a free rwlock, or one only readers hold,
+ * does not block, and counts the readers.
+ */
+int
+rwu4(int nargs, char **args)
+{
+	struct rwlock *rw;
+	struct spinlock lk;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+
+	/* As in semunit, check for blocking by holding a spinlock. */
+	spinlock_init(&lk);
+	spinlock_acquire(&lk);
+
+	rwlock_acquire_read(rw);
+	KASSERT(rw->rwlock_readers == 1);
+	rwlock_acquire_read(rw);
+	KASSERT(rw->rwlock_readers == 2);
+
+	spinlock_release(&lk);
+
+	ok();
+	rwlock_release_read(rw);
+	rwlock_release_read(rw);
+	KASSERT(rw->rwlock_readers == 0);
+	spinlock_cleanup(&lk);
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 5. Taking a write lock on a free rwlock does not block, and makes
+ * the current thread the writer.
+ */
+int
+rwu5(int nargs, char **args)
+{
+	struct rwlock *rw;
+	struct spinlock lk;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+
+	spinlock_init(&lk);
+	spinlock_acquire(&lk);
+	rwlock_acquire_write(rw);
+	spinlock_release(&lk);
+
+	KASSERT(rw->rwlock_writer == curthread);
+	KASSERT(rwlock_do_i_hold_write(rw));
+	KASSERT(rw->rwlock_readers == 0);
+
+	ok();
+	rwlock_release_write(rw);
+	KASSERT(rw->rwlock_writer == NULL);
+	KASSERT(!rwlock_do_i_hold_write(rw));
+	spinlock_cleanup(&lk);
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 6. Other threads can read while we read.
+ */
+int
+rwu6(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+	resetorder();
+
+	rwlock_acquire_read(rw);
+	makewaiter(rw, false);
+	KASSERT(getwaiters() == 0);
+
+	ok();
+	rwlock_release_read(rw);
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 7. A writer blocks readers until it releases the lock.
+ */
+int
+rwu7(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+	resetorder();
+
+	rwlock_acquire_write(rw);
+	makewaiter(rw, false);
+	makewaiter(rw, false);
+	KASSERT(getwaiters() == 2);
+
+	rwlock_release_write(rw);
+	clocksleep(1);
+	KASSERT(getwaiters() == 0);
+
+	ok();
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 8. A writer blocks other writers until it releases the lock.
+ */
+int
+rwu8(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+	resetorder();
+
+	rwlock_acquire_write(rw);
+	makewaiter(rw, true);
+	KASSERT(getwaiters() == 1);
+	KASSERT(rw->rwlock_wwaiting == 1);
+
+	rwlock_release_write(rw);
+	clocksleep(1);
+	KASSERT(getwaiters() == 0);
+	KASSERT(rw->rwlock_wwaiting == 0);
+
+	ok();
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 9. Readers block a writer until the last of them releases the lock.
+ */
+int
+rwu9(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+	resetorder();
+
+	rwlock_acquire_read(rw);
+	rwlock_acquire_read(rw);
+	makewaiter(rw, true);
+	KASSERT(getwaiters() == 1);
+
+	rwlock_release_read(rw);
+	clocksleep(1);
+	KASSERT(getwaiters() == 1);
+
+	rwlock_release_read(rw);
+	clocksleep(1);
+	KASSERT(getwaiters() == 0);
+
+	ok();
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 10. Writers have preference: once a writer is waiting, a new
+ * reader waits too, even though only readers hold the lock, and the
+ * writer gets in first.
+ */
+int
+rwu10(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+	resetorder();
+
+	rwlock_acquire_read(rw);
+	makewaiter(rw, true);
+	makewaiter(rw, false);
+	KASSERT(getwaiters() == 2);
+	KASSERT(rw->rwlock_readers == 1);
+
+	rwlock_release_read(rw);
+	clocksleep(1);
+	KASSERT(getwaiters() == 0);
+	KASSERT(!strcmp(order, "wr"));
+
+	ok();
+	rwlock_destroy(rw);
+	return 0;
+}
+
+/*
+ * 11. Releasing a write lock you don't hold asserts.
+ */
+int
+rwu11(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+	kprintf("This should assert that we hold the write lock\n");
+	rwlock_release_write(rw);
+	panic("rwu11: rwlock_release_write tolerated a non-holder\n");
+	return 0;
+}
+
+/*
+ * 12. Releasing a read lock nobody holds asserts.
+ */
+int
+rwu12(int nargs, char **args)
+{
+	struct rwlock *rw;
+
+	(void)nargs; (void)args;
+
+	rw = makerwlock();
+	kprintf("This should assert that there are readers\n");
+	rwlock_release_read(rw);
+	panic("rwu12: rwlock_release_read tolerated no readers\n");
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * swaptest - paging test and benchmark.
+ *
+ * Builds an address space bigger than memory (twice the size of the
+ * coremap unless told otherwise), writes a different pattern on every
+ * page, and then reads them all back twice, first in order and then
+ * in a stride that defeats the clock. Every page has to survive a
+ * trip to swap and back. Prints the time each pass took and how many
+ * page-ins and page-outs it cost.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <swap.h>
+#include <test.h>
+
+#define SWT_BASE	0x10000000
+#define SWT_STRIDE	7
+
+static
+void
+swaptest_report(const char *what, struct timespec *before, unsigned npages,
+		unsigned *pageins, unsigned *pageouts)
+{
+	struct timespec after, duration;
+	unsigned ins, outs;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	ins = vmstats_get(VMSTAT_PAGEINS);
+	outs = vmstats_get(VMSTAT_PAGEOUTS);
+
+	kprintf("    %-7s %u pages in %llu.%09lu seconds, "
+		"%u page-ins, %u page-outs\n",
+		what, npages, (unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec, ins - *pageins,
+		outs - *pageouts);
+
+	*before = after;
+	*pageins = ins;
+	*pageouts = outs;
+}
+
+/*
+ * Touch page I of AS. If WRITE, fill it with its pattern; otherwise
+ * check it has it.
+ */
+static
+int
+swaptest_page(struct addrspace *as, unsigned i, bool write)
+{
+	paddr_t pa;
+	bool writeable;
+	uint32_t *p;
+	unsigned j;
+	int result;
+
+	result = as_fault(as, SWT_BASE + i * PAGE_SIZE,
+			  write ? VM_FAULT_WRITE : VM_FAULT_READ,
+			  &pa, &writeable);
+	if (result) {
+		kprintf("swaptest: page %u: %s\n", i, strerror(result));
+		return result;
+	}
+	p = (uint32_t *)PADDR_TO_KVADDR(pa);
+	for (j=0; j<PAGE_SIZE / sizeof(uint32_t); j++) {
+		if (write) {
+			p[j] = (i * 0x9e3779b9) ^ j;
+		}
+		else if (p[j] != ((i * 0x9e3779b9) ^ j)) {
+			kprintf("swaptest: page %u has bad data\n", i);
+			coremap_unpin(pa);
+			return EINVAL;
+		}
+	}
+	coremap_unpin(pa);
+	return 0;
+}
+
+int
+swaptest(int nargs, char **args)
+{
+	struct coremapstats cs;
+	struct addrspace *as;
+	struct timespec t;
+	unsigned npages, maxpages, i, ins, outs;
+	int n, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: swt [npages]\n");
+		return EINVAL;
+	}
+	coremap_getstats(&cs);
+	npages = 2 * cs.cs_npages;
+	maxpages = (USERSPACETOP - SWT_BASE) / PAGE_SIZE;
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("Usage: swt [npages]\n");
+			return EINVAL;
+		}
+		if ((unsigned)n > maxpages) {
+			kprintf("swt: only %u pages fit above 0x%x\n",
+				maxpages, SWT_BASE);
+			return EINVAL;
+		}
+		npages = n;
+	}
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(as, SWT_BASE, npages * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+
+	kprintf("Starting swap test, %u pages (%u in memory):\n",
+		npages, cs.cs_npages);
+	ins = vmstats_get(VMSTAT_PAGEINS);
+	outs = vmstats_get(VMSTAT_PAGEOUTS);
+	gettime(&t);
+
+	for (i=0; i<npages && result == 0; i++) {
+		result = swaptest_page(as, i, true);
+	}
+	if (result == 0) {
+		swaptest_report("write", &t, npages, &ins, &outs);
+	}
+	for (i=0; i<npages && result == 0; i++) {
+		result = swaptest_page(as, i, false);
+	}
+	if (result == 0) {
+		swaptest_report("read", &t, npages, &ins, &outs);
+	}
+	for (i=0; i<npages && result == 0; i++) {
+		result = swaptest_page(as, (i * SWT_STRIDE) % npages, false);
+	}
+	if (result == 0) {
+		swaptest_report("stride", &t, npages, &ins, &outs);
+	}
+
+	as_destroy(as);
+	if (result) {
+		kprintf("Swap test failed.\n");
+		return result;
+	}
+	swap_printstats();
+	kprintf("Swap test done.\n");
+	return 0;
+}
@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -43,6 +44,16 @@
 #define NCVLOOPS      5
 #define NTHREADS      32
 
+#define LOCKBENCH_THREADS	8
+#define LOCKBENCH_LOOPS		20000
+
+#define CVBENCH_WAITERS		32
+#define CVBENCH_ROUNDS		20
+
+#define RWBENCH_THREADS		8
+#define RWBENCH_WRITEPCT	10
+#define RWBENCH_LOOPS		10000
+
 static volatile unsigned long testval1;
 static volatile unsigned long testval2;
 static volatile unsigned long testval3;
@@ -220,6 +231,84 @@ locktest(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Lock contention benchmark. For 1, 2, ... N threads, each thread
+ * takes testlock LOCKBENCH_LOOPS times around a short critical
+ * section, and we report total acquisitions per second. With as many
+ * threads as cpus (set "cpus" in sys161.conf) waiters mostly find the
+ * holder running and spin; beyond that they find it switched out and
+ * sleep.
+ */
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<LOCKBENCH_LOOPS; i++) {
+		lock_acquire(testlock);
+		testval1 = num;
+		testval2 += testval1;
+		lock_release(testlock);
+	}
+	V(donesem);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	struct timespec before, after, duration;
+	unsigned long long nsecs, acquisitions;
+	unsigned maxthreads, nthreads, i;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: sy2b [maxthreads]\n");
+		return EINVAL;
+	}
+	maxthreads = nargs == 2 ? (unsigned)atoi(args[1]) : LOCKBENCH_THREADS;
+	if (maxthreads == 0) {
+		kprintf("sy2b: need at least one thread\n");
+		return EINVAL;
+	}
+
+	inititems();
+	kprintf("Starting lock benchmark...\n");
+
+	for (nthreads=1; nthreads<=maxthreads; nthreads++) {
+		gettime(&before);
+		for (i=0; i<nthreads; i++) {
+			result = thread_fork("lockbench", NULL,
+					     lockbenchthread, NULL, i);
+			if (result) {
+				panic("lockbench: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<nthreads; i++) {
+			P(donesem);
+		}
+		gettime(&after);
+		timespec_sub(&after, &before, &duration);
+
+		nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+		if (nsecs == 0) {
+			nsecs = 1;
+		}
+		acquisitions = (unsigned long long)nthreads * LOCKBENCH_LOOPS;
+		kprintf("%2u threads: %llu acquisitions in %llu.%09lu "
+			"seconds, %llu/sec\n", nthreads, acquisitions,
+			(unsigned long long)duration.tv_sec,
+			(unsigned long)duration.tv_nsec,
+			acquisitions * 1000000000ULL / nsecs);
+	}
+
+	kprintf("Lock benchmark done.\n");
+
+	return 0;
+}
+
 static
 void
 cvtestthread(void *junk, unsigned long num)
@@ -297,6 +386,217 @@ cvtest(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Broadcast benchmark. N threads wait on testcv; each round we
+ * broadcast once and time how long it takes for all of them to get
+ * through the lock. testval1 is the round number the waiters are
+ * waiting to see change.
+ */
+static struct semaphore *cvbench_ready;
+
+static
+void
+cvbenchthread(void *junk, unsigned long rounds)
+{
+	unsigned long round;
+	(void)junk;
+
+	lock_acquire(testlock);
+	for (round=0; round<rounds; round++) {
+		V(cvbench_ready);
+		while (testval1 == round) {
+			cv_wait(testcv, testlock);
+		}
+		testval2++;
+		V(donesem);
+	}
+	lock_release(testlock);
+}
+
+int
+cvbench(int nargs, char **args)
+{
+	struct timespec before, after, duration, total;
+	unsigned long long nsecs;
+	unsigned nwaiters, i, round;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: sy3b [nwaiters]\n");
+		return EINVAL;
+	}
+	nwaiters = nargs == 2 ? (unsigned)atoi(args[1]) : CVBENCH_WAITERS;
+	if (nwaiters == 0) {
+		kprintf("sy3b: need at least one waiter\n");
+		return EINVAL;
+	}
+
+	inititems();
+	cvbench_ready = sem_create("cvbench", 0);
+	if (cvbench_ready == NULL) {
+		panic("cvbench: sem_create failed\n");
+	}
+	kprintf("Starting CV broadcast benchmark...\n");
+
+	testval1 = 0;
+	testval2 = 0;
+	for (i=0; i<nwaiters; i++) {
+		result = thread_fork("cvbench", NULL, cvbenchthread,
+				     NULL, CVBENCH_ROUNDS);
+		if (result) {
+			panic("cvbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	total.tv_sec = 0;
+	total.tv_nsec = 0;
+	for (round=0; round<CVBENCH_ROUNDS; round++) {
+		/*
+		 * Each waiter signals ready while holding the lock,
+		 * so once we get the lock they're all in cv_wait.
+		 */
+		for (i=0; i<nwaiters; i++) {
+			P(cvbench_ready);
+		}
+		lock_acquire(testlock);
+		gettime(&before);
+		testval1 = round + 1;
+		cv_broadcast(testcv, testlock);
+		lock_release(testlock);
+		for (i=0; i<nwaiters; i++) {
+			P(donesem);
+		}
+		gettime(&after);
+		timespec_sub(&after, &before, &duration);
+		timespec_add(&total, &duration, &total);
+	}
+
+	sem_destroy(cvbench_ready);
+	cvbench_ready = NULL;
+
+	if (testval2 != (unsigned long)nwaiters * CVBENCH_ROUNDS) {
+		kprintf("cvbench: %lu wakeups, expected %lu\n", testval2,
+			(unsigned long)nwaiters * CVBENCH_ROUNDS);
+		kprintf("Test failed\n");
+		return 0;
+	}
+
+	nsecs = total.tv_sec * 1000000000ULL + total.tv_nsec;
+	kprintf("%u waiters, %u broadcasts: %llu.%09lu seconds, "
+		"%llu ns per broadcast\n", nwaiters, CVBENCH_ROUNDS,
+		(unsigned long long)total.tv_sec,
+		(unsigned long)total.tv_nsec, nsecs / CVBENCH_ROUNDS);
+	kprintf("CV broadcast benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * rwlock throughput benchmark. Each thread does RWBENCH_LOOPS
+ * operations on a shared rwlock, WRITEPCT percent of them writes,
+ * spread evenly through the run. The read side walks a small array
+ * so that it holds the lock long enough for readers to overlap.
+ */
+#define RWBENCH_ITEMS	32
+
+static struct rwlock *rwbench_lock;
+static volatile unsigned rwbench_items[RWBENCH_ITEMS];
+static unsigned rwbench_writepct;
+
+static
+void
+rwbenchthread(void *junk, unsigned long num)
+{
+	unsigned i, j, sum;
+	(void)junk;
+
+	for (i=0; i<RWBENCH_LOOPS; i++) {
+		if ((i + num * 37) % 100 < rwbench_writepct) {
+			rwlock_acquire_write(rwbench_lock);
+			for (j=0; j<RWBENCH_ITEMS; j++) {
+				rwbench_items[j]++;
+			}
+			rwlock_release_write(rwbench_lock);
+		}
+		else {
+			rwlock_acquire_read(rwbench_lock);
+			sum = 0;
+			for (j=0; j<RWBENCH_ITEMS; j++) {
+				sum += rwbench_items[j];
+			}
+			/* every write bumps every item */
+			if (sum != rwbench_items[0] * RWBENCH_ITEMS) {
+				panic("rwbench: reader saw a partial write\n");
+			}
+			rwlock_release_read(rwbench_lock);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	struct timespec before, after, duration;
+	unsigned long long nsecs, ops;
+	unsigned nthreads, i;
+	int result;
+
+	if (nargs > 3) {
+		kprintf("Usage: rwb [nthreads [writepercent]]\n");
+		return EINVAL;
+	}
+	nthreads = nargs > 1 ? (unsigned)atoi(args[1]) : RWBENCH_THREADS;
+	rwbench_writepct = nargs > 2 ? (unsigned)atoi(args[2]) :
+		RWBENCH_WRITEPCT;
+	if (nthreads == 0 || rwbench_writepct > 100) {
+		kprintf("Usage: rwb [nthreads [writepercent]]\n");
+		return EINVAL;
+	}
+
+	inititems();
+	rwbench_lock = rwlock_create("rwbench");
+	if (rwbench_lock == NULL) {
+		panic("rwbench: rwlock_create failed\n");
+	}
+	for (i=0; i<RWBENCH_ITEMS; i++) {
+		rwbench_items[i] = 0;
+	}
+
+	kprintf("Starting rwlock benchmark...\n");
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("rwbench", NULL, rwbenchthread, NULL, i);
+		if (result) {
+			panic("rwbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	rwlock_destroy(rwbench_lock);
+	rwbench_lock = NULL;
+
+	nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+	if (nsecs == 0) {
+		nsecs = 1;
+	}
+	ops = (unsigned long long)nthreads * RWBENCH_LOOPS;
+	kprintf("%u threads, %u%% writes: %llu ops in %llu.%09lu seconds, "
+		"%llu/sec\n", nthreads, rwbench_writepct, ops,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec,
+		ops * 1000000000ULL / nsecs);
+	kprintf("rwlock benchmark done.\n");
+
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
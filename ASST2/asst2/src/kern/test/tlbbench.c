@@ -0,0 +1,193 @@
+/*
+ * tlbbench - TLB benchmark for processes that take turns.
+ *
+ * Two threads, each in a process of its own with its own address
+ * space, hand a semaphore back and forth; on each turn one touches
+ * every one of its NPAGES pages and passes the turn on. Every turn is
+ * a context switch to the other address space. If switching flushes
+ * the TLB, each turn faults on every page again; with address space
+ * IDs, if both working sets fit in the TLB, there shouldn't be any
+ * faults after the first round. Prints the time and the TLB faults
+ * per round.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <proc.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <vmstats.h>
+#include <test.h>
+
+#define TLBB_BASE	0x10000000
+#define TLBB_DEFAULT_PAGES	16
+#define TLBB_ROUNDS	2000
+/* Each process's pages run from TLBB_BASE to at most USERSPACETOP. */
+#define TLBB_MAXPAGES	((int)((USERSPACETOP - TLBB_BASE) / PAGE_SIZE))
+
+static struct semaphore *tlbbench_turn[2];
+static struct semaphore *tlbbench_done;
+static unsigned tlbbench_npages;
+
+static
+void
+tlbbench_thread(void *junk, unsigned long num)
+{
+	volatile uint32_t *p;
+	unsigned i, j;
+
+	(void)junk;
+
+	for (i=0; i<TLBB_ROUNDS; i++) {
+		P(tlbbench_turn[num]);
+		for (j=0; j<tlbbench_npages; j++) {
+			p = (volatile uint32_t *)(TLBB_BASE + j * PAGE_SIZE);
+			*p += 1;
+		}
+		V(tlbbench_turn[1 - num]);
+	}
+	V(tlbbench_done);
+}
+
+/*
+ * Make a process for one of the threads, with NPAGES of address
+ * space.
+ */
+static
+struct proc *
+tlbbench_proc(const char *name, unsigned npages)
+{
+	struct proc *proc;
+	struct addrspace *as;
+
+	proc = proc_create_runprogram(name);
+	if (proc == NULL) {
+		return NULL;
+	}
+	as = as_create();
+	if (as == NULL) {
+		proc_destroy(proc);
+		return NULL;
+	}
+	if (as_define_region(as, TLBB_BASE, npages * PAGE_SIZE, 1, 1, 0)) {
+		as_destroy(as);
+		proc_destroy(proc);
+		return NULL;
+	}
+	/* It isn't running yet, so there's no need for proc_setas. */
+	proc->p_addrspace = as;
+	return proc;
+}
+
+/*
+ * Wait for the thread in PROC to leave it, then destroy it.
+ */
+static
+void
+tlbbench_reap(struct proc *proc)
+{
+	unsigned n;
+
+	while (1) {
+		spinlock_acquire(&proc->p_lock);
+		n = proc->p_numthreads;
+		spinlock_release(&proc->p_lock);
+		if (n == 0) {
+			break;
+		}
+		thread_yield();
+	}
+	proc_destroy(proc);
+}
+
+int
+tlbbench(int nargs, char **args)
+{
+	struct proc *procs[2];
+	struct timespec before, after, duration;
+	char name[16];
+	unsigned faults, quick, i;
+	uint64_t usecs;
+	int n, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: tlbb [npages]\n");
+		return EINVAL;
+	}
+	tlbbench_npages = TLBB_DEFAULT_PAGES;
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n < 1 || n > TLBB_MAXPAGES) {
+			kprintf("tlbb: npages must be from 1 to %d\n",
+				TLBB_MAXPAGES);
+			return EINVAL;
+		}
+		tlbbench_npages = n;
+	}
+
+	for (i=0; i<2; i++) {
+		snprintf(name, sizeof(name), "tlbbench%u", i);
+		procs[i] = tlbbench_proc(name, tlbbench_npages);
+		if (procs[i] == NULL) {
+			if (i > 0) {
+				proc_destroy(procs[0]);
+			}
+			return ENOMEM;
+		}
+	}
+	tlbbench_turn[0] = sem_create("tlbbench0", 0);
+	tlbbench_turn[1] = sem_create("tlbbench1", 0);
+	tlbbench_done = sem_create("tlbbench", 0);
+	if (tlbbench_turn[0] == NULL || tlbbench_turn[1] == NULL ||
+	    tlbbench_done == NULL) {
+		panic("tlbbench: sem_create failed\n");
+	}
+
+	kprintf("Starting TLB benchmark, 2 processes, %u pages each:\n",
+		tlbbench_npages);
+	faults = vmstats_get(VMSTAT_FAULTS);
+	quick = vmstats_get(VMSTAT_QUICKFAULTS);
+	gettime(&before);
+
+	for (i=0; i<2; i++) {
+		snprintf(name, sizeof(name), "tlbbench%u", i);
+		result = thread_fork(name, procs[i], tlbbench_thread, NULL, i);
+		if (result) {
+			panic("tlbbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	V(tlbbench_turn[0]);
+	P(tlbbench_done);
+	P(tlbbench_done);
+
+	gettime(&after);
+	faults = vmstats_get(VMSTAT_FAULTS) - faults;
+	quick = vmstats_get(VMSTAT_QUICKFAULTS) - quick;
+	timespec_sub(&after, &before, &duration);
+
+	for (i=0; i<2; i++) {
+		tlbbench_reap(procs[i]);
+	}
+	sem_destroy(tlbbench_turn[0]);
+	sem_destroy(tlbbench_turn[1]);
+	sem_destroy(tlbbench_done);
+
+	usecs = (uint64_t)duration.tv_sec * 1000000 + duration.tv_nsec / 1000;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	kprintf("    %u rounds in %llu.%09lu seconds\n", TLBB_ROUNDS,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec);
+	kprintf("    %u TLB faults (%u per round, %u/sec), "
+		"%u from the page table\n", faults, faults / TLBB_ROUNDS,
+		(unsigned)(faults * 1000000ULL / usecs), quick);
+	kprintf("TLB benchmark done.\n");
+	return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * vnodebench - vnode table benchmark.
+ *
+ * Creates a batch of files in the root of a mounted filesystem and
+ * times opening them by name two ways: once with only the file being
+ * opened in memory, and once with every file in the batch held open,
+ * so each lookup has to find its vnode among all the others. With a
+ * linear vnode table the second phase gets slower as the batch grows;
+ * with the hash table the two should cost about the same per open.
+ * The name cache is turned off while it runs, since it would answer
+ * the lookups without consulting the vnode table at all.
+ *
+ * SFS has no subdirectories, so the files all go in the root
+ * directory.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <dcache.h>
+#include <test.h>
+
+#define VNB_DEFAULT_FILES	1000
+
+static
+void
+vnodebench_makename(char *buf, size_t buflen, const char *fs, unsigned n)
+{
+	snprintf(buf, buflen, "%s:vnb-%u", fs, n);
+	KASSERT(strlen(buf) < buflen);
+}
+
+static
+void
+vnodebench_report(const char *what, struct timespec *before, unsigned ops)
+{
+	struct timespec after, duration;
+	uint64_t nsecs;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	nsecs = (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+
+	kprintf("    %-10s %llu.%09lu seconds, %llu ns per open\n", what,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec,
+		(unsigned long long)(nsecs / ops));
+
+	*before = after;
+}
+
+/*
+ * Open file N read-only and hand back its vnode.
+ */
+static
+int
+vnodebench_open(const char *fs, unsigned n, int flags, struct vnode **ret)
+{
+	char name[64], path[64];
+	int result;
+
+	vnodebench_makename(name, sizeof(name), fs, n);
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(path, name);
+	result = vfs_open(path, flags, 0664, ret);
+	if (result) {
+		kprintf("vnodebench: %s: %s\n", name, strerror(result));
+	}
+	return result;
+}
+
+int
+vnodebench(int nargs, char **args)
+{
+	struct vnode **held, *vn;
+	struct timespec t;
+	char path[64];
+	unsigned nfiles, ncreated, i, dcmax;
+	int result = 0;
+
+	if (nargs < 2 || nargs > 3) {
+		kprintf("Usage: vnb filesystem [nfiles]\n");
+		return EINVAL;
+	}
+	nfiles = VNB_DEFAULT_FILES;
+	if (nargs == 3) {
+		nfiles = atoi(args[2]);
+		if (nfiles == 0) {
+			kprintf("Usage: vnb filesystem [nfiles]\n");
+			return EINVAL;
+		}
+	}
+
+	held = kmalloc(nfiles * sizeof(struct vnode *));
+	if (held == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("Starting vnode table benchmark on %s, %u files:\n",
+		args[1], nfiles);
+	dcmax = dcache_getmax();
+	dcache_setmax(0);
+
+	/* Create the files, keeping every one of them open. */
+	gettime(&t);
+	for (ncreated = 0; ncreated < nfiles; ncreated++) {
+		result = vnodebench_open(args[1], ncreated,
+					 O_WRONLY|O_CREAT|O_EXCL,
+					 &held[ncreated]);
+		if (result) {
+			goto out;
+		}
+	}
+	vnodebench_report("create", &t, nfiles);
+
+	/* Reopen each one while all of them are loaded. */
+	for (i=0; i<nfiles; i++) {
+		result = vnodebench_open(args[1], i, O_RDONLY, &vn);
+		if (result) {
+			goto out;
+		}
+		KASSERT(vn == held[i]);
+		vfs_close(vn);
+	}
+	vnodebench_report("open/full", &t, nfiles);
+
+	/* Drop them all, then reopen each one on its own. */
+	for (i=0; i<nfiles; i++) {
+		vfs_close(held[i]);
+	}
+	ncreated = 0;
+	gettime(&t);
+	for (i=0; i<nfiles; i++) {
+		result = vnodebench_open(args[1], i, O_RDONLY, &vn);
+		if (result) {
+			break;
+		}
+		vfs_close(vn);
+	}
+	vnodebench_report("open/empty", &t, i > 0 ? i : 1);
+
+ out:
+	for (i=0; i<ncreated; i++) {
+		vfs_close(held[i]);
+	}
+	kfree(held);
+	dcache_setmax(dcmax);
+
+	for (i=0; i<nfiles; i++) {
+		vnodebench_makename(path, sizeof(path), args[1], i);
+		if (vfs_remove(path)) {
+			break;
+		}
+	}
+
+	if (result) {
+		kprintf("Vnode table benchmark failed.\n");
+		return result;
+	}
+	kprintf("Vnode table benchmark done.\n");
+	return 0;
+}
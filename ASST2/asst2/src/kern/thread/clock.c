@@ -34,6 +34,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <buf.h>
 
 /*
  * Time handling.
@@ -79,10 +80,13 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
+	/* Broadcast on lbolt */
 	spinlock_acquire(&lbolt_lock);
 	wchan_wakeall(lbolt, &lbolt_lock);
 	spinlock_release(&lbolt_lock);
+
+	/* and kick the buffer cache syncer when it's due. */
+	buf_timerclock();
 }
 
 /*
@@ -103,7 +107,9 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	if (thread_quantum_tick()) {
+		thread_yield();
+	}
 }
 
 /*
@@ -180,3 +180,31 @@ hangman_release(struct hangman_actor *a,
 
 	spinlock_release(&hangman_lock);
 }
+
+/*
+ * Note that a has stopped waiting for l without becoming its holder.
+ * This is for shared (reader) acquisitions: there can be many readers
+ * at once and a lockable only has room for one holder, so we track
+ * readers only while they wait for a writer to get out.
+ */
+void
+hangman_stopwait(struct hangman_actor *a,
+		 struct hangman_lockable *l)
+{
+	if (l == &hangman_lock.splk_hangman) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&hangman_lock);
+
+	if (a->a_waiting != l) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_stopwait: not waiting for lock %s (%p)\n",
+		      l->l_name, l);
+	}
+
+	a->a_waiting = NULL;
+
+	spinlock_release(&hangman_lock);
+}
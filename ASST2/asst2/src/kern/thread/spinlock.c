@@ -121,6 +121,47 @@ spinlock_acquire(struct spinlock *splk)
 	}
 }
 
+/*
+ * Try to get the lock without spinning.
+ *
+ * A failed attempt never waits, so it can't be part of a deadlock and
+ * hangman never hears of it. Hangman does expect every acquire to
+ * follow a wait, so a successful one reports both.
+ */
+bool
+spinlock_tryacquire(struct spinlock *splk)
+{
+	struct cpu *mycpu;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (splk->splk_holder == mycpu) {
+			panic("Deadlock on spinlock %p\n", splk);
+		}
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	if (spinlock_data_get(&splk->splk_lock) != 0 ||
+	    spinlock_data_testandset(&splk->splk_lock) != 0) {
+		spllower(IPL_HIGH, IPL_NONE);
+		return false;
+	}
+
+	membar_store_any();
+	splk->splk_holder = mycpu;
+
+	if (CURCPU_EXISTS()) {
+		mycpu->c_spinlocks++;
+		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
+	}
+	return true;
+}
+
 /*
  * Release the lock.
  */
@@ -38,14 +38,25 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <synch.h>
 
+/*
+ * How many times lock_acquire polls a lock whose holder is running
+ * on another cpu before giving up and sleeping. Critical sections
+ * guarded by sleep locks are short compared to a context switch, so
+ * a holder that is still running after this long is probably doing
+ * I/O-bound work under the lock and we're better off asleep.
+ */
+#define LOCK_SPIN_LIMIT	1000
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static
 struct semaphore *
-sem_create(const char *name, unsigned initial_count)
+sem_create_common(const char *name, unsigned initial_count, bool fifo)
 {
         struct semaphore *sem;
 
@@ -69,10 +80,26 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+	sem->sem_fifo = fifo;
+	sem->sem_nsleeps = 0;
+	sem->sem_nwakeups = 0;
+	sem->sem_nrechecks = 0;
 
         return sem;
 }
 
+struct semaphore *
+sem_create(const char *name, unsigned initial_count)
+{
+	return sem_create_common(name, initial_count, false);
+}
+
+struct semaphore *
+sem_create_fifo(const char *name, unsigned initial_count)
+{
+	return sem_create_common(name, initial_count, true);
+}
+
 void
 sem_destroy(struct semaphore *sem)
 {
@@ -100,6 +127,25 @@ P(struct semaphore *sem)
 
 	/* Use the semaphore spinlock to protect the wchan as well. */
 	spinlock_acquire(&sem->sem_lock);
+
+	if (sem->sem_fifo) {
+		/*
+		 * The count is only nonzero when nobody is waiting,
+		 * so taking it can't jump the queue. Otherwise wait
+		 * our turn; V wakes us instead of raising the count,
+		 * so when we wake up the unit is already ours.
+		 */
+		if (sem->sem_count > 0) {
+			sem->sem_count--;
+		}
+		else {
+			sem->sem_nsleeps++;
+			wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+		}
+		spinlock_release(&sem->sem_lock);
+		return;
+	}
+
         while (sem->sem_count == 0) {
 		/*
 		 *
@@ -111,9 +157,13 @@ P(struct semaphore *sem)
 		 * strict ordering. Too bad. :-)
 		 *
 		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * ordering? (Answer: sem_create_fifo.)
 		 */
+		sem->sem_nsleeps++;
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+		if (sem->sem_count == 0) {
+			sem->sem_nrechecks++;
+		}
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
@@ -127,13 +177,41 @@ V(struct semaphore *sem)
 
 	spinlock_acquire(&sem->sem_lock);
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	if (wchan_isempty(sem->sem_wchan, &sem->sem_lock)) {
+		sem->sem_count++;
+		KASSERT(sem->sem_count > 0);
+	}
+	else {
+		if (!sem->sem_fifo) {
+			sem->sem_count++;
+			KASSERT(sem->sem_count > 0);
+		}
+		/* else pass it straight to the first waiter */
+		sem->sem_nwakeups++;
+		wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	}
 
 	spinlock_release(&sem->sem_lock);
 }
 
+void
+sem_printstats(struct semaphore *sem)
+{
+	unsigned nsleeps, nwakeups, nrechecks;
+
+        KASSERT(sem != NULL);
+
+	spinlock_acquire(&sem->sem_lock);
+	nsleeps = sem->sem_nsleeps;
+	nwakeups = sem->sem_nwakeups;
+	nrechecks = sem->sem_nrechecks;
+	spinlock_release(&sem->sem_lock);
+
+	kprintf("%s (%s): %u sleeps, %u wakeups, %u failed rechecks\n",
+		sem->sem_name, sem->sem_fifo ? "fifo" : "plain",
+		nsleeps, nwakeups, nrechecks);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
@@ -156,7 +234,16 @@ lock_create(const char *name)
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
-        // add stuff here as needed
+	lock->lk_wchan = wchan_create(lock->lk_name);
+	if (lock->lk_wchan == NULL) {
+		kfree(lock->lk_name);
+		kfree(lock);
+		return NULL;
+	}
+
+	spinlock_init(&lock->lk_lock);
+	lock->lk_holder = NULL;
+	lock->lk_holdercpu = NULL;
 
         return lock;
 }
@@ -165,46 +252,138 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+	KASSERT(lock->lk_holder == NULL);
 
-        // add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
         kfree(lock);
 }
 
+/*
+ * Read C's current thread without any locking. The pointer is only
+ * ever compared, so a stale value is harmless.
+ */
+static
+struct thread *
+lock_cpu_curthread(struct cpu *c)
+{
+	return *(struct thread *volatile *)&c->c_curthread;
+}
+
+/*
+ * Check if the holder of LOCK is on a cpu right now. Call with the
+ * lock's spinlock held; the answer can of course be stale as soon as
+ * it is released.
+ *
+ * We only compare the holder pointer against the cpu's current
+ * thread, so this is safe even if the holder has since released the
+ * lock and exited.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	struct cpu *c;
+
+	c = lock->lk_holdercpu;
+	if (c == NULL || c == curcpu->c_self) {
+		/* If it ran on this cpu, it isn't running: we are. */
+		return false;
+	}
+	return lock_cpu_curthread(c) == lock->lk_holder;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	struct thread *holder;
+	struct cpu *holdercpu;
+	unsigned spins;
+
+	KASSERT(lock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(lock->lk_holder != curthread);
+
+	spinlock_acquire(&lock->lk_lock);
+
 	/* Call this (atomically) before waiting for a lock */
-	//HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+
+	while (lock->lk_holder != NULL) {
+		if (!lock_holder_running(lock)) {
+			wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+			continue;
+		}
 
-        // Write this
+		/*
+		 * The holder is running elsewhere. Poll the lock word
+		 * without the spinlock, so as not to slow the holder
+		 * down on its way out, and with interrupts on. Stop as
+		 * soon as it changes hands or the holder is switched
+		 * out, then recheck properly.
+		 */
+		holder = lock->lk_holder;
+		holdercpu = lock->lk_holdercpu;
+		spinlock_release(&lock->lk_lock);
+		for (spins = 0; spins < LOCK_SPIN_LIMIT; spins++) {
+			if (lock->lk_holder != holder ||
+			    lock_cpu_curthread(holdercpu) != holder) {
+				break;
+			}
+		}
+		spinlock_acquire(&lock->lk_lock);
+
+		if (spins == LOCK_SPIN_LIMIT && lock->lk_holder == holder) {
+			/* Spun long enough; sleep. */
+			wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+		}
+	}
 
-        (void)lock;  // suppress warning until code gets written
+	lock->lk_holder = curthread;
+	lock->lk_holdercpu = curcpu->c_self;
 
 	/* Call this (atomically) once the lock is acquired */
-	//HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+
+	spinlock_release(&lock->lk_lock);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	KASSERT(lock != NULL);
+	KASSERT(lock->lk_holder == curthread);
+
+	spinlock_acquire(&lock->lk_lock);
+
 	/* Call this (atomically) when the lock is released */
-	//HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+
+	lock->lk_holder = NULL;
+	lock->lk_holdercpu = NULL;
 
-        // Write this
+	/*
+	 * Wake one sleeper; anyone spinning will see lk_holder change
+	 * by itself. The sleeper may still lose the race to a spinner
+	 * or a newcomer, in which case it goes back to sleep.
+	 */
+	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 
-        (void)lock;  // suppress warning until code gets written
+	spinlock_release(&lock->lk_lock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-        // Write this
+	KASSERT(lock != NULL);
 
-        (void)lock;  // suppress warning until code gets written
-
-        return true; // dummy until code gets written
+	/*
+	 * No need for the spinlock: only we can make lk_holder equal
+	 * to curthread, or change it once it is.
+	 */
+	return lock->lk_holder == curthread;
 }
 
 ////////////////////////////////////////////////////////////
@@ -228,7 +407,14 @@ cv_create(const char *name)
                 return NULL;
         }
 
-        // add stuff here as needed
+	cv->cv_wchan = wchan_create(cv->cv_name);
+	if (cv->cv_wchan == NULL) {
+		kfree(cv->cv_name);
+		kfree(cv);
+		return NULL;
+	}
+
+	spinlock_init(&cv->cv_lock);
 
         return cv;
 }
@@ -238,32 +424,225 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&cv->cv_lock);
+	wchan_destroy(cv->cv_wchan);
         kfree(cv->cv_name);
         kfree(cv);
 }
 
+/*
+ * Lock ordering: the cv's spinlock comes before the lock's spinlock.
+ */
+
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-        // Write this
-        (void)cv;    // suppress warning until code gets written
-        (void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	/*
+	 * Get on the cv before letting go of the lock, so a signal
+	 * sent as soon as the lock is free can't be missed.
+	 */
+	spinlock_acquire(&cv->cv_lock);
+	lock_release(lock);
+	wchan_sleep(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
+
+	/*
+	 * We may have been morphed onto the lock's wait channel and
+	 * woken by lock_release, but that isn't a handoff: take the
+	 * lock the ordinary way.
+	 */
+	lock_acquire(lock);
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-        // Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_lock);
+	spinlock_acquire(&lock->lk_lock);
+	wchan_moveone(cv->cv_wchan, &cv->cv_lock,
+		      lock->lk_wchan, &lock->lk_lock);
+	spinlock_release(&lock->lk_lock);
+	spinlock_release(&cv->cv_lock);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_lock);
+	spinlock_acquire(&lock->lk_lock);
+	wchan_moveall(cv->cv_wchan, &cv->cv_lock,
+		      lock->lk_wchan, &lock->lk_lock);
+	spinlock_release(&lock->lk_lock);
+	spinlock_release(&cv->cv_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rwlock;
+
+        rwlock = kmalloc(sizeof(*rwlock));
+        if (rwlock == NULL) {
+                return NULL;
+        }
+
+        rwlock->rwlock_name = kstrdup(name);
+        if (rwlock->rwlock_name == NULL) {
+                kfree(rwlock);
+                return NULL;
+        }
+
+	HANGMAN_LOCKABLEINIT(&rwlock->rwlock_hangman, rwlock->rwlock_name);
+
+	rwlock->rwlock_rwchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_rwchan == NULL) {
+		kfree(rwlock->rwlock_name);
+		kfree(rwlock);
+		return NULL;
+	}
+
+	rwlock->rwlock_wwchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_wwchan == NULL) {
+		wchan_destroy(rwlock->rwlock_rwchan);
+		kfree(rwlock->rwlock_name);
+		kfree(rwlock);
+		return NULL;
+	}
+
+	spinlock_init(&rwlock->rwlock_lock);
+	rwlock->rwlock_readers = 0;
+	rwlock->rwlock_wwaiting = 0;
+	rwlock->rwlock_writer = NULL;
+
+        return rwlock;
+}
+
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+	KASSERT(rwlock->rwlock_readers == 0);
+	KASSERT(rwlock->rwlock_writer == NULL);
+	KASSERT(rwlock->rwlock_wwaiting == 0);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rwlock->rwlock_lock);
+	wchan_destroy(rwlock->rwlock_wwchan);
+	wchan_destroy(rwlock->rwlock_rwchan);
+        kfree(rwlock->rwlock_name);
+        kfree(rwlock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rwlock->rwlock_writer != curthread);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	if (rwlock->rwlock_writer != NULL || rwlock->rwlock_wwaiting > 0) {
+		HANGMAN_WAIT(&curthread->t_hangman, &rwlock->rwlock_hangman);
+		while (rwlock->rwlock_writer != NULL ||
+		       rwlock->rwlock_wwaiting > 0) {
+			wchan_sleep(rwlock->rwlock_rwchan,
+				    &rwlock->rwlock_lock);
+		}
+		HANGMAN_STOPWAIT(&curthread->t_hangman,
+				 &rwlock->rwlock_hangman);
+	}
+	rwlock->rwlock_readers++;
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	KASSERT(rwlock->rwlock_readers > 0);
+	rwlock->rwlock_readers--;
+	if (rwlock->rwlock_readers == 0 && rwlock->rwlock_wwaiting > 0) {
+		wchan_wakeone(rwlock->rwlock_wwchan, &rwlock->rwlock_lock);
+	}
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rwlock->rwlock_writer != curthread);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+
+	/* Call this (atomically) before waiting for a lock */
+	HANGMAN_WAIT(&curthread->t_hangman, &rwlock->rwlock_hangman);
+
+	rwlock->rwlock_wwaiting++;
+	while (rwlock->rwlock_writer != NULL || rwlock->rwlock_readers > 0) {
+		wchan_sleep(rwlock->rwlock_wwchan, &rwlock->rwlock_lock);
+	}
+	rwlock->rwlock_wwaiting--;
+	rwlock->rwlock_writer = curthread;
+
+	/* Call this (atomically) once the lock is acquired */
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rwlock->rwlock_hangman);
+
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+	KASSERT(rwlock->rwlock_writer == curthread);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+
+	/* Call this (atomically) when the lock is released */
+	HANGMAN_RELEASE(&curthread->t_hangman, &rwlock->rwlock_hangman);
+
+	rwlock->rwlock_writer = NULL;
+
+	/*
+	 * Writers first. Readers only get in once no writer is
+	 * waiting, and then all of them at once.
+	 */
+	if (rwlock->rwlock_wwaiting > 0) {
+		wchan_wakeone(rwlock->rwlock_wwchan, &rwlock->rwlock_lock);
+	}
+	else {
+		wchan_wakeall(rwlock->rwlock_rwchan, &rwlock->rwlock_lock);
+	}
+
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+
+	/* As with lock_do_i_hold, no need for the spinlock. */
+	return rwlock->rwlock_writer == curthread;
 }
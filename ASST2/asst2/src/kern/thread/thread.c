@@ -50,11 +50,18 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/* Move every thread back to the top MLFQ level this often. */
+#define MLFQ_BOOST_HARDCLOCKS	HZ
+
+/* Default cache affinity window; see thread_set_affinity_window(). */
+#define AFFINITY_HARDCLOCKS	2
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -69,6 +76,12 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Cache affinity window, in hardclocks. */
+static unsigned affinity_window = AFFINITY_HARDCLOCKS;
+
+/* When the per-cpu migration counters were last zeroed. */
+static struct timespec cpustats_since;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -147,6 +160,12 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Scheduler fields */
+	thread->t_priority = 0;
+	thread->t_quantum_used = 0;
+	thread->t_lastcpu = NULL;
+	thread->t_lastran = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -179,10 +198,16 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_asid = 0;
+	c->c_asidnext = 1;
+	c->c_asidgen = 1;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_migrated_out = 0;
+	c->c_migrated_in = 0;
+	c->c_stolen = 0;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -440,6 +465,34 @@ thread_start_cpus(void)
 	}
 	sem_destroy(cpu_startup_sem);
 	cpu_startup_sem = NULL;
+
+	/* Migration statistics count from here. */
+	gettime(&cpustats_since);
+}
+
+/*
+ * Put a thread on a cpu's run queue, behind every thread of the same
+ * or higher priority and ahead of any lower priority ones. The run
+ * queue is thus always sorted by MLFQ level, and FIFO within a level.
+ * Search from the tail since the common case is appending.
+ *
+ * The run queue lock must be held.
+ */
+static
+void
+thread_runqueue_insert(struct cpu *c, struct thread *target)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL_REV(t, c->c_runqueue) {
+		if (t->t_priority <= target->t_priority) {
+			threadlist_insertafter(&c->c_runqueue, t, target);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, target);
 }
 
 /*
@@ -466,7 +519,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_insert(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -481,6 +534,129 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Number of threads waiting on C's run queue, read without taking the
+ * run queue lock. tl_count only changes under that lock, so this is a
+ * possibly-stale snapshot of a per-cpu counter, which is all that the
+ * load balancing decisions below need. Whoever acts on it takes the
+ * lock and rechecks.
+ */
+static
+unsigned
+cpu_load_hint(struct cpu *c)
+{
+	return *(volatile unsigned *)&c->c_runqueue.tl_count;
+}
+
+/*
+ * How long, in C's hardclocks, ready thread T has been off C. A thread
+ * that last ran somewhere else (or never ran) has nothing cached on C
+ * and counts as coldest of all.
+ */
+static
+unsigned
+thread_coldness(struct cpu *c, struct thread *t)
+{
+	if (t->t_lastcpu != c) {
+		return (unsigned)-1;
+	}
+	return c->c_hardclocks - t->t_lastran;
+}
+
+/*
+ * Pick the ready thread on C's run queue that has been off the cpu
+ * longest and is at least MINCOLD hardclocks cold, or NULL. Never
+ * picks C's curthread (see thread_consider_migration). Ties go to the
+ * thread nearer the tail. C's run queue must be locked.
+ */
+static
+struct thread *
+thread_pick_coldest(struct cpu *c, unsigned mincold)
+{
+	struct thread *t, *best;
+	unsigned cold, bestcold;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	best = NULL;
+	bestcold = 0;
+	THREADLIST_FORALL_REV(t, c->c_runqueue) {
+		if (t == c->c_curthread) {
+			continue;
+		}
+		cold = thread_coldness(c, t);
+		if (cold >= mincold && (best == NULL || cold > bestcold)) {
+			best = t;
+			bestcold = cold;
+		}
+	}
+	return best;
+}
+
+/*
+ * Work stealing. Called from thread_switch, with our own run queue
+ * locked and empty, before going idle. Pick the peer with the longest
+ * run queue and take the thread at its tail (the lowest priority, and
+ * the one that would otherwise wait longest).
+ *
+ * We already hold a run queue lock, so only trylock the victim's: if
+ * it is busy we just go idle and try again after the next interrupt.
+ * That also means two cpus stealing from each other can't deadlock.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, load, maxload;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	victim = NULL;
+	maxload = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		load = cpu_load_hint(c);
+		if (load > maxload) {
+			maxload = load;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	if (!spinlock_tryacquire(&victim->c_runqueue_lock)) {
+		return NULL;
+	}
+	/*
+	 * Prefer a thread whose cache on the victim has gone cold, but
+	 * since we'd otherwise sit idle, settle for a hot one. (The
+	 * victim's curthread can briefly be on its own run queue while
+	 * that cpu unidles; thread_pick_coldest never returns it.)
+	 */
+	t = thread_pick_coldest(victim, affinity_window);
+	if (t == NULL) {
+		t = thread_pick_coldest(victim, 0);
+	}
+	if (t != NULL) {
+		threadlist_remove(&victim->c_runqueue, t);
+		t->t_cpu = curcpu->c_self;
+		victim->c_migrated_out++;
+		curcpu->c_stolen++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	return t;
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -594,6 +770,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		return;
 	}
 
+	/* Remember where and when it last ran, for cache affinity. */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastran = curcpu->c_hardclocks;
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -642,6 +822,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	curcpu->c_isidle = true;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (next == NULL) {
+			/* Nothing of our own; see if a peer can spare one. */
+			next = thread_steal();
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
@@ -814,17 +998,84 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu's run queue is kept
+ * sorted by t_priority (see thread_runqueue_insert), so picking the
+ * head in thread_switch runs the highest-priority ready thread.
+ * Threads that keep burning whole quanta sink a level at a time
+ * (thread_quantum_tick); threads that sleep and get woken rise a
+ * level at a time (thread_wakeup_boost). Periodically everything is
+ * put back on the top level so CPU-bound threads can't starve.
  */
 
+/*
+ * Promote a thread that is being woken up. It is on no list, so
+ * the caller's wchan lock is sufficient protection.
+ */
+static
+void
+thread_wakeup_boost(struct thread *target)
+{
+	if (target->t_priority > 0) {
+		target->t_priority--;
+	}
+	target->t_quantum_used = 0;
+}
+
+bool
+thread_quantum_tick(void)
+{
+	struct thread *cur, *next;
+	bool preempt;
+
+	if (curcpu->c_isidle) {
+		/* Nothing to charge; thread_switch would ignore us anyway. */
+		return true;
+	}
+
+	cur = curthread;
+	preempt = false;
+	cur->t_quantum_used++;
+	if (cur->t_quantum_used >= MLFQ_QUANTUM(cur->t_priority)) {
+		if (cur->t_priority < MLFQ_LEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_quantum_used = 0;
+		preempt = true;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (!preempt && !threadlist_isempty(&curcpu->c_runqueue)) {
+		next = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		preempt = next->t_priority < cur->t_priority;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return preempt;
+}
+
+/*
+ * This is called periodically from hardclock(). The run queue is
+ * already in priority order; all we do here is the periodic boost.
+ * Setting every level to 0 leaves the queue sorted.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+
+	if ((curcpu->c_hardclocks % MLFQ_BOOST_HARDCLOCKS) != 0) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	THREADLIST_FORALL(t, curcpu->c_runqueue) {
+		t->t_priority = 0;
+		t->t_quantum_used = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	curthread->t_priority = 0;
+	curthread->t_quantum_used = 0;
 }
 
 /*
@@ -840,29 +1091,33 @@ schedule(void)
  * and the performance loss due to underutilization of some CPUs is
  * something that needs to be tuned and probably is workload-specific.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * System/161 does not (yet) model such cache effects, but real
+ * hardware does, so we leave alone any thread that ran here within the
+ * last affinity_window hardclocks, and among the rest send the ones
+ * that have been off the cpu longest, whose caches are coldest.
  */
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
+	unsigned my_count, total_count, one_share, to_send, sent;
 	unsigned i, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
 	struct thread *t;
 
+	/*
+	 * Idle cpus pull work for themselves (thread_steal), so this
+	 * is only the slow push path for evening out busy cpus. Use the
+	 * unlocked load hints rather than locking every run queue.
+	 */
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += cpu_load_hint(c);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = cpu_load_hint(c);
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -873,12 +1128,23 @@ thread_consider_migration(void)
 	to_send = my_count - one_share;
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (to_send > curcpu->c_runqueue.tl_count) {
+		/* The hint was stale. */
+		to_send = curcpu->c_runqueue.tl_count;
+	}
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+		t = thread_pick_coldest(curcpu, affinity_window);
+		if (t == NULL) {
+			/* Everything left is cache-hot; keep it. */
+			break;
+		}
+		threadlist_remove(&curcpu->c_runqueue, t);
+		threadlist_addtail(&victims, t);
 	}
+	to_send = i;
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	sent = 0;
 	for (i=0; i < numcpus && to_send > 0; i++) {
 		c = cpuarray_get(&allcpus, i);
 		if (c == curcpu->c_self) {
@@ -916,7 +1182,9 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			thread_runqueue_insert(c, t);
+			c->c_migrated_in++;
+			sent++;
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -937,18 +1205,84 @@ thread_consider_migration(void)
 	 * changed while we were working and we may end up with leftovers.
 	 * Don't panic; just put them back on our own run queue.
 	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	curcpu->c_migrated_out += sent;
+	while ((t = threadlist_remhead(&victims)) != NULL) {
+		thread_runqueue_insert(curcpu, t);
 	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 
 	KASSERT(threadlist_isempty(&victims));
 	threadlist_cleanup(&victims);
 }
 
+unsigned
+thread_get_affinity_window(void)
+{
+	return affinity_window;
+}
+
+void
+thread_set_affinity_window(unsigned hardclocks)
+{
+	affinity_window = hardclocks;
+}
+
+/*
+ * Print each cpu's migration counters, and the rate since they were
+ * last reset.
+ */
+void
+thread_printcpustats(void)
+{
+	struct timespec now, elapsed;
+	uint64_t msecs;
+	unsigned i, out, in, stolen;
+	struct cpu *c;
+
+	gettime(&now);
+	timespec_sub(&now, &cpustats_since, &elapsed);
+	msecs = (uint64_t)elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	kprintf("Affinity window: %u hardclocks\n", affinity_window);
+	kprintf("cpu  hardclocks  ready   out/s    in/s stolen/s"
+		"      out       in   stolen\n");
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		out = c->c_migrated_out;
+		in = c->c_migrated_in;
+		stolen = c->c_stolen;
+		spinlock_release(&c->c_runqueue_lock);
+		kprintf("%3u  %10u  %5u %7u %7u %8u %8u %8u %8u\n",
+			c->c_number, c->c_hardclocks, cpu_load_hint(c),
+			(unsigned)(out * 1000ULL / msecs),
+			(unsigned)(in * 1000ULL / msecs),
+			(unsigned)(stolen * 1000ULL / msecs),
+			out, in, stolen);
+	}
+}
+
+void
+thread_resetcpustats(void)
+{
+	unsigned i;
+	struct cpu *c;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		c->c_migrated_out = 0;
+		c->c_migrated_in = 0;
+		c->c_stolen = 0;
+		spinlock_release(&c->c_runqueue_lock);
+	}
+	gettime(&cpustats_since);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1029,6 +1363,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		/* Nobody was sleeping. */
 		return;
 	}
+	thread_wakeup_boost(target);
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1059,6 +1394,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * private list.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		thread_wakeup_boost(target);
 		threadlist_addtail(&list, target);
 	}
 
@@ -1074,6 +1410,46 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move one thread sleeping on FROM to the tail of TO, if there is
+ * one. The thread stays asleep.
+ */
+void
+wchan_moveone(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	target = threadlist_remhead(&from->wc_threads);
+	if (target == NULL) {
+		return;
+	}
+	target->t_wchan_name = to->wc_name;
+	threadlist_addtail(&to->wc_threads, target);
+}
+
+/*
+ * Move all threads sleeping on FROM to the tail of TO, keeping their
+ * order.
+ */
+void
+wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1160,14 +1536,34 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all CPUs.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n = 0;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
 void
 interprocessor_interrupt(void)
 {
+	struct tlbshootdown shootdown[TLBSHOOTDOWN_MAX];
 	uint32_t bits;
-	unsigned i;
+	unsigned i, numshootdown = 0;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
@@ -1197,16 +1593,22 @@ interprocessor_interrupt(void)
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * vm_tlbshootdown wakes up whoever asked, which takes
+		 * the wait channel and run queue locks, so call it
+		 * after releasing the ipi lock. Take the requests off
+		 * the queue first so new ones can come in meanwhile.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		numshootdown = curcpu->c_numshootdown;
+		for (i=0; i<numshootdown; i++) {
+			shootdown[i] = curcpu->c_shootdown[i];
 		}
 		curcpu->c_numshootdown = 0;
 	}
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	for (i=0; i<numshootdown; i++) {
+		vm_tlbshootdown(&shootdown[i]);
+	}
 }
@@ -0,0 +1,1160 @@
+/*
+ * Buffer cache.
+ *
+ * Each buffer holds one block. Buffers live in a hash table keyed by
+ * (device, block) for lookup and on an LRU list for replacement; the
+ * head of the list is the most recently used.
+ *
+ * buf_lock covers the table, the list, and every field of every
+ * buffer except the data. A thread that wants the data marks the
+ * buffer busy and then drops buf_lock, so device I/O happens without
+ * it; anyone else who wants the same block waits on buf_cv until the
+ * buffer is released. buf_lock is a leaf: callers may hold their own
+ * locks, and we never call out while holding it.
+ *
+ * In write-back mode buf_write only marks the buffer dirty. Dirty
+ * buffers go to disk when the syncer thread runs (every
+ * buf_syncsecs seconds, counted by timerclock, or sooner if too much
+ * of the cache is dirty), when they're about to be replaced, or when
+ * somebody calls buf_flush. Each write-out takes the run of dirty
+ * buffers with consecutive block numbers around the one we started
+ * from and sends it to the device as one request. A flush starts up
+ * to BUF_MAXBATCH such requests at once and lets the driver order
+ * them.
+ *
+ * buf_readahead queues blocks for the read-ahead thread, which reads
+ * runs of consecutive uncached blocks in one request each, so the
+ * caller doesn't wait for them.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <thread.h>
+#include <uio.h>
+#include <device.h>
+#include <buf.h>
+
+/* Number of hash chains. */
+#define BUF_HASHSIZE  127
+
+/* Most blocks written in one device request. */
+#define BUF_MAXCLUSTER  16
+
+/* Most write requests a flush has outstanding at once. */
+#define BUF_MAXBATCH  8
+
+/* Wake the syncer early once this percentage of the cache is dirty. */
+#define BUF_DIRTY_PERCENT  75
+
+/* Size of the read-ahead queue. Requests beyond this are dropped. */
+#define BUF_RAQUEUE  64
+
+struct buf {
+	struct device *b_dev;		/* device the block is on */
+	daddr_t b_block;		/* block number on the device */
+	bool b_valid;			/* b_data holds the block */
+	bool b_dirty;			/* b_data is newer than the disk */
+	bool b_busy;			/* somebody is using b_data */
+	bool b_prefetched;		/* read ahead and not read since */
+	unsigned b_pincount;		/* number of buf_pin calls */
+	struct buf *b_hashnext;		/* next on hash chain */
+	struct buf *b_lruprev;		/* more recently used */
+	struct buf *b_lrunext;		/* less recently used */
+	void *b_data;			/* BUF_BLOCKSIZE bytes */
+};
+
+/* A run of dirty buffers on its way to the disk. */
+struct buf_cluster {
+	struct devreq bc_req;
+	struct iovec bc_iov[BUF_MAXCLUSTER];
+	struct buf *bc_bufs[BUF_MAXCLUSTER];
+};
+
+static struct lock *buf_lock;
+static struct cv *buf_cv;
+static struct buf *buf_hash[BUF_HASHSIZE];
+static struct buf *buf_lruhead, *buf_lrutail;
+static unsigned buf_num;		/* buffers allocated */
+static unsigned buf_ndirty;		/* of those, how many dirty */
+static unsigned buf_max = BUF_DEFAULT_NBUFS;
+static bool buf_writeback = true;
+
+/* The counters are bumped outside buf_lock, so they get their own. */
+static struct spinlock buf_statslock = SPINLOCK_INITIALIZER;
+static struct bufstats buf_stats;
+
+#define BUF_COUNT(field, n) \
+	(spinlock_acquire(&buf_statslock), \
+	 buf_stats.field += (n), \
+	 spinlock_release(&buf_statslock))
+
+/*
+ * Syncer state. buf_synclock is a spinlock because timerclock runs
+ * in interrupt context.
+ */
+static struct spinlock buf_synclock = SPINLOCK_INITIALIZER;
+static struct wchan *buf_syncwchan;
+static bool buf_syncwanted;
+static unsigned buf_syncsecs = BUF_DEFAULT_SYNCSECS;
+static unsigned buf_syncticks;
+
+/*
+ * Read-ahead queue: a ring of blocks waiting for the read-ahead
+ * thread, under its own spinlock so queueing never sleeps.
+ */
+static struct spinlock buf_ralock = SPINLOCK_INITIALIZER;
+static struct wchan *buf_rawchan;
+static struct {
+	struct device *ra_dev;		/* NULL if cancelled */
+	daddr_t ra_block;
+} buf_raq[BUF_RAQUEUE];
+static unsigned buf_rahead, buf_racount;
+static struct device *buf_radev;	/* device being read ahead */
+
+////////////////////////////////////////////////////////////
+// buffer objects
+
+static
+struct buf *
+buf_create(void)
+{
+	struct buf *b;
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->b_data = kmalloc(BUF_BLOCKSIZE);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return NULL;
+	}
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_busy = false;
+	b->b_prefetched = false;
+	b->b_pincount = 0;
+	b->b_hashnext = NULL;
+	b->b_lruprev = b->b_lrunext = NULL;
+	buf_num++;
+	return b;
+}
+
+static
+void
+buf_destroy(struct buf *b)
+{
+	KASSERT(!b->b_busy);
+	KASSERT(!b->b_dirty);
+	KASSERT(b->b_pincount == 0);
+	KASSERT(buf_num > 0);
+	buf_num--;
+	kfree(b->b_data);
+	kfree(b);
+}
+
+////////////////////////////////////////////////////////////
+// hash table and LRU list
+
+static
+unsigned
+buf_hashfn(struct device *dev, daddr_t block)
+{
+	return (((uintptr_t)dev >> 4) + block) % BUF_HASHSIZE;
+}
+
+static
+struct buf *
+buf_find(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buf_hash[buf_hashfn(dev, block)]; b != NULL;
+	     b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buf_hash_insert(struct buf *b)
+{
+	unsigned h = buf_hashfn(b->b_dev, b->b_block);
+
+	b->b_hashnext = buf_hash[h];
+	buf_hash[h] = b;
+}
+
+static
+void
+buf_hash_remove(struct buf *b)
+{
+	struct buf **pp;
+
+	pp = &buf_hash[buf_hashfn(b->b_dev, b->b_block)];
+	while (*pp != b) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->b_hashnext;
+	}
+	*pp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+static
+void
+buf_lru_remove(struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(buf_lruhead == b);
+		buf_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(buf_lrutail == b);
+		buf_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+buf_lru_addhead(struct buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = buf_lruhead;
+	if (buf_lruhead != NULL) {
+		buf_lruhead->b_lruprev = b;
+	}
+	else {
+		buf_lrutail = b;
+	}
+	buf_lruhead = b;
+}
+
+////////////////////////////////////////////////////////////
+// syncer
+
+static
+void
+buf_syncer_wake(void)
+{
+	spinlock_acquire(&buf_synclock);
+	buf_syncwanted = true;
+	wchan_wakeone(buf_syncwchan, &buf_synclock);
+	spinlock_release(&buf_synclock);
+}
+
+/*
+ * Mark a busy buffer dirty or clean, keeping count.
+ */
+static
+void
+buf_setdirty(struct buf *b, bool dirty)
+{
+	bool wake = false;
+
+	KASSERT(b->b_busy);
+
+	lock_acquire(buf_lock);
+	if (dirty && !b->b_dirty) {
+		buf_ndirty++;
+		wake = buf_ndirty * 100 >= buf_max * BUF_DIRTY_PERCENT;
+	}
+	else if (!dirty && b->b_dirty) {
+		KASSERT(buf_ndirty > 0);
+		buf_ndirty--;
+	}
+	b->b_dirty = dirty;
+	lock_release(buf_lock);
+
+	if (wake) {
+		buf_syncer_wake();
+	}
+}
+
+////////////////////////////////////////////////////////////
+// writing back
+
+/*
+ * Collect a dirty buffer, and the dirty buffers on either side of
+ * it, into C and mark them busy. B must be dirty and not busy.
+ */
+static
+void
+buf_gathercluster(struct buf *b, struct buf_cluster *c)
+{
+	struct buf *nb;
+	daddr_t first;
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+	KASSERT(b->b_dirty && !b->b_busy);
+
+	/* Walk back to the start of the run... */
+	first = b->b_block;
+	n = 1;
+	while (first > 0 && n < BUF_MAXCLUSTER) {
+		nb = buf_find(b->b_dev, first - 1);
+		if (nb == NULL || !nb->b_dirty || nb->b_busy) {
+			break;
+		}
+		first--;
+		n++;
+	}
+
+	/* ...then collect forward from there. */
+	for (n = 0; n < BUF_MAXCLUSTER; n++) {
+		nb = buf_find(b->b_dev, first + n);
+		if (nb == NULL || !nb->b_dirty || nb->b_busy) {
+			break;
+		}
+		nb->b_busy = true;
+		c->bc_bufs[n] = nb;
+		c->bc_iov[n].iov_kbase = nb->b_data;
+		c->bc_iov[n].iov_len = BUF_BLOCKSIZE;
+	}
+	KASSERT(n > 0);
+	KASSERT(b->b_busy);
+	devreq_init(&c->bc_req, first, c->bc_iov, n, true);
+}
+
+/*
+ * Write out N gathered clusters, all at once, and wait for them.
+ * Drops and retakes buf_lock, so the caller has to look at the world
+ * again afterwards. Returns the first error.
+ */
+static
+int
+buf_writeclusters(struct buf_cluster *c, unsigned n)
+{
+	struct devbatch db;
+	struct devreq *req;
+	struct buf *b;
+	unsigned i, j;
+	int result = 0;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+	lock_release(buf_lock);
+
+	devbatch_init(&db);
+	for (i = 0; i < n; i++) {
+		b = c[i].bc_bufs[0];
+		KASSERT(b->b_dev->d_blocksize == BUF_BLOCKSIZE);
+		BUF_COUNT(bs_devwrites, 1);
+		BUF_COUNT(bs_writeblocks, c[i].bc_req.dr_iovcnt);
+		devbatch_submit(&db, b->b_dev, &c[i].bc_req);
+	}
+	devbatch_wait(&db);
+
+	lock_acquire(buf_lock);
+	for (i = 0; i < n; i++) {
+		req = &c[i].bc_req;
+		if (req->dr_result) {
+			kprintf("buf: blocks %u-%u: write error: %s\n",
+				req->dr_block,
+				req->dr_block + req->dr_iovcnt - 1,
+				strerror(req->dr_result));
+			if (result == 0) {
+				result = req->dr_result;
+			}
+		}
+		for (j = 0; j < req->dr_iovcnt; j++) {
+			b = c[i].bc_bufs[j];
+			if (req->dr_result == 0) {
+				KASSERT(buf_ndirty > 0);
+				buf_ndirty--;
+				b->b_dirty = false;
+			}
+			b->b_busy = false;
+		}
+	}
+	cv_broadcast(buf_cv, buf_lock);
+	return result;
+}
+
+/*
+ * Write a dirty buffer, and the dirty buffers on either side of it,
+ * in one device request. B must be dirty and not busy. Drops and
+ * retakes buf_lock, like buf_writeclusters.
+ */
+static
+int
+buf_writecluster(struct buf *b)
+{
+	struct buf_cluster c;
+
+	buf_gathercluster(b, &c);
+	return buf_writeclusters(&c, 1);
+}
+
+/*
+ * Write back every dirty buffer of DEV, or of every device if DEV is
+ * NULL, up to BUF_MAXBATCH clusters at a time.
+ */
+static
+int
+buf_flush_locked(struct device *dev)
+{
+	struct buf_cluster one, *batch;
+	struct buf *b;
+	unsigned max, n;
+	int result = 0;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+
+	batch = kmalloc(BUF_MAXBATCH * sizeof(*batch));
+	max = BUF_MAXBATCH;
+	if (batch == NULL) {
+		/* Do them one at a time, then */
+		batch = &one;
+		max = 1;
+	}
+
+ again:
+	n = 0;
+	for (b = buf_lrutail; b != NULL && n < max; b = b->b_lruprev) {
+		if (!b->b_dirty || b->b_busy ||
+		    (dev != NULL && b->b_dev != dev)) {
+			continue;
+		}
+		buf_gathercluster(b, &batch[n++]);
+	}
+	if (n > 0) {
+		result = buf_writeclusters(batch, n);
+		if (result) {
+			/* Give up on this pass rather than loop forever */
+			goto done;
+		}
+		goto again;
+	}
+
+	/* Whatever is left is busy; wait for it, it may be dirty after. */
+	for (b = buf_lrutail; b != NULL; b = b->b_lruprev) {
+		if (b->b_dirty && (dev == NULL || b->b_dev == dev)) {
+			KASSERT(b->b_busy);
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+	}
+
+ done:
+	if (batch != &one) {
+		kfree(batch);
+	}
+	return result;
+}
+
+static
+void
+buf_syncer(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		spinlock_acquire(&buf_synclock);
+		while (!buf_syncwanted) {
+			wchan_sleep(buf_syncwchan, &buf_synclock);
+		}
+		buf_syncwanted = false;
+		spinlock_release(&buf_synclock);
+
+		BUF_COUNT(bs_syncs, 1);
+		lock_acquire(buf_lock);
+		buf_flush_locked(NULL);
+		lock_release(buf_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// replacement
+
+/*
+ * Find the least recently used buffer that can be thrown out, and
+ * take it off the table and the list. Clean buffers go first. If
+ * only dirty ones are left, write the oldest back and return NULL
+ * with *RETRY set, since buf_lock was dropped in the meantime.
+ */
+static
+struct buf *
+buf_evict(bool *retry)
+{
+	struct buf *b, *dirty = NULL;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+	*retry = false;
+
+	for (b = buf_lrutail; b != NULL; b = b->b_lruprev) {
+		if (b->b_busy || b->b_pincount > 0) {
+			continue;
+		}
+		if (!b->b_dirty) {
+			break;
+		}
+		if (dirty == NULL) {
+			dirty = b;
+		}
+	}
+	if (b == NULL) {
+		if (dirty != NULL && buf_writecluster(dirty) == 0) {
+			*retry = true;
+		}
+		return NULL;
+	}
+
+	buf_hash_remove(b);
+	buf_lru_remove(b);
+	if (b->b_valid) {
+		BUF_COUNT(bs_evictions, 1);
+	}
+	b->b_valid = false;
+	return b;
+}
+
+/*
+ * Free buffers until we're back under the limit, or everything left
+ * is pinned or busy.
+ */
+static
+void
+buf_trim(void)
+{
+	struct buf *b;
+	bool retry;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+
+	while (buf_num > buf_max) {
+		b = buf_evict(&retry);
+		if (b == NULL) {
+			if (retry) {
+				continue;
+			}
+			break;
+		}
+		buf_destroy(b);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// getting and releasing buffers
+
+/*
+ * Set up a busy, not yet valid buffer for BLOCK on DEV, which must
+ * not be cached. Use a new buffer if we're under the limit, otherwise
+ * recycle the least recently used one; if none can be recycled and
+ * MAYGROW is set, go over the limit and let buf_release trim.
+ * Returns NULL with *RETRY
+ * set if buf_lock was dropped, in which case the caller must check
+ * again that the block isn't cached; NULL without it if we're out of
+ * memory.
+ */
+static
+struct buf *
+buf_newbuf(struct device *dev, daddr_t block, bool maygrow, bool *retry)
+{
+	struct buf *b = NULL;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+	*retry = false;
+
+	if (buf_num < buf_max) {
+		b = buf_create();
+	}
+	if (b == NULL) {
+		b = buf_evict(retry);
+		if (*retry) {
+			return NULL;
+		}
+	}
+	if (b == NULL && maygrow) {
+		b = buf_create();
+	}
+	if (b == NULL) {
+		return NULL;
+	}
+
+	b->b_dev = dev;
+	b->b_block = block;
+	b->b_valid = false;
+	b->b_prefetched = false;
+	b->b_busy = true;
+	buf_hash_insert(b);
+	buf_lru_addhead(b);
+	return b;
+}
+
+/*
+ * Get the buffer for BLOCK on DEV, marked busy. If the block wasn't
+ * cached, it comes back with b_valid false. If ISREAD, count the hit
+ * or miss. Returns NULL if we're out of memory.
+ */
+static
+struct buf *
+buf_get(struct device *dev, daddr_t block, bool isread)
+{
+	struct buf *b;
+	bool retry;
+
+	lock_acquire(buf_lock);
+ again:
+	b = buf_find(dev, block);
+	if (b != NULL) {
+		if (b->b_busy) {
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		b->b_busy = true;
+		buf_lru_remove(b);
+		buf_lru_addhead(b);
+		lock_release(buf_lock);
+		if (isread) {
+			if (b->b_valid) {
+				BUF_COUNT(bs_hits, 1);
+			}
+			else {
+				BUF_COUNT(bs_misses, 1);
+			}
+			if (b->b_prefetched) {
+				BUF_COUNT(bs_rahits, 1);
+			}
+		}
+		b->b_prefetched = false;
+		return b;
+	}
+
+	b = buf_newbuf(dev, block, true, &retry);
+	if (retry) {
+		/* Somebody may have loaded our block meanwhile */
+		goto again;
+	}
+	lock_release(buf_lock);
+	if (b == NULL) {
+		return NULL;
+	}
+
+	if (isread) {
+		BUF_COUNT(bs_misses, 1);
+	}
+	return b;
+}
+
+static
+void
+buf_release(struct buf *b)
+{
+	lock_acquire(buf_lock);
+	KASSERT(b->b_busy);
+	b->b_busy = false;
+	buf_trim();
+	cv_broadcast(buf_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+/*
+ * Transfer the whole of a busy buffer to or from the disk.
+ */
+static
+int
+buf_devio(struct buf *b, enum uio_rw rw)
+{
+	struct devbatch db;
+	struct devreq req;
+	struct iovec iov;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_dev->d_blocksize == BUF_BLOCKSIZE);
+
+	if (rw == UIO_READ) {
+		BUF_COUNT(bs_devreads, 1);
+	}
+	else {
+		BUF_COUNT(bs_devwrites, 1);
+		BUF_COUNT(bs_writeblocks, 1);
+	}
+
+	iov.iov_kbase = b->b_data;
+	iov.iov_len = BUF_BLOCKSIZE;
+	devreq_init(&req, b->b_block, &iov, 1, rw == UIO_WRITE);
+	devbatch_init(&db);
+	devbatch_submit(&db, b->b_dev, &req);
+	devbatch_wait(&db);
+	return req.dr_result;
+}
+
+/*
+ * Make sure a busy buffer holds the disk contents.
+ */
+static
+int
+buf_fill(struct buf *b)
+{
+	int result;
+
+	if (b->b_valid) {
+		return 0;
+	}
+	result = buf_devio(b, UIO_READ);
+	if (result) {
+		return result;
+	}
+	b->b_valid = true;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// read-ahead
+
+/*
+ * Read whichever of the COUNT blocks starting at FIRST on DEV aren't
+ * cached yet. Each run of consecutive uncached blocks is one device
+ * request; they're all started together. Never grows the cache past
+ * its limit: read-ahead is only a guess, so it isn't worth more than
+ * a recycled buffer.
+ */
+static
+void
+buf_prefetch(struct device *dev, daddr_t first, unsigned count)
+{
+	struct buf *bufs[BUF_MAXCLUSTER];
+	struct iovec iov[BUF_MAXCLUSTER];
+	struct devreq reqs[BUF_MAXCLUSTER];
+	struct devbatch db;
+	struct buf *b;
+	unsigned i, j, n, r, nreqs;
+	bool retry;
+
+	KASSERT(count <= BUF_MAXCLUSTER);
+	KASSERT(dev->d_blocksize == BUF_BLOCKSIZE);
+
+	lock_acquire(buf_lock);
+	n = 0;
+	while (count > 0 && buf_max > 0) {
+		if (buf_find(dev, first) != NULL) {
+			first++;
+			count--;
+			continue;
+		}
+		b = buf_newbuf(dev, first, false, &retry);
+		if (b == NULL) {
+			if (retry) {
+				/* We lost the lock; look again */
+				continue;
+			}
+			break;
+		}
+		bufs[n] = b;
+		iov[n].iov_kbase = b->b_data;
+		iov[n].iov_len = BUF_BLOCKSIZE;
+		n++;
+		first++;
+		count--;
+	}
+	lock_release(buf_lock);
+
+	if (n == 0) {
+		return;
+	}
+
+	/* Our buffers are busy, so their block numbers hold still. */
+	devbatch_init(&db);
+	nreqs = 0;
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n; j++) {
+			if (bufs[j]->b_block != bufs[j-1]->b_block + 1) {
+				break;
+			}
+		}
+		devreq_init(&reqs[nreqs], bufs[i]->b_block, &iov[i], j - i,
+			    false);
+		BUF_COUNT(bs_devreads, 1);
+		devbatch_submit(&db, dev, &reqs[nreqs]);
+		nreqs++;
+	}
+	BUF_COUNT(bs_rablocks, n);
+	devbatch_wait(&db);
+
+	lock_acquire(buf_lock);
+	i = 0;
+	for (r = 0; r < nreqs; r++) {
+		for (j = 0; j < reqs[r].dr_iovcnt; j++) {
+			b = bufs[i++];
+			/* On error leave it invalid; a real read will retry */
+			b->b_valid = (reqs[r].dr_result == 0);
+			b->b_prefetched = b->b_valid;
+			b->b_busy = false;
+		}
+	}
+	cv_broadcast(buf_cv, buf_lock);
+	buf_trim();
+	lock_release(buf_lock);
+}
+
+static
+void
+buf_readahead_thread(void *junk1, unsigned long junk2)
+{
+	struct device *dev;
+	daddr_t first;
+	unsigned n;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		spinlock_acquire(&buf_ralock);
+		buf_radev = NULL;
+		/* buf_invalidate may be waiting for us to finish */
+		wchan_wakeall(buf_rawchan, &buf_ralock);
+		while (buf_racount == 0) {
+			wchan_sleep(buf_rawchan, &buf_ralock);
+		}
+
+		/* Take the run of consecutive blocks at the front. */
+		dev = buf_raq[buf_rahead].ra_dev;
+		first = buf_raq[buf_rahead].ra_block;
+		n = 0;
+		do {
+			buf_rahead = (buf_rahead + 1) % BUF_RAQUEUE;
+			buf_racount--;
+			n++;
+		} while (buf_racount > 0 && n < BUF_MAXCLUSTER &&
+			 buf_raq[buf_rahead].ra_dev == dev &&
+			 buf_raq[buf_rahead].ra_block == first + n);
+		buf_radev = dev;
+		spinlock_release(&buf_ralock);
+
+		if (dev != NULL) {
+			buf_prefetch(dev, first, n);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+void
+buf_bootstrap(void)
+{
+	buf_lock = lock_create("buf");
+	if (buf_lock == NULL) {
+		panic("buf: Could not create buffer cache lock\n");
+	}
+	buf_cv = cv_create("buf");
+	if (buf_cv == NULL) {
+		panic("buf: Could not create buffer cache cv\n");
+	}
+	buf_syncwchan = wchan_create("bufsync");
+	if (buf_syncwchan == NULL) {
+		panic("buf: Could not create syncer wchan\n");
+	}
+	buf_rawchan = wchan_create("bufra");
+	if (buf_rawchan == NULL) {
+		panic("buf: Could not create read-ahead wchan\n");
+	}
+}
+
+void
+buf_start_threads(void)
+{
+	int result;
+
+	result = thread_fork("syncer", NULL, buf_syncer, NULL, 0);
+	if (result) {
+		panic("buf: Could not start syncer: %s\n", strerror(result));
+	}
+	result = thread_fork("readahead", NULL, buf_readahead_thread,
+			     NULL, 0);
+	if (result) {
+		panic("buf: Could not start read-ahead thread: %s\n",
+		      strerror(result));
+	}
+}
+
+/*
+ * Called once a second from timerclock, in interrupt context.
+ */
+void
+buf_timerclock(void)
+{
+	if (buf_syncsecs == 0 || !buf_writeback) {
+		return;
+	}
+	if (++buf_syncticks < buf_syncsecs) {
+		return;
+	}
+	buf_syncticks = 0;
+	buf_syncer_wake();
+}
+
+int
+buf_read(struct device *dev, daddr_t block, void *data, size_t len)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(len == BUF_BLOCKSIZE);
+
+	b = buf_get(dev, block, true);
+	if (b == NULL) {
+		return ENOMEM;
+	}
+	result = buf_fill(b);
+	if (result == 0) {
+		memcpy(data, b->b_data, len);
+	}
+	buf_release(b);
+	return result;
+}
+
+int
+buf_write(struct device *dev, daddr_t block, const void *data, size_t len)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(len == BUF_BLOCKSIZE);
+
+	b = buf_get(dev, block, false);
+	if (b == NULL) {
+		return ENOMEM;
+	}
+	memcpy(b->b_data, data, len);
+	b->b_valid = true;
+
+	if (buf_writeback) {
+		buf_setdirty(b, true);
+		buf_release(b);
+		return 0;
+	}
+
+	result = buf_devio(b, UIO_WRITE);
+	if (result) {
+		/* We don't know what's on disk now. */
+		b->b_valid = false;
+	}
+	buf_setdirty(b, false);
+	buf_release(b);
+	return result;
+}
+
+void
+buf_readahead(struct device *dev, daddr_t block)
+{
+	unsigned i;
+
+	if (buf_max == 0) {
+		return;
+	}
+
+	spinlock_acquire(&buf_ralock);
+	if (buf_racount < BUF_RAQUEUE) {
+		i = (buf_rahead + buf_racount) % BUF_RAQUEUE;
+		buf_raq[i].ra_dev = dev;
+		buf_raq[i].ra_block = block;
+		buf_racount++;
+		wchan_wakeall(buf_rawchan, &buf_ralock);
+	}
+	spinlock_release(&buf_ralock);
+}
+
+int
+buf_pin(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+	int result;
+
+	b = buf_get(dev, block, true);
+	if (b == NULL) {
+		return ENOMEM;
+	}
+	result = buf_fill(b);
+	if (result == 0) {
+		/* We have it busy, so nobody else is looking at this */
+		b->b_pincount++;
+	}
+	buf_release(b);
+	return result;
+}
+
+void
+buf_unpin(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buf_lock);
+	b = buf_find(dev, block);
+	KASSERT(b != NULL);
+	KASSERT(b->b_pincount > 0);
+	b->b_pincount--;
+	buf_trim();
+	lock_release(buf_lock);
+}
+
+int
+buf_flush(struct device *dev)
+{
+	int result;
+
+	lock_acquire(buf_lock);
+	result = buf_flush_locked(dev);
+	lock_release(buf_lock);
+	return result;
+}
+
+void
+buf_invalidate(struct device *dev)
+{
+	struct buf *b, *next;
+	unsigned i;
+
+	/* Cancel queued read-ahead and wait out any in progress. */
+	spinlock_acquire(&buf_ralock);
+	for (i = 0; i < buf_racount; i++) {
+		if (buf_raq[(buf_rahead + i) % BUF_RAQUEUE].ra_dev == dev) {
+			buf_raq[(buf_rahead + i) % BUF_RAQUEUE].ra_dev = NULL;
+		}
+	}
+	while (buf_radev == dev) {
+		wchan_sleep(buf_rawchan, &buf_ralock);
+	}
+	spinlock_release(&buf_ralock);
+
+	lock_acquire(buf_lock);
+ again:
+	for (b = buf_lruhead; b != NULL; b = next) {
+		next = b->b_lrunext;
+		if (b->b_dev != dev) {
+			continue;
+		}
+		if (b->b_busy) {
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		KASSERT(!b->b_dirty);
+		KASSERT(b->b_pincount == 0);
+		buf_hash_remove(b);
+		buf_lru_remove(b);
+		buf_destroy(b);
+	}
+	lock_release(buf_lock);
+}
+
+unsigned
+buf_getmax(void)
+{
+	return buf_max;
+}
+
+void
+buf_setmax(unsigned nbufs)
+{
+	lock_acquire(buf_lock);
+	buf_max = nbufs;
+	buf_trim();
+	lock_release(buf_lock);
+}
+
+bool
+buf_getwriteback(unsigned *syncsecs)
+{
+	if (syncsecs != NULL) {
+		*syncsecs = buf_syncsecs;
+	}
+	return buf_writeback;
+}
+
+void
+buf_setwriteback(bool writeback, unsigned syncsecs)
+{
+	lock_acquire(buf_lock);
+	buf_writeback = writeback;
+	buf_syncsecs = syncsecs;
+	buf_syncticks = 0;
+	if (!writeback) {
+		/* Going to write-through; nothing may stay dirty. */
+		buf_flush_locked(NULL);
+	}
+	lock_release(buf_lock);
+}
+
+void
+buf_getstats(struct bufstats *stats)
+{
+	struct buf *b;
+	unsigned npinned = 0;
+
+	lock_acquire(buf_lock);
+	for (b = buf_lruhead; b != NULL; b = b->b_lrunext) {
+		if (b->b_pincount > 0) {
+			npinned++;
+		}
+	}
+
+	spinlock_acquire(&buf_statslock);
+	*stats = buf_stats;
+	stats->bs_nbufs = buf_num;
+	stats->bs_npinned = npinned;
+	stats->bs_ndirty = buf_ndirty;
+	spinlock_release(&buf_statslock);
+
+	lock_release(buf_lock);
+}
+
+void
+buf_printstats(void)
+{
+	struct bufstats bs;
+	unsigned reads;
+
+	buf_getstats(&bs);
+	reads = bs.bs_hits + bs.bs_misses;
+
+	kprintf("Buffer cache: %u/%u buffers, %u pinned, %u dirty\n",
+		bs.bs_nbufs, buf_max, bs.bs_npinned, bs.bs_ndirty);
+	if (buf_writeback) {
+		kprintf("    write-back, syncer every %u seconds, "
+			"%u syncs\n", buf_syncsecs, bs.bs_syncs);
+	}
+	else {
+		kprintf("    write-through\n");
+	}
+	kprintf("    %u hits, %u misses (%u%% hit rate), %u evictions\n",
+		bs.bs_hits, bs.bs_misses,
+		reads == 0 ? 0 : (unsigned)(bs.bs_hits * 100ULL / reads),
+		bs.bs_evictions);
+	kprintf("    %u device reads, %u device writes of %u blocks\n",
+		bs.bs_devreads, bs.bs_devwrites, bs.bs_writeblocks);
+	kprintf("    %u blocks read ahead, %u of them used\n",
+		bs.bs_rablocks, bs.bs_rahits);
+}
+
+void
+buf_resetstats(void)
+{
+	spinlock_acquire(&buf_statslock);
+	buf_stats.bs_hits = 0;
+	buf_stats.bs_misses = 0;
+	buf_stats.bs_evictions = 0;
+	buf_stats.bs_devreads = 0;
+	buf_stats.bs_devwrites = 0;
+	buf_stats.bs_writeblocks = 0;
+	buf_stats.bs_syncs = 0;
+	buf_stats.bs_rablocks = 0;
+	buf_stats.bs_rahits = 0;
+	spinlock_release(&buf_statslock);
+}
@@ -0,0 +1,394 @@
+/*
+ * Name cache.
+ *
+ * Entries live in a hash table keyed by (directory, name) for lookup
+ * and on an LRU list for replacement; the head of the list is the
+ * most recently used.
+ *
+ * dcache_lock covers everything here. Dropping the last reference to
+ * a vnode can call into the filesystem to reclaim it, so entries are
+ * unhooked under the lock and their references released after it is
+ * dropped. Nothing calls into the cache with filesystem locks held.
+ *
+ * A lookup that misses asks the filesystem and then enters what it
+ * found. If a create or remove of the same name finishes in between,
+ * the answer is stale by the time we enter it; dcache_gen counts
+ * invalidations so such answers can be recognized and dropped.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <dcache.h>
+
+/* Number of hash chains. */
+#define DCACHE_HASHSIZE  127
+
+struct dcentry {
+	struct vnode *dc_dir;		/* directory the name is in */
+	struct vnode *dc_vn;		/* what it names, or NULL */
+	char *dc_name;			/* the name (kmalloc'd) */
+	unsigned dc_hash;		/* hash of dir and name */
+	struct dcentry *dc_hashnext;	/* next on hash chain */
+	struct dcentry *dc_lruprev;	/* more recently used */
+	struct dcentry *dc_lrunext;	/* less recently used */
+};
+
+static struct lock *dcache_lock;
+static struct dcentry *dcache_hash[DCACHE_HASHSIZE];
+static struct dcentry *dcache_lruhead, *dcache_lrutail;
+static unsigned dcache_num;
+static unsigned dcache_max = DCACHE_DEFAULT_MAX;
+static unsigned dcache_gen;
+static struct dcachestats dcache_stats;
+
+void
+dcache_bootstrap(void)
+{
+	dcache_lock = lock_create("dcache");
+	if (dcache_lock == NULL) {
+		panic("dcache: Could not create lock\n");
+	}
+}
+
+static
+unsigned
+dcache_hashname(struct vnode *dir, const char *name)
+{
+	unsigned h = (unsigned)(uintptr_t)dir;
+
+	while (*name != 0) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+////////////////////////////////////////////////////////////
+// lists
+
+static
+void
+dcache_lru_remove(struct dcentry *dc)
+{
+	if (dc->dc_lruprev != NULL) {
+		dc->dc_lruprev->dc_lrunext = dc->dc_lrunext;
+	}
+	else {
+		KASSERT(dcache_lruhead == dc);
+		dcache_lruhead = dc->dc_lrunext;
+	}
+	if (dc->dc_lrunext != NULL) {
+		dc->dc_lrunext->dc_lruprev = dc->dc_lruprev;
+	}
+	else {
+		KASSERT(dcache_lrutail == dc);
+		dcache_lrutail = dc->dc_lruprev;
+	}
+	dc->dc_lruprev = dc->dc_lrunext = NULL;
+}
+
+static
+void
+dcache_lru_addhead(struct dcentry *dc)
+{
+	dc->dc_lruprev = NULL;
+	dc->dc_lrunext = dcache_lruhead;
+	if (dcache_lruhead != NULL) {
+		dcache_lruhead->dc_lruprev = dc;
+	}
+	else {
+		dcache_lrutail = dc;
+	}
+	dcache_lruhead = dc;
+}
+
+static
+struct dcentry *
+dcache_find(struct vnode *dir, const char *name, unsigned hash)
+{
+	struct dcentry *dc;
+
+	for (dc = dcache_hash[hash % DCACHE_HASHSIZE]; dc != NULL;
+	     dc = dc->dc_hashnext) {
+		if (dc->dc_hash == hash && dc->dc_dir == dir &&
+		    !strcmp(dc->dc_name, name)) {
+			return dc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take DC out of the table and the LRU list and put it on *DOOMED,
+ * to be freed by dcache_release once dcache_lock is dropped.
+ */
+static
+void
+dcache_unhook(struct dcentry *dc, struct dcentry **doomed)
+{
+	struct dcentry **p;
+
+	KASSERT(lock_do_i_hold(dcache_lock));
+
+	p = &dcache_hash[dc->dc_hash % DCACHE_HASHSIZE];
+	while (*p != dc) {
+		KASSERT(*p != NULL);
+		p = &(*p)->dc_hashnext;
+	}
+	*p = dc->dc_hashnext;
+	dcache_lru_remove(dc);
+
+	KASSERT(dcache_num > 0);
+	dcache_num--;
+	if (dc->dc_vn == NULL) {
+		KASSERT(dcache_stats.ds_nnegative > 0);
+		dcache_stats.ds_nnegative--;
+	}
+
+	dc->dc_hashnext = *doomed;
+	*doomed = dc;
+}
+
+static
+void
+dcache_release(struct dcentry *doomed)
+{
+	struct dcentry *dc;
+
+	KASSERT(!lock_do_i_hold(dcache_lock));
+
+	while (doomed != NULL) {
+		dc = doomed;
+		doomed = dc->dc_hashnext;
+
+		if (dc->dc_vn != NULL) {
+			VOP_DECREF(dc->dc_vn);
+		}
+		VOP_DECREF(dc->dc_dir);
+		kfree(dc->dc_name);
+		kfree(dc);
+	}
+}
+
+/*
+ * Throw out least recently used entries until there are no more
+ * than dcache_max.
+ */
+static
+void
+dcache_trim(struct dcentry **doomed)
+{
+	while (dcache_num > dcache_max) {
+		KASSERT(dcache_lrutail != NULL);
+		dcache_unhook(dcache_lrutail, doomed);
+		dcache_stats.ds_evictions++;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+bool
+dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct dcentry *dc;
+	unsigned hash;
+
+	hash = dcache_hashname(dir, name);
+
+	lock_acquire(dcache_lock);
+	dc = dcache_find(dir, name, hash);
+	if (dc == NULL) {
+		dcache_stats.ds_misses++;
+		lock_release(dcache_lock);
+		return false;
+	}
+
+	if (dc->dc_vn != NULL) {
+		VOP_INCREF(dc->dc_vn);
+		dcache_stats.ds_hits++;
+	}
+	else {
+		dcache_stats.ds_neghits++;
+	}
+	*ret = dc->dc_vn;
+
+	dcache_lru_remove(dc);
+	dcache_lru_addhead(dc);
+	lock_release(dcache_lock);
+	return true;
+}
+
+unsigned
+dcache_generation(void)
+{
+	unsigned gen;
+
+	lock_acquire(dcache_lock);
+	gen = dcache_gen;
+	lock_release(dcache_lock);
+	return gen;
+}
+
+void
+dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+	     unsigned gen)
+{
+	struct dcentry *dc, *doomed = NULL;
+	unsigned hash;
+
+	/* These depend on where the directory is, not just what it is. */
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return;
+	}
+
+	dc = kmalloc(sizeof(*dc));
+	if (dc == NULL) {
+		return;
+	}
+	dc->dc_name = kstrdup(name);
+	if (dc->dc_name == NULL) {
+		kfree(dc);
+		return;
+	}
+	hash = dcache_hashname(dir, name);
+	dc->dc_dir = dir;
+	dc->dc_vn = vn;
+	dc->dc_hash = hash;
+
+	lock_acquire(dcache_lock);
+	if (dcache_max == 0 || gen != dcache_gen ||
+	    dcache_find(dir, name, hash) != NULL) {
+		lock_release(dcache_lock);
+		kfree(dc->dc_name);
+		kfree(dc);
+		return;
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	else {
+		dcache_stats.ds_nnegative++;
+	}
+	dc->dc_hashnext = dcache_hash[hash % DCACHE_HASHSIZE];
+	dcache_hash[hash % DCACHE_HASHSIZE] = dc;
+	dcache_lru_addhead(dc);
+	dcache_num++;
+
+	dcache_trim(&doomed);
+	lock_release(dcache_lock);
+
+	dcache_release(doomed);
+}
+
+void
+dcache_invalidate(struct vnode *dir, const char *name, bool isdir)
+{
+	struct dcentry *dc, *next, *doomed = NULL;
+	struct vnode *gone;
+
+	lock_acquire(dcache_lock);
+	dcache_gen++;
+
+	dc = dcache_find(dir, name, dcache_hashname(dir, name));
+	if (dc == NULL) {
+		lock_release(dcache_lock);
+		return;
+	}
+	gone = dc->dc_vn;
+	dcache_unhook(dc, &doomed);
+	dcache_stats.ds_invalidations++;
+
+	if (isdir && gone != NULL) {
+		for (dc = dcache_lruhead; dc != NULL; dc = next) {
+			next = dc->dc_lrunext;
+			if (dc->dc_dir == gone) {
+				dcache_unhook(dc, &doomed);
+				dcache_stats.ds_invalidations++;
+			}
+		}
+	}
+	lock_release(dcache_lock);
+
+	dcache_release(doomed);
+}
+
+void
+dcache_purgefs(struct fs *fs)
+{
+	struct dcentry *dc, *next, *doomed = NULL;
+
+	lock_acquire(dcache_lock);
+	dcache_gen++;
+	for (dc = dcache_lruhead; dc != NULL; dc = next) {
+		next = dc->dc_lrunext;
+		if (dc->dc_dir->vn_fs == fs) {
+			dcache_unhook(dc, &doomed);
+		}
+	}
+	lock_release(dcache_lock);
+
+	dcache_release(doomed);
+}
+
+unsigned
+dcache_getmax(void)
+{
+	return dcache_max;
+}
+
+void
+dcache_setmax(unsigned max)
+{
+	struct dcentry *doomed = NULL;
+
+	lock_acquire(dcache_lock);
+	dcache_max = max;
+	dcache_trim(&doomed);
+	lock_release(dcache_lock);
+
+	dcache_release(doomed);
+}
+
+void
+dcache_getstats(struct dcachestats *stats)
+{
+	lock_acquire(dcache_lock);
+	*stats = dcache_stats;
+	stats->ds_nentries = dcache_num;
+	lock_release(dcache_lock);
+}
+
+void
+dcache_printstats(void)
+{
+	struct dcachestats ds;
+	unsigned lookups;
+
+	dcache_getstats(&ds);
+	lookups = ds.ds_hits + ds.ds_neghits + ds.ds_misses;
+
+	kprintf("Name cache: %u/%u entries, %u negative\n",
+		ds.ds_nentries, dcache_max, ds.ds_nnegative);
+	kprintf("    %u hits, %u negative hits, %u misses (%u%% hit rate)\n",
+		ds.ds_hits, ds.ds_neghits, ds.ds_misses,
+		lookups == 0 ? 0 :
+		(unsigned)((ds.ds_hits + ds.ds_neghits) * 100ULL / lookups));
+	kprintf("    %u evictions, %u invalidations\n",
+		ds.ds_evictions, ds.ds_invalidations);
+}
+
+void
+dcache_resetstats(void)
+{
+	lock_acquire(dcache_lock);
+	dcache_stats.ds_hits = 0;
+	dcache_stats.ds_neghits = 0;
+	dcache_stats.ds_misses = 0;
+	dcache_stats.ds_evictions = 0;
+	dcache_stats.ds_invalidations = 0;
+	lock_release(dcache_lock);
+}
@@ -338,6 +338,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_fsync = null_fsync,
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
+	.vop_readahead = vopfail_readahead_nosys,
 	.vop_namefile = dev_namefile,
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -0,0 +1,133 @@
+/*
+ * Asynchronous block I/O requests and batches; see <device.h>.
+ *
+ * Every batch waits on the same wchan. A batch is just a counter, so
+ * a thread can keep one on its stack without allocating anything,
+ * and completions are rare enough next to disk latency that waking
+ * the occasional wrong waiter costs nothing worth measuring.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <uio.h>
+#include <device.h>
+
+static struct spinlock devreq_lock = SPINLOCK_INITIALIZER;
+static struct wchan *devreq_wchan;
+
+void
+devreq_bootstrap(void)
+{
+	devreq_wchan = wchan_create("devreq");
+	if (devreq_wchan == NULL) {
+		panic("devreq: Could not create wchan\n");
+	}
+}
+
+void
+devreq_init(struct devreq *req, daddr_t block, struct iovec *iov,
+	    unsigned iovcnt, bool write)
+{
+	req->dr_block = block;
+	req->dr_iov = iov;
+	req->dr_iovcnt = iovcnt;
+	req->dr_write = write;
+	req->dr_done = NULL;
+	req->dr_arg = NULL;
+	req->dr_result = 0;
+	req->dr_batch = NULL;
+	req->dr_next = NULL;
+}
+
+/*
+ * Do a request synchronously with devop_io, for devices that have no
+ * request queue. One devop_io per piece, so dr_iov isn't touched.
+ */
+static
+void
+dev_submit_sync(struct device *dev, struct devreq *req)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t pos;
+	unsigned i;
+	int result = 0;
+
+	pos = ((off_t)req->dr_block) * dev->d_blocksize;
+	for (i=0; i<req->dr_iovcnt && result == 0; i++) {
+		uio_kinit(&iov, &ku, req->dr_iov[i].iov_kbase,
+			  req->dr_iov[i].iov_len, pos,
+			  req->dr_write ? UIO_WRITE : UIO_READ);
+		result = DEVOP_IO(dev, &ku);
+		if (result == 0 && ku.uio_resid > 0) {
+			result = EIO;
+		}
+		pos += req->dr_iov[i].iov_len;
+	}
+	devreq_done(req, result);
+}
+
+void
+dev_submit(struct device *dev, struct devreq *req)
+{
+	KASSERT(req->dr_iovcnt > 0);
+
+	if (dev->d_ops->devop_submit == NULL) {
+		dev_submit_sync(dev, req);
+		return;
+	}
+	dev->d_ops->devop_submit(dev, req);
+}
+
+/*
+ * Called by drivers when a request has finished. Must not touch REQ
+ * after telling the batch, since the waiter may free it.
+ */
+void
+devreq_done(struct devreq *req, int result)
+{
+	struct devbatch *db = req->dr_batch;
+
+	req->dr_result = result;
+	if (req->dr_done != NULL) {
+		req->dr_done(req);
+	}
+	if (db != NULL) {
+		spinlock_acquire(&devreq_lock);
+		KASSERT(db->db_pending > 0);
+		db->db_pending--;
+		if (db->db_pending == 0) {
+			wchan_wakeall(devreq_wchan, &devreq_lock);
+		}
+		spinlock_release(&devreq_lock);
+	}
+}
+
+void
+devbatch_init(struct devbatch *db)
+{
+	db->db_pending = 0;
+}
+
+void
+devbatch_submit(struct devbatch *db, struct device *dev, struct devreq *req)
+{
+	req->dr_batch = db;
+	spinlock_acquire(&devreq_lock);
+	db->db_pending++;
+	spinlock_release(&devreq_lock);
+	dev_submit(dev, req);
+}
+
+void
+devbatch_wait(struct devbatch *db)
+{
+	spinlock_acquire(&devreq_lock);
+	while (db->db_pending > 0) {
+		wchan_sleep(devreq_wchan, &devreq_lock);
+	}
+	spinlock_release(&devreq_lock);
+}
@@ -114,6 +114,18 @@ vopfail_truncate_isdir(struct vnode *vn, off_t pos)
 	return EISDIR;
 }
 
+////////////////////////////////////////////////////////////
+// readahead
+
+int
+vopfail_readahead_nosys(struct vnode *vn, off_t pos, off_t len)
+{
+	(void)vn;
+	(void)pos;
+	(void)len;
+	return ENOSYS;
+}
+
 ////////////////////////////////////////////////////////////
 // creat
 
@@ -43,6 +43,8 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <buf.h>
+#include <dcache.h>
 
 /*
  * Structure for a single named device.
@@ -112,6 +114,9 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	devreq_bootstrap();
+	buf_bootstrap();
+	dcache_bootstrap();
 	devnull_create();
 	semfs_bootstrap();
 }
@@ -660,6 +665,9 @@ vfs_unmount(const char *devname)
 		goto fail;
 	}
 
+	/* let go of the vnodes the name cache is holding */
+	dcache_purgefs(kd->kd_fs);
+
 	result = FSOP_UNMOUNT(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -763,6 +771,8 @@ vfs_unmountall(void)
 			}
 		}
 
+		dcache_purgefs(dev->kd_fs);
+
 		result = FSOP_UNMOUNT(dev->kd_fs);
 		if (result == EBUSY) {
 			kprintf("vfs: Cannot unmount %s: (busy)\n",
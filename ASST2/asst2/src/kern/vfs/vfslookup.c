@@ -33,12 +33,14 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/stattypes.h>
 #include <limits.h>
 #include <lib.h>
 #include <synch.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <dcache.h>
 
 static struct vnode *bootfs_vnode = NULL;
 
@@ -234,6 +236,103 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Look up one component NAME in directory DIR, through the name
+ * cache.
+ */
+static
+int
+lookonce(struct vnode *dir, char *name, struct vnode **ret)
+{
+	char tmp[NAME_MAX+1];
+	unsigned gen;
+	int result;
+
+	if (strlen(name) > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+
+	if (dcache_lookup(dir, name, ret)) {
+		return *ret != NULL ? 0 : ENOENT;
+	}
+
+	/* VOP_LOOKUP may destroy the name; keep a copy to cache under. */
+	strcpy(tmp, name);
+	gen = dcache_generation();
+	result = VOP_LOOKUP(dir, name, ret);
+	if (result == 0) {
+		dcache_enter(dir, tmp, *ret, gen);
+	}
+	else if (result == ENOENT) {
+		dcache_enter(dir, tmp, NULL, gen);
+	}
+	return result;
+}
+
+/*
+ * Translate PATH relative to STARTVN a component at a time, handing
+ * back a new reference to what it names. Resolving each component
+ * ourselves, instead of handing the whole path to VOP_LOOKUP, is what
+ * lets the name cache see every directory along the way.
+ */
+static
+int
+walkpath(struct vnode *startvn, char *path, struct vnode **ret)
+{
+	struct vnode *vn, *next;
+	char *name, *s;
+	bool trailingslash = false;
+	mode_t type;
+	int result;
+
+	VOP_INCREF(startvn);
+	vn = startvn;
+
+	while (1) {
+		while (*path == '/') {
+			trailingslash = true;
+			path++;
+		}
+		if (*path == 0) {
+			break;
+		}
+		trailingslash = false;
+
+		name = path;
+		s = strchr(path, '/');
+		if (s != NULL) {
+			*s = 0;
+			path = s + 1;
+			trailingslash = true;
+		}
+		else {
+			path = name + strlen(name);
+		}
+
+		result = lookonce(vn, name, &next);
+		VOP_DECREF(vn);
+		if (result) {
+			return result;
+		}
+		vn = next;
+	}
+
+	/* "name/" only makes sense if it's a directory. */
+	if (trailingslash) {
+		result = VOP_GETTYPE(vn, &type);
+		if (result == 0 && (type & _S_IFMT) != _S_IFDIR) {
+			result = ENOTDIR;
+		}
+		if (result) {
+			VOP_DECREF(vn);
+			return result;
+		}
+	}
+
+	*ret = vn;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
@@ -243,7 +342,8 @@ int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *s;
 	int result;
 
 	vfs_biglock_acquire();
@@ -254,21 +354,49 @@ vfs_lookparent(char *path, struct vnode **retval,
 		return result;
 	}
 
+	/*
+	 * The device table is all the biglock protects here; the
+	 * filesystem does its own locking from here on.
+	 */
+	vfs_biglock_release();
+
 	if (strlen(path)==0) {
 		/*
 		 * It does not make sense to use just a device name in
 		 * a context where "lookparent" is the desired
 		 * operation.
 		 */
-		result = EINVAL;
+		VOP_DECREF(startvn);
+		return EINVAL;
+	}
+
+	/*
+	 * Walk to the directory ourselves, so it goes through the name
+	 * cache, and let the filesystem split off the last component.
+	 */
+	s = strrchr(path, '/');
+	if (s == NULL) {
+		dir = startvn;
 	}
 	else {
-		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+		*s = 0;
+		result = walkpath(startvn, path, &dir);
+		VOP_DECREF(startvn);
+		if (result) {
+			return result;
+		}
+		path = s + 1;
 	}
 
-	VOP_DECREF(startvn);
+	if (strlen(path)==0) {
+		/* "dir/" has no last component to hand back. */
+		VOP_DECREF(dir);
+		return EINVAL;
+	}
 
-	vfs_biglock_release();
+	result = VOP_LOOKPARENT(dir, path, retval, buf, buflen);
+
+	VOP_DECREF(dir);
 	return result;
 }
 
@@ -286,15 +414,16 @@ vfs_lookup(char *path, struct vnode **retval)
 		return result;
 	}
 
+	/* As in vfs_lookparent, the filesystem locks for itself. */
+	vfs_biglock_release();
+
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = walkpath(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
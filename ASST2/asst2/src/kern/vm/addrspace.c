@@ -30,16 +30,64 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <vmstats.h>
 #include <proc.h>
+#include <current.h>
+#include <thread.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
+ *
+ * Nothing is loaded or allocated up front. An address space is a list
+ * of regions saying what each part of it should contain, and a page
+ * table of the pages that have been touched so far; as_fault fills in
+ * the rest one page at a time.
+ *
+ * as_copy doesn't copy pages either. Both address spaces share them,
+ * marked PTE_COW and mapped read-only, and the first write to one
+ * through either address space gets it a copy of its own.
+ *
+ * When memory runs short the pageout thread calls as_pageout, which
+ * takes pages from whatever address space owns them. So every page
+ * table, and every user page's coremap entry, is covered by one lock,
+ * as_biglock. Nobody holds it across I/O: a page being read in or
+ * written out is marked busy in the coremap and left present in the
+ * page table, and anyone else who wants it waits on as_busycv. Shared
+ * pages are never paged out and never have a swap slot of their own;
+ * once the others sharing one have gone, the next fault on it makes
+ * it an ordinary page again.
+ *
+ * Pages in swap are shared too, by sharing the slot; swap.c counts
+ * references to slots. So a page gives up its swap copy when it's
+ * first written, and a dirty page never has one.
  */
 
+static struct lock *as_biglock;
+static struct cv *as_busycv;
+
+void
+as_bootstrap(void)
+{
+	as_biglock = lock_create("as");
+	if (as_biglock == NULL) {
+		panic("as_bootstrap: Could not create address space lock\n");
+	}
+	as_busycv = cv_create("as");
+	if (as_busycv == NULL) {
+		panic("as_bootstrap: Could not create address space cv\n");
+	}
+}
+
 struct addrspace *
 as_create(void)
 {
@@ -50,29 +98,147 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_regions = NULL;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	/* No TLB address space ID yet; cpus start at generation 1. */
+	as->as_asid = 0;
+	as->as_asidcpu = 0;
+	as->as_asidgen = 0;
 
 	return as;
 }
 
+/*
+ * Add a region covering VADDR to VADDR+MEMSIZE, rounded out to whole
+ * pages.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+	     bool writeable, struct region **ret)
+{
+	struct region *rg;
+
+	if (vaddr + memsize < vaddr || vaddr + memsize > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_base = vaddr & PAGE_FRAME;
+	rg->rg_top = ROUNDUP(vaddr + memsize, PAGE_SIZE);
+	rg->rg_writeable = writeable;
+	rg->rg_vn = NULL;
+	rg->rg_fileva = vaddr;
+	rg->rg_fileoffset = 0;
+	rg->rg_filesize = 0;
+
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+
+	if (ret != NULL) {
+		*ret = rg;
+	}
+	return 0;
+}
+
+static
+void
+as_freeregions(struct addrspace *as)
+{
+	struct region *rg;
+
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		if (rg->rg_vn != NULL) {
+			VOP_DECREF(rg->rg_vn);
+		}
+		kfree(rg);
+	}
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg, *newrg;
+	vaddr_t va;
+	pte_t *pte, *newpte;
+	paddr_t pa;
+	unsigned slot;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
-	/*
-	 * Write this.
-	 */
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		result = as_addregion(newas, rg->rg_base,
+				      rg->rg_top - rg->rg_base,
+				      rg->rg_writeable, &newrg);
+		if (result) {
+			as_destroy(newas);
+			return result;
+		}
+		newrg->rg_vn = rg->rg_vn;
+		if (newrg->rg_vn != NULL) {
+			VOP_INCREF(newrg->rg_vn);
+		}
+		newrg->rg_fileva = rg->rg_fileva;
+		newrg->rg_fileoffset = rg->rg_fileoffset;
+		newrg->rg_filesize = rg->rg_filesize;
+	}
+
+	/* Share the pages, whether they're in memory or in swap. */
+	lock_acquire(as_biglock);
+	va = 0;
+	result = 0;
+	while ((pte = pt_next(old->as_pt, &va)) != NULL) {
+		if ((*pte & PTE_PRESENT) && coremap_isbusy(*pte & PTE_FRAME)) {
+			cv_wait(as_busycv, as_biglock);
+			continue;
+		}
+		result = pt_lookup(newas->as_pt, va, true, &newpte);
+		if (result) {
+			break;
+		}
+		if (*pte & PTE_SWAPPED) {
+			swap_share(*pte >> PTE_SLOTSHIFT);
+			*newpte = *pte;
+		}
+		else {
+			pa = *pte & PTE_FRAME;
+			if (!(*pte & PTE_COW)) {
+				slot = coremap_getslot(pa);
+				if (slot != COREMAP_NOSLOT) {
+					swap_free(slot);
+					coremap_setslot(pa, COREMAP_NOSLOT);
+					*pte |= PTE_DIRTY;
+				}
+			}
+			coremap_share(pa);
+			*pte |= PTE_COW;
+			*newpte = *pte;
+		}
+		va += PAGE_SIZE;
+	}
+	lock_release(as_biglock);
 
-	(void)old;
+	/* OLD's pages may be in the TLB writeable; they aren't now. */
+	vm_tlbforget(old);
 
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 	*ret = newas;
 	return 0;
 }
@@ -80,9 +246,38 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	vaddr_t va;
+	pte_t *pte;
+	paddr_t pa;
+	unsigned slot;
+
+	lock_acquire(as_biglock);
+	va = 0;
+	while ((pte = pt_next(as->as_pt, &va)) != NULL) {
+		if (*pte & PTE_SWAPPED) {
+			swap_free(*pte >> PTE_SLOTSHIFT);
+		}
+		else if (*pte & PTE_PRESENT) {
+			pa = *pte & PTE_FRAME;
+			if (coremap_isbusy(pa)) {
+				/* The pageout thread has it. */
+				cv_wait(as_busycv, as_biglock);
+				continue;
+			}
+			if (!(*pte & PTE_COW)) {
+				slot = coremap_getslot(pa);
+				if (slot != COREMAP_NOSLOT) {
+					swap_free(slot);
+				}
+			}
+			coremap_free(pa);
+		}
+		*pte = 0;
+		va += PAGE_SIZE;
+	}
+	lock_release(as_biglock);
+	pt_destroy(as->as_pt);
+	as_freeregions(as);
 
 	kfree(as);
 }
@@ -101,55 +296,72 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	/* Whatever it left in the TLB last time it ran is still good. */
+	vm_tlbactivate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * The address space is about to be destroyed and its pages
+	 * reused. Its TLB entries can stay, since its ID won't be
+	 * handed out again until they're flushed, but stop using them.
 	 */
+	vm_tlbdeactivate();
 }
 
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
- * VADDR+MEMSIZE.
+ * VADDR+MEMSIZE. Its pages are zero-filled when first touched.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. The
+ * MIPS TLB can only refuse writes, so only WRITEABLE is used.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	(void)readable;
+	(void)executable;
+
+	return as_addregion(as, vaddr, memsize, writeable != 0, NULL);
+}
+
+/*
+ * Like as_define_region, but the segment's first FILESIZE bytes come
+ * from offset OFFSET in the file V.
+ */
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+	       struct vnode *v, off_t offset, size_t filesize,
+	       int readable, int writeable, int executable)
+{
+	struct region *rg;
+	int result;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
 	(void)readable;
-	(void)writeable;
 	(void)executable;
-	return ENOSYS;
+
+	result = as_addregion(as, vaddr, memsize, writeable != 0, &rg);
+	if (result) {
+		return result;
+	}
+	if (filesize > 0) {
+		VOP_INCREF(v);
+		rg->rg_vn = v;
+		rg->rg_fileoffset = offset;
+		rg->rg_filesize = filesize < memsize ? filesize : memsize;
+	}
+	return 0;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
-
+	/* Nothing is loaded until it's touched. */
 	(void)as;
 	return 0;
 }
@@ -157,10 +369,6 @@ as_prepare_load(struct addrspace *as)
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
-
 	(void)as;
 	return 0;
 }
@@ -168,11 +376,13 @@ as_complete_load(struct addrspace *as)
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			      VM_STACKPAGES * PAGE_SIZE, true, NULL);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +390,484 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_pin(struct addrspace *as, vaddr_t vaddr, size_t len, bool write)
+{
+	vaddr_t va;
+	paddr_t pa;
+	bool writeable;
+	int result;
+
+	if (len == 0) {
+		return 0;
+	}
+	if (vaddr + len < vaddr || vaddr + len > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	/* as_fault leaves each page pinned. */
+	for (va = vaddr & PAGE_FRAME; va < vaddr + len; va += PAGE_SIZE) {
+		result = as_fault(as, va,
+				  write ? VM_FAULT_WRITE : VM_FAULT_READ,
+				  &pa, &writeable);
+		if (result) {
+			if (va > vaddr) {
+				as_unpin(as, vaddr, va - vaddr);
+			}
+			return result;
+		}
+	}
+	return 0;
+}
+
+void
+as_unpin(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	vaddr_t va;
+	pte_t *pte;
+	int result;
+
+	if (len == 0) {
+		return;
+	}
+
+	/* Pinned pages can't go anywhere, so their PTEs still point at them. */
+	lock_acquire(as_biglock);
+	for (va = vaddr & PAGE_FRAME; va < vaddr + len; va += PAGE_SIZE) {
+		result = pt_lookup(as->as_pt, va, false, &pte);
+		KASSERT(result == 0 && pte != NULL);
+		KASSERT(*pte & PTE_PRESENT);
+		coremap_unpin(*pte & PTE_FRAME);
+	}
+	lock_release(as_biglock);
+}
+
+/*
+ * Check that the page at VADDR is in one of AS's regions, and find
+ * out whether it may be written.
+ */
+static
+bool
+as_inregion(struct addrspace *as, vaddr_t vaddr, bool *writeable)
+{
+	struct region *rg;
+	bool found = false;
+
+	/* A page shared by two segments may be written if either allows. */
+	*writeable = false;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_base && vaddr < rg->rg_top) {
+			found = true;
+			*writeable = *writeable || rg->rg_writeable;
+		}
+	}
+	return found;
+}
+
+/*
+ * Fill in the new page at VADDR, whose memory is at PADDR: zeros,
+ * except for whatever parts of it are file data. Segments needn't
+ * start or end on page boundaries, so more than one of them can have
+ * data on the same page.
+ */
+static
+int
+as_fillpage(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	struct region *rg;
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	char *kva;
+	bool fromfile = false;
+	int result;
+
+	kva = (char *)PADDR_TO_KVADDR(paddr);
+	bzero(kva, PAGE_SIZE);
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_vn == NULL) {
+			continue;
+		}
+		start = rg->rg_fileva > vaddr ? rg->rg_fileva : vaddr;
+		end = rg->rg_fileva + rg->rg_filesize;
+		if (end > vaddr + PAGE_SIZE) {
+			end = vaddr + PAGE_SIZE;
+		}
+		if (start >= end) {
+			continue;
+		}
+
+		uio_kinit(&iov, &ku, kva + (start - vaddr), end - start,
+			  rg->rg_fileoffset + (start - rg->rg_fileva),
+			  UIO_READ);
+		result = VOP_READ(rg->rg_vn, &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid != 0) {
+			kprintf("vm: short read on segment - file truncated?\n");
+			return ENOEXEC;
+		}
+		fromfile = true;
+	}
+	vmstats_inc(fromfile ? VMSTAT_FILELOADS : VMSTAT_ZEROFILLS);
+	return 0;
+}
+
+/*
+ * Put the new, busy page PADDR at VADDR, with entry PTE: read it from
+ * swap if it's there, otherwise fill it in. Drops as_biglock for the
+ * I/O.
+ */
+static
+int
+as_pagein(struct addrspace *as, vaddr_t vaddr, pte_t *pte, paddr_t paddr)
+{
+	pte_t oldpte;
+	unsigned slot;
+	bool writeable;
+	int result;
+
+	KASSERT(lock_do_i_hold(as_biglock));
+	KASSERT(!(*pte & PTE_PRESENT));
+
+	oldpte = *pte;
+	if (oldpte & PTE_SWAPPED) {
+		/* Keep the swap copy; if the page stays clean, it's free. */
+		slot = oldpte >> PTE_SLOTSHIFT;
+		coremap_setslot(paddr, slot);
+		*pte = paddr | PTE_PRESENT;
+		lock_release(as_biglock);
+		result = swap_read(slot, paddr);
+	}
+	else {
+		/*
+		 * If nobody can write it, it can be filled in again
+		 * instead of being paged out, so leave it clean.
+		 */
+		as_inregion(as, vaddr, &writeable);
+		*pte = paddr | PTE_PRESENT | (writeable ? PTE_DIRTY : 0);
+		lock_release(as_biglock);
+		result = as_fillpage(as, vaddr, paddr);
+	}
+	lock_acquire(as_biglock);
+
+	if (result) {
+		coremap_setslot(paddr, COREMAP_NOSLOT);
+		*pte = oldpte;
+	}
+	coremap_unbusy(paddr);
+	if (result) {
+		coremap_free(paddr);
+	}
+	cv_broadcast(as_busycv, as_biglock);
+	return result;
+}
+
+/*
+ * Give the process a copy of the shared page at VADDR, with entry
+ * PTE, that it can write.
+ */
+static
+int
+as_unshare(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+
+	KASSERT((*pte & (PTE_PRESENT|PTE_COW)) == (PTE_PRESENT|PTE_COW));
+
+	oldpa = *pte & PTE_FRAME;
+	newpa = coremap_alloc_user(as, vaddr);
+	if (newpa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	*pte = newpa | PTE_PRESENT | PTE_DIRTY;
+	coremap_unbusy(newpa);
+	coremap_free(oldpa);
+	vmstats_inc(VMSTAT_COWCOPIES);
+	return 0;
+}
+
+int
+as_fault(struct addrspace *as, vaddr_t vaddr, int faulttype,
+	 paddr_t *paddr, bool *writeable)
+{
+	pte_t *pte;
+	paddr_t pa;
+	unsigned slot;
+	int result;
+
+	vaddr &= PAGE_FRAME;
+
+	if (!as_inregion(as, vaddr, writeable)) {
+		return EFAULT;
+	}
+
+	switch (faulttype) {
+	    case VM_FAULT_READ:
+		break;
+	    case VM_FAULT_WRITE:
+	    case VM_FAULT_READONLY:
+		/* Writeable pages are mapped read-only if shared or clean. */
+		if (!*writeable) {
+			return EFAULT;
+		}
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	lock_acquire(as_biglock);
+ retry:
+	result = pt_lookup(as->as_pt, vaddr, true, &pte);
+	if (result) {
+		goto fail;
+	}
+	if (!(*pte & PTE_PRESENT)) {
+		pa = coremap_alloc_user(as, vaddr);
+		if (pa == 0) {
+			result = ENOMEM;
+			goto fail;
+		}
+		result = as_pagein(as, vaddr, pte, pa);
+		if (result) {
+			goto fail;
+		}
+		/* Somebody may have come along while we were unlocked. */
+		goto retry;
+	}
+	pa = *pte & PTE_FRAME;
+	if (coremap_isbusy(pa)) {
+		cv_wait(as_busycv, as_biglock);
+		goto retry;
+	}
+
+	if (*pte & PTE_COW) {
+		if (faulttype != VM_FAULT_READ) {
+			vmstats_inc(VMSTAT_COWFAULTS);
+		}
+		/*
+		 * If everyone else sharing it has gone, it's ours, and
+		 * can be paged out again. Otherwise copy it to write it.
+		 */
+		if (coremap_claim(pa, as, vaddr)) {
+			*pte &= ~PTE_COW;
+		}
+		else if (faulttype != VM_FAULT_READ) {
+			result = as_unshare(as, vaddr, pte);
+			if (result) {
+				goto fail;
+			}
+			pa = *pte & PTE_FRAME;
+		}
+	}
+	if (faulttype != VM_FAULT_READ && !(*pte & PTE_DIRTY)) {
+		/*
+		 * Its swap copy is stale now, and may be someone else's
+		 * too, so let it go. It gets a new one if it's paged out.
+		 */
+		slot = coremap_getslot(pa);
+		if (slot != COREMAP_NOSLOT) {
+			swap_free(slot);
+			coremap_setslot(pa, COREMAP_NOSLOT);
+		}
+		*pte |= PTE_DIRTY;
+	}
+	/* Map it read-only until it's written, to find out when it is. */
+	if ((*pte & (PTE_COW|PTE_DIRTY)) != PTE_DIRTY) {
+		*writeable = false;
+	}
+	coremap_pin(pa);
+	lock_release(as_biglock);
+
+	swap_wake();
+	*paddr = pa;
+	return 0;
+
+ fail:
+	lock_release(as_biglock);
+	if (result == ENOMEM && swap_waitforpages()) {
+		lock_acquire(as_biglock);
+		goto retry;
+	}
+	return result;
+}
+
+/*
+ * Only the process itself changes its regions and page table
+ * directory, and it's the one faulting, so they can be read without
+ * the lock. Its PTEs can be changed by the pageout thread, so check
+ * after the page turns out not to be busy that the PTE is still the
+ * same: paging it out marks it busy first, and sets the PTE before
+ * it's unbusy again. Anything that changes a page from under an
+ * address space takes it out of the TLBs afterwards, and with
+ * interrupts off here that has to wait until the caller is done.
+ */
+bool
+as_quickfault(struct addrspace *as, vaddr_t vaddr, int faulttype,
+	      paddr_t *paddr, bool *writeable)
+{
+	pte_t *pte, entry;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	vaddr &= PAGE_FRAME;
+
+	if (pt_lookup(as->as_pt, vaddr, false, &pte) || pte == NULL) {
+		return false;
+	}
+	entry = *pte;
+	/* Shared pages need claiming or copying. */
+	if ((entry & (PTE_PRESENT|PTE_COW)) != PTE_PRESENT) {
+		return false;
+	}
+	/* Clean ones are mapped read-only, to find out when they're written. */
+	if (!(entry & PTE_DIRTY) || !as_inregion(as, vaddr, writeable)) {
+		*writeable = false;
+	}
+	if (faulttype != VM_FAULT_READ && !*writeable) {
+		return false;
+	}
+	if (!coremap_touch(entry & PTE_FRAME) || *pte != entry) {
+		return false;
+	}
+	*paddr = entry & PTE_FRAME;
+	return true;
+}
+
+/*
+ * Page out up to MAX pages, picked by the coremap's clock: write the
+ * dirty ones to swap, all together, and free them all. Clean ones
+ * that were never in swap are just dropped, and filled in again from
+ * their file when next touched. Called by the pageout thread. Returns
+ * how many pages were freed.
+ */
+unsigned
+as_pageout(unsigned max)
+{
+	paddr_t victims[SWAP_BATCH], wpages[SWAP_BATCH];
+	unsigned slots[SWAP_BATCH], wslots[SWAP_BATCH], windex[SWAP_BATCH];
+	bool newslot[SWAP_BATCH], refill[SWAP_BATCH];
+	int results[SWAP_BATCH], wresults[SWAP_BATCH];
+	pte_t *ptes[SWAP_BATCH];
+	struct addrspace *as;
+	vaddr_t va;
+	unsigned i, n, nw, nnew, first, freed, pass;
+	int result;
+
+	KASSERT(max <= SWAP_BATCH);
+
+	lock_acquire(as_biglock);
+	n = coremap_pickvictims(victims, max);
+	if (n == 0) {
+		lock_release(as_biglock);
+		return 0;
+	}
+
+	nnew = 0;
+	for (i=0; i<n; i++) {
+		coremap_getowner(victims[i], &as, &va);
+		KASSERT(as != NULL);
+		result = pt_lookup(as->as_pt, va, false, &ptes[i]);
+		KASSERT(result == 0 && ptes[i] != NULL);
+		KASSERT((*ptes[i] & PTE_FRAME) == victims[i]);
+		KASSERT(!(*ptes[i] & PTE_COW));
+		slots[i] = coremap_getslot(victims[i]);
+		KASSERT(!(*ptes[i] & PTE_DIRTY) || slots[i] == COREMAP_NOSLOT);
+		/* Clean with no swap copy: it comes back from its file. */
+		refill[i] = slots[i] == COREMAP_NOSLOT &&
+			!(*ptes[i] & PTE_DIRTY);
+		newslot[i] = slots[i] == COREMAP_NOSLOT && !refill[i];
+		if (newslot[i]) {
+			nnew++;
+		}
+	}
+
+	/* Give the new ones consecutive slots if we can. */
+	if (nnew > 0 && swap_alloc(nnew, &first) == 0) {
+		for (i=0; i<n; i++) {
+			if (newslot[i]) {
+				slots[i] = first++;
+			}
+		}
+	}
+	else {
+		for (i=0; i<n; i++) {
+			if (newslot[i] && swap_alloc(1, &slots[i]) != 0) {
+				slots[i] = COREMAP_NOSLOT;
+			}
+		}
+	}
+
+	/*
+	 * Queue the dirty ones, new slots first so they stay in order
+	 * and go out as one request.
+	 */
+	nw = 0;
+	for (pass = 0; pass < 2; pass++) {
+		for (i=0; i<n; i++) {
+			if (newslot[i] != (pass == 0)) {
+				continue;
+			}
+			results[i] = 0;
+			if (refill[i]) {
+				/* Nothing to write. */
+			}
+			else if (slots[i] == COREMAP_NOSLOT) {
+				/* Swap is full. */
+				results[i] = ENOSPC;
+			}
+			else if (*ptes[i] & PTE_DIRTY) {
+				windex[nw] = i;
+				wpages[nw] = victims[i];
+				wslots[nw] = slots[i];
+				nw++;
+			}
+		}
+	}
+
+	/*
+	 * Nobody may use them from here on, so get them out of the TLBs,
+	 * and then write them out. Neither needs as_biglock: they're
+	 * busy, so nobody maps them again meanwhile, and the flush waits
+	 * for every other cpu.
+	 */
+	lock_release(as_biglock);
+	vm_tlbflush_all();
+	if (nw > 0) {
+		swap_write(wslots, wpages, wresults, nw);
+	}
+	lock_acquire(as_biglock);
+	for (i=0; i<nw; i++) {
+		results[windex[i]] = wresults[i];
+	}
+
+	freed = 0;
+	for (i=0; i<n; i++) {
+		if (results[i]) {
+			if (newslot[i] && slots[i] != COREMAP_NOSLOT) {
+				swap_free(slots[i]);
+			}
+			coremap_unbusy(victims[i]);
+			continue;
+		}
+		if (refill[i]) {
+			*ptes[i] = 0;
+		}
+		else {
+			*ptes[i] = (slots[i] << PTE_SLOTSHIFT) | PTE_SWAPPED;
+		}
+		coremap_setslot(victims[i], COREMAP_NOSLOT);
+		coremap_unbusy(victims[i]);
+		coremap_free(victims[i]);
+		vmstats_inc(VMSTAT_EVICTIONS);
+		freed++;
+	}
+	cv_broadcast(as_busycv, as_biglock);
+	lock_release(as_biglock);
+
+	return freed;
+}
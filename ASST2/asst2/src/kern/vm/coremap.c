@@ -0,0 +1,722 @@
+/*
+ * Physical page frame allocator.
+ *
+ * Each coremap entry is in one of five states:
+ *
+ *    FIXED   - below the first free page at boot (exception vectors,
+ *              the kernel image, memory stolen early, and the coremap
+ *              itself). Never allocated or freed.
+ *    FREE    - on the global free list.
+ *    CACHED  - free, but in one cpu's page cache.
+ *    KERNEL  - allocated with coremap_alloc. The first page of an
+ *              allocation records how many pages it has; the rest
+ *              record 0.
+ *    USER    - allocated with coremap_alloc_user; records the address
+ *              space and virtual address it belongs to, and how many
+ *              address spaces are sharing it copy-on-write. A shared
+ *              page has no one owner, so it records none. A user page
+ *              is busy while it's being filled or paged out, pinned
+ *              while a fault is putting it in the TLB, and remembers
+ *              the swap slot holding a copy of it, if any.
+ *
+ * coremap_lock covers the free list, and every change into or out of
+ * the FREE state; the run search relies on that. A page in a cpu cache
+ * belongs to that cache, and one allocated belongs to its owner, so
+ * moving between CACHED, KERNEL, and USER only needs the cache's
+ * lock. User page reference counts, owners, and the busy, pinned,
+ * and referenced bits are covered by coremap_lock. Lock order: cache
+ * lock, then coremap_lock.
+ *
+ * User pages are only allocated, freed, shared, or picked for paging
+ * out with the address space lock in addrspace.c held, so the clock
+ * never sees a user page come or go under it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <coremap.h>
+#include <platform/maxcpus.h>
+
+#define CME_FIXED	0
+#define CME_FREE	1
+#define CME_CACHED	2
+#define CME_KERNEL	3
+#define CME_USER	4
+
+/* Marks the end of the free list. */
+#define CM_NONE		((unsigned)-1)
+
+/*
+ * Pages each cpu keeps for itself, and how many it moves to or from
+ * the global list at a time.
+ */
+#define COREMAP_CACHEMAX	16
+#define COREMAP_CACHEBATCH	8
+
+struct coremap_entry {
+	unsigned cme_prev;		/* free list links (page numbers) */
+	unsigned cme_next;
+	unsigned cme_npages;		/* pages in allocation, at its start */
+	struct addrspace *cme_as;	/* owner of a user page */
+	vaddr_t cme_vaddr;		/* where it is in the owner */
+	unsigned cme_refcount;		/* address spaces using a user page */
+	unsigned cme_swapslot;		/* copy in swap, or COREMAP_NOSLOT */
+	unsigned cme_pincount;		/* faults mapping a user page */
+	bool cme_busy;			/* user page is in transit */
+	bool cme_referenced;		/* used since the clock last passed */
+	unsigned char cme_state;	/* CME_* */
+};
+
+struct coremap_cache {
+	struct spinlock cc_lock;
+	unsigned cc_n;				/* pages in cc_pages */
+	unsigned cc_pages[COREMAP_CACHEMAX];	/* page numbers */
+	unsigned cc_allocs;			/* single-page allocs */
+	unsigned cc_frees;			/* single-page frees */
+	unsigned cc_hits;			/* allocs not needing a refill */
+	unsigned cc_userallocs;			/* of the allocs, user pages */
+	unsigned cc_userfrees;			/* of the frees, user pages */
+};
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct coremap_entry *coremap;
+static unsigned coremap_npages;		/* pages of RAM */
+static unsigned coremap_first;		/* first page not FIXED */
+static unsigned coremap_freehead;	/* head of free list */
+static unsigned coremap_nfree;		/* pages on free list */
+static unsigned coremap_allocs;		/* multi-page allocs */
+static unsigned coremap_frees;		/* multi-page frees */
+static unsigned coremap_failures;
+static unsigned coremap_hand;		/* clock hand for paging out */
+static struct coremap_cache coremap_caches[MAXCPUS];
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t paddr;
+	size_t size;
+	unsigned i;
+
+	coremap_npages = ram_getsize() / PAGE_SIZE;
+	size = coremap_npages * sizeof(struct coremap_entry);
+	paddr = ram_stealmem(DIVROUNDUP(size, PAGE_SIZE));
+	if (paddr == 0) {
+		panic("coremap: No memory for %u pages\n", coremap_npages);
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(paddr);
+
+	/* This also turns ram_stealmem off. */
+	coremap_first = ram_getfirstfree() / PAGE_SIZE;
+
+	for (i=0; i<coremap_npages; i++) {
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_swapslot = COREMAP_NOSLOT;
+		coremap[i].cme_pincount = 0;
+		coremap[i].cme_busy = false;
+		coremap[i].cme_referenced = false;
+	}
+	for (i=0; i<coremap_first; i++) {
+		coremap[i].cme_prev = coremap[i].cme_next = CM_NONE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_state = CME_FIXED;
+	}
+
+	/* Build the free list in order, so low pages go out first. */
+	coremap_freehead = CM_NONE;
+	for (i=coremap_first; i<coremap_npages; i++) {
+		coremap[i].cme_prev = i > coremap_first ? i - 1 : CM_NONE;
+		coremap[i].cme_next = i + 1 < coremap_npages ? i + 1 : CM_NONE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_state = CME_FREE;
+	}
+	if (coremap_first < coremap_npages) {
+		coremap_freehead = coremap_first;
+	}
+	coremap_nfree = coremap_npages - coremap_first;
+	coremap_hand = coremap_first;
+
+	for (i=0; i<MAXCPUS; i++) {
+		spinlock_init(&coremap_caches[i].cc_lock);
+		coremap_caches[i].cc_n = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// free list
+
+static
+void
+coremap_push(unsigned page)
+{
+	struct coremap_entry *cme = &coremap[page];
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(cme->cme_state != CME_FREE && cme->cme_state != CME_FIXED);
+
+	cme->cme_state = CME_FREE;
+	cme->cme_npages = 0;
+	cme->cme_prev = CM_NONE;
+	cme->cme_next = coremap_freehead;
+	if (coremap_freehead != CM_NONE) {
+		coremap[coremap_freehead].cme_prev = page;
+	}
+	coremap_freehead = page;
+	coremap_nfree++;
+}
+
+static
+void
+coremap_unlink(unsigned page)
+{
+	struct coremap_entry *cme = &coremap[page];
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(cme->cme_state == CME_FREE);
+
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		KASSERT(coremap_freehead == page);
+		coremap_freehead = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	cme->cme_prev = cme->cme_next = CM_NONE;
+	KASSERT(coremap_nfree > 0);
+	coremap_nfree--;
+}
+
+/*
+ * Find NPAGES free pages in a row, take them off the free list, and
+ * return the first, or CM_NONE.
+ */
+static
+unsigned
+coremap_takerun(unsigned npages)
+{
+	unsigned i, start, len;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (coremap_nfree < npages) {
+		return CM_NONE;
+	}
+	start = coremap_first;
+	len = 0;
+	for (i=coremap_first; i<coremap_npages && len < npages; i++) {
+		if (coremap[i].cme_state != CME_FREE) {
+			len = 0;
+			continue;
+		}
+		if (len == 0) {
+			start = i;
+		}
+		len++;
+	}
+	if (len < npages) {
+		return CM_NONE;
+	}
+	for (i=start; i<start+npages; i++) {
+		coremap_unlink(i);
+		coremap[i].cme_state = CME_KERNEL;
+	}
+	coremap[start].cme_npages = npages;
+	return start;
+}
+
+////////////////////////////////////////////////////////////
+// cpu caches
+
+/*
+ * Move pages from the global list into CC until it has a batch.
+ */
+static
+void
+coremap_cache_refill(struct coremap_cache *cc)
+{
+	unsigned page;
+
+	KASSERT(spinlock_do_i_hold(&cc->cc_lock));
+
+	spinlock_acquire(&coremap_lock);
+	while (cc->cc_n < COREMAP_CACHEBATCH && coremap_freehead != CM_NONE) {
+		page = coremap_freehead;
+		coremap_unlink(page);
+		coremap[page].cme_state = CME_CACHED;
+		cc->cc_pages[cc->cc_n++] = page;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Move pages from CC back to the global list until it has only KEEP.
+ */
+static
+void
+coremap_cache_flush(struct coremap_cache *cc, unsigned keep)
+{
+	KASSERT(spinlock_do_i_hold(&cc->cc_lock));
+
+	spinlock_acquire(&coremap_lock);
+	while (cc->cc_n > keep) {
+		coremap_push(cc->cc_pages[--cc->cc_n]);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Empty every cpu's cache, so the pages in them can be found by a
+ * run search or by a cpu whose own cache is empty.
+ */
+static
+void
+coremap_drain(void)
+{
+	struct coremap_cache *cc;
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		cc = &coremap_caches[i];
+		spinlock_acquire(&cc->cc_lock);
+		if (cc->cc_n > 0) {
+			coremap_cache_flush(cc, 0);
+		}
+		spinlock_release(&cc->cc_lock);
+	}
+}
+
+static
+unsigned
+coremap_alloc_one(void)
+{
+	struct coremap_cache *cc;
+	unsigned page = CM_NONE;
+
+	cc = &coremap_caches[curcpu->c_number];
+	spinlock_acquire(&cc->cc_lock);
+	if (cc->cc_n > 0) {
+		cc->cc_hits++;
+	}
+	else {
+		coremap_cache_refill(cc);
+	}
+	if (cc->cc_n > 0) {
+		page = cc->cc_pages[--cc->cc_n];
+		cc->cc_allocs++;
+	}
+	spinlock_release(&cc->cc_lock);
+	return page;
+}
+
+static
+void
+coremap_free_one(unsigned page)
+{
+	struct coremap_cache *cc;
+
+	cc = &coremap_caches[curcpu->c_number];
+	spinlock_acquire(&cc->cc_lock);
+	if (coremap[page].cme_state == CME_USER) {
+		cc->cc_userfrees++;
+	}
+	coremap[page].cme_state = CME_CACHED;
+	coremap[page].cme_npages = 0;
+	coremap[page].cme_as = NULL;
+	coremap[page].cme_vaddr = 0;
+	if (cc->cc_n == COREMAP_CACHEMAX) {
+		coremap_cache_flush(cc, COREMAP_CACHEMAX - COREMAP_CACHEBATCH);
+	}
+	cc->cc_pages[cc->cc_n++] = page;
+	cc->cc_frees++;
+	spinlock_release(&cc->cc_lock);
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+paddr_t
+coremap_alloc(unsigned npages)
+{
+	unsigned page;
+	paddr_t paddr;
+	bool drained = false;
+
+	KASSERT(npages > 0);
+
+	if (coremap == NULL) {
+		/* Too early; steal it for good. */
+		spinlock_acquire(&coremap_lock);
+		paddr = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return paddr;
+	}
+
+	while (1) {
+		if (npages == 1) {
+			page = coremap_alloc_one();
+			if (page != CM_NONE) {
+				coremap[page].cme_state = CME_KERNEL;
+				coremap[page].cme_npages = 1;
+				return (paddr_t)page * PAGE_SIZE;
+			}
+		}
+		else {
+			spinlock_acquire(&coremap_lock);
+			page = coremap_takerun(npages);
+			if (page != CM_NONE) {
+				coremap_allocs++;
+				spinlock_release(&coremap_lock);
+				return (paddr_t)page * PAGE_SIZE;
+			}
+			spinlock_release(&coremap_lock);
+		}
+
+		if (drained) {
+			break;
+		}
+		/* Maybe what we need is sitting in other cpus' caches. */
+		coremap_drain();
+		drained = true;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	coremap_failures++;
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+paddr_t
+coremap_alloc_user(struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_cache *cc;
+	paddr_t paddr;
+	unsigned page;
+
+	KASSERT(as != NULL);
+	KASSERT(vaddr % PAGE_SIZE == 0);
+
+	paddr = coremap_alloc(1);
+	if (paddr == 0) {
+		return 0;
+	}
+	page = paddr / PAGE_SIZE;
+
+	coremap[page].cme_state = CME_USER;
+	coremap[page].cme_as = as;
+	coremap[page].cme_vaddr = vaddr;
+	coremap[page].cme_refcount = 1;
+	coremap[page].cme_swapslot = COREMAP_NOSLOT;
+	coremap[page].cme_pincount = 0;
+	coremap[page].cme_referenced = true;
+	coremap[page].cme_busy = true;
+
+	cc = &coremap_caches[curcpu->c_number];
+	spinlock_acquire(&cc->cc_lock);
+	cc->cc_userallocs++;
+	spinlock_release(&cc->cc_lock);
+
+	return paddr;
+}
+
+void
+coremap_share(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_state == CME_USER);
+	KASSERT(cme->cme_refcount > 0);
+	cme->cme_refcount++;
+	cme->cme_as = NULL;
+	cme->cme_vaddr = 0;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_claim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+	bool sole;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_state == CME_USER);
+	sole = cme->cme_refcount == 1;
+	if (sole) {
+		cme->cme_as = as;
+		cme->cme_vaddr = vaddr;
+	}
+	spinlock_release(&coremap_lock);
+	return sole;
+}
+
+void
+coremap_unbusy(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_state == CME_USER);
+	KASSERT(cme->cme_busy);
+	cme->cme_busy = false;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_isbusy(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	bool busy;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_state == CME_USER);
+	busy = cme->cme_busy;
+	spinlock_release(&coremap_lock);
+	return busy;
+}
+
+void
+coremap_pin(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_state == CME_USER);
+	KASSERT(!cme->cme_busy);
+	cme->cme_pincount++;
+	cme->cme_referenced = true;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_unpin(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_state == CME_USER);
+	KASSERT(cme->cme_pincount > 0);
+	cme->cme_pincount--;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_touch(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	bool ok;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	ok = cme->cme_state == CME_USER && !cme->cme_busy;
+	if (ok) {
+		cme->cme_referenced = true;
+	}
+	spinlock_release(&coremap_lock);
+	return ok;
+}
+
+unsigned
+coremap_getslot(paddr_t paddr)
+{
+	KASSERT(paddr % PAGE_SIZE == 0);
+	KASSERT(coremap[paddr / PAGE_SIZE].cme_state == CME_USER);
+	return coremap[paddr / PAGE_SIZE].cme_swapslot;
+}
+
+void
+coremap_setslot(paddr_t paddr, unsigned slot)
+{
+	KASSERT(paddr % PAGE_SIZE == 0);
+	KASSERT(coremap[paddr / PAGE_SIZE].cme_state == CME_USER);
+	coremap[paddr / PAGE_SIZE].cme_swapslot = slot;
+}
+
+void
+coremap_getowner(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cme->cme_state == CME_USER);
+	*as = cme->cme_as;
+	*vaddr = cme->cme_vaddr;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Second-chance clock. Each user page the hand passes that's been
+ * used since last time gets its referenced bit cleared and is left
+ * alone; the first ones found unused are taken. Pages that are
+ * shared, busy, or pinned are skipped. Going around twice is enough
+ * to find every page not used in between.
+ */
+unsigned
+coremap_pickvictims(paddr_t *victims, unsigned max)
+{
+	struct coremap_entry *cme;
+	unsigned n = 0, scanned, page;
+
+	spinlock_acquire(&coremap_lock);
+	for (scanned = 0;
+	     scanned < 2 * (coremap_npages - coremap_first) && n < max;
+	     scanned++) {
+		page = coremap_hand;
+		if (++coremap_hand == coremap_npages) {
+			coremap_hand = coremap_first;
+		}
+
+		cme = &coremap[page];
+		if (cme->cme_state != CME_USER || cme->cme_as == NULL ||
+		    cme->cme_busy || cme->cme_pincount > 0) {
+			continue;
+		}
+		if (cme->cme_referenced) {
+			cme->cme_referenced = false;
+			continue;
+		}
+		cme->cme_busy = true;
+		victims[n++] = (paddr_t)page * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	return n;
+}
+
+unsigned
+coremap_countfree(void)
+{
+	unsigned i, n;
+
+	/* No locks: it's only a hint, and a stale one does no harm. */
+	n = coremap_nfree;
+	for (i=0; i<MAXCPUS; i++) {
+		n += coremap_caches[i].cc_n;
+	}
+	return n;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned page, npages, i;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	page = paddr / PAGE_SIZE;
+
+	if (coremap == NULL || page < coremap_first) {
+		/* Stolen before we took over; we don't know its size. */
+		return;
+	}
+	KASSERT(page < coremap_npages);
+	KASSERT(coremap[page].cme_state == CME_KERNEL ||
+		coremap[page].cme_state == CME_USER);
+
+	if (coremap[page].cme_state == CME_USER) {
+		/* Only the last address space using it frees it. */
+		spinlock_acquire(&coremap_lock);
+		KASSERT(coremap[page].cme_refcount > 0);
+		coremap[page].cme_refcount--;
+		if (coremap[page].cme_refcount > 0) {
+			spinlock_release(&coremap_lock);
+			return;
+		}
+		KASSERT(!coremap[page].cme_busy);
+		KASSERT(coremap[page].cme_pincount == 0);
+		spinlock_release(&coremap_lock);
+	}
+
+	npages = coremap[page].cme_npages;
+	KASSERT(npages > 0 && page + npages <= coremap_npages);
+
+	if (npages == 1) {
+		coremap_free_one(page);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	for (i=page; i<page+npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_KERNEL);
+		KASSERT(i == page || coremap[i].cme_npages == 0);
+		coremap_push(i);
+	}
+	coremap_frees++;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_getstats(struct coremapstats *stats)
+{
+	struct coremap_cache *cc;
+	unsigned i, userallocs = 0, userfrees = 0;
+
+	bzero(stats, sizeof(*stats));
+	for (i=0; i<MAXCPUS; i++) {
+		cc = &coremap_caches[i];
+		spinlock_acquire(&cc->cc_lock);
+		stats->cs_ncached += cc->cc_n;
+		stats->cs_allocs += cc->cc_allocs;
+		stats->cs_frees += cc->cc_frees;
+		stats->cs_cachehits += cc->cc_hits;
+		userallocs += cc->cc_userallocs;
+		userfrees += cc->cc_userfrees;
+		spinlock_release(&cc->cc_lock);
+	}
+
+	spinlock_acquire(&coremap_lock);
+	stats->cs_npages = coremap_npages - coremap_first;
+	stats->cs_nfree = coremap_nfree + stats->cs_ncached;
+	stats->cs_allocs += coremap_allocs;
+	stats->cs_frees += coremap_frees;
+	stats->cs_failures = coremap_failures;
+	spinlock_release(&coremap_lock);
+
+	/* A page can be allocated on one cpu and freed on another. */
+	stats->cs_nuser = userallocs - userfrees;
+	stats->cs_nkernel = stats->cs_npages - stats->cs_nfree -
+		stats->cs_nuser;
+}
+
+void
+coremap_printstats(void)
+{
+	struct coremapstats cs;
+
+	coremap_getstats(&cs);
+
+	kprintf("Coremap: %u pages, %u free (%u in cpu caches), "
+		"%u kernel, %u user\n", cs.cs_npages, cs.cs_nfree,
+		cs.cs_ncached, cs.cs_nkernel, cs.cs_nuser);
+	kprintf("    %u allocs (%u from cpu caches), %u frees, "
+		"%u failures\n", cs.cs_allocs, cs.cs_cachehits, cs.cs_frees,
+		cs.cs_failures);
+}
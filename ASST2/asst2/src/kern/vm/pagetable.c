@@ -0,0 +1,107 @@
+/*
+ * Two-level page table.
+ *
+ * Each second-level table is a page (1024 four-byte entries), and
+ * the directory half a page, since only the bottom 2G of the address
+ * space belongs to the user. A process that touches a little text, a
+ * little data, and a little stack costs three and a half pages of
+ * table.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+#define PT_NENTRIES	1024
+#define PT_NDIR		(USERSPACETOP >> PT_DIRSHIFT)
+#define PT_DIRSHIFT	22
+#define PT_L2SHIFT	12
+
+#define PT_DIRINDEX(va)	((va) >> PT_DIRSHIFT)
+#define PT_L2INDEX(va)	(((va) >> PT_L2SHIFT) & (PT_NENTRIES - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_NDIR];
+};
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_NDIR; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	for (i=0; i<PT_NDIR; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+int
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create, pte_t **ret)
+{
+	pte_t *l2;
+	unsigned i;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	l2 = pt->pt_dir[PT_DIRINDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			*ret = NULL;
+			return 0;
+		}
+		l2 = kmalloc(PT_NENTRIES * sizeof(pte_t));
+		if (l2 == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<PT_NENTRIES; i++) {
+			l2[i] = 0;
+		}
+		pt->pt_dir[PT_DIRINDEX(vaddr)] = l2;
+	}
+	*ret = &l2[PT_L2INDEX(vaddr)];
+	return 0;
+}
+
+pte_t *
+pt_next(struct pagetable *pt, vaddr_t *vaddr)
+{
+	unsigned d, i;
+	pte_t *l2;
+
+	d = PT_DIRINDEX(*vaddr);
+	i = PT_L2INDEX(*vaddr);
+	for (; d < PT_NDIR; d++, i = 0) {
+		l2 = pt->pt_dir[d];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (; i<PT_NENTRIES; i++) {
+			if (l2[i] != 0) {
+				*vaddr = ((vaddr_t)d << PT_DIRSHIFT) |
+					((vaddr_t)i << PT_L2SHIFT);
+				return &l2[i];
+			}
+		}
+	}
+	return NULL;
+}
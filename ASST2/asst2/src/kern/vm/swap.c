@@ -0,0 +1,358 @@
+/*
+ * Swap space.
+ *
+ * User pages that don't fit in memory go to the raw disk SWAP_DEVICE,
+ * one page per slot, and a bitmap records which slots are in use.
+ * Address spaces copied with as_copy share slots, so each slot also
+ * has a reference count, and is only freed when the last goes.
+ *
+ * The pageout thread keeps some memory free. It's woken when the
+ * number of free pages drops below SWAP_LOWATER, or when a fault
+ * can't get a page at all, and calls as_pageout to push out batches
+ * of up to SWAP_BATCH pages until SWAP_HIWATER are free. All the
+ * writes for a batch are started together and the thread sleeps once
+ * for the lot; as_pageout hands out new slots in runs, so usually the
+ * whole batch is a single device request.
+ *
+ * swap_pagerlock is a spinlock, so swap_wake can be called from
+ * anywhere.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <device.h>
+#include <bitmap.h>
+#include <vfs.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <swap.h>
+
+#define SWAP_DEVICE	"lhd1"
+
+/* Start paging out below this many free pages; stop at the other. */
+#define SWAP_LOWATER	16
+#define SWAP_HIWATER	32
+
+static struct vnode *swap_vn;
+static struct device *swap_dev;
+static unsigned swap_nslots;
+
+static struct spinlock swap_maplock = SPINLOCK_INITIALIZER;
+static struct bitmap *swap_map;
+static uint16_t *swap_refs;		/* references to each slot */
+static unsigned swap_nused;
+
+static struct spinlock swap_pagerlock = SPINLOCK_INITIALIZER;
+static struct wchan *swap_pagerwchan;	/* the pageout thread waits here */
+static struct wchan *swap_waitwchan;	/* faults wait here for a pass */
+static bool swap_pagerwanted;
+static bool swap_pagerrunning;
+static unsigned swap_passes;		/* passes finished */
+static unsigned swap_lastfreed;		/* pages freed by the last one */
+
+////////////////////////////////////////////////////////////
+// slots
+
+int
+swap_alloc(unsigned count, unsigned *slot)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(count > 0);
+
+	spinlock_acquire(&swap_maplock);
+	if (swap_map == NULL) {
+		result = ENOSPC;
+	}
+	else if (count == 1) {
+		result = bitmap_alloc(swap_map, slot);
+	}
+	else {
+		result = bitmap_alloc_range(swap_map, count, slot);
+	}
+	if (result == 0) {
+		for (i=0; i<count; i++) {
+			KASSERT(swap_refs[*slot + i] == 0);
+			swap_refs[*slot + i] = 1;
+		}
+		swap_nused += count;
+	}
+	spinlock_release(&swap_maplock);
+	return result;
+}
+
+void
+swap_share(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_maplock);
+	KASSERT(swap_refs[slot] > 0);
+	KASSERT(swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_maplock);
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_maplock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	KASSERT(swap_refs[slot] > 0);
+	swap_refs[slot]--;
+	if (swap_refs[slot] == 0) {
+		bitmap_unmark(swap_map, slot);
+		KASSERT(swap_nused > 0);
+		swap_nused--;
+	}
+	spinlock_release(&swap_maplock);
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+static
+daddr_t
+swap_block(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+	return slot * (PAGE_SIZE / swap_dev->d_blocksize);
+}
+
+/*
+ * Move one page between KVA and SLOT.
+ */
+static
+int
+swap_io(unsigned slot, void *kva, bool write)
+{
+	struct devbatch db;
+	struct devreq req;
+	struct iovec iov;
+
+	iov.iov_kbase = kva;
+	iov.iov_len = PAGE_SIZE;
+	devreq_init(&req, swap_block(slot), &iov, 1, write);
+	devbatch_init(&db);
+	devbatch_submit(&db, swap_dev, &req);
+	devbatch_wait(&db);
+	return req.dr_result;
+}
+
+int
+swap_read(unsigned slot, paddr_t paddr)
+{
+	int result;
+
+	result = swap_io(slot, (void *)PADDR_TO_KVADDR(paddr), false);
+	if (result) {
+		kprintf("swap: slot %u: read error: %s\n", slot,
+			strerror(result));
+		return result;
+	}
+	vmstats_inc(VMSTAT_PAGEINS);
+	return 0;
+}
+
+/*
+ * Pages going to consecutive slots share a request.
+ */
+void
+swap_write(const unsigned *slots, const paddr_t *paddrs, int *results,
+	   unsigned n)
+{
+	struct devreq reqs[SWAP_BATCH];
+	struct iovec iovs[SWAP_BATCH];
+	unsigned first[SWAP_BATCH];	/* first page of each request */
+	struct devbatch db;
+	unsigned i, j, nreqs;
+
+	KASSERT(n <= SWAP_BATCH);
+
+	nreqs = 0;
+	for (i=0; i<n; i++) {
+		iovs[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+		iovs[i].iov_len = PAGE_SIZE;
+		if (i > 0 && slots[i] == slots[i-1] + 1) {
+			reqs[nreqs-1].dr_iovcnt++;
+			continue;
+		}
+		first[nreqs] = i;
+		devreq_init(&reqs[nreqs], swap_block(slots[i]), &iovs[i], 1,
+			    true);
+		nreqs++;
+	}
+
+	devbatch_init(&db);
+	for (i=0; i<nreqs; i++) {
+		devbatch_submit(&db, swap_dev, &reqs[i]);
+	}
+	devbatch_wait(&db);
+
+	for (i=0; i<nreqs; i++) {
+		if (reqs[i].dr_result) {
+			kprintf("swap: slots %u-%u: write error: %s\n",
+				slots[first[i]],
+				slots[first[i]] + reqs[i].dr_iovcnt - 1,
+				strerror(reqs[i].dr_result));
+		}
+		for (j=0; j<reqs[i].dr_iovcnt; j++) {
+			results[first[i] + j] = reqs[i].dr_result;
+			if (reqs[i].dr_result == 0) {
+				vmstats_inc(VMSTAT_PAGEOUTS);
+			}
+		}
+		vmstats_inc(VMSTAT_SWAPWRITES);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// pageout thread
+
+static
+void
+swap_pageout(void *junk1, unsigned long junk2)
+{
+	unsigned n, freed;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		spinlock_acquire(&swap_pagerlock);
+		while (!swap_pagerwanted) {
+			wchan_sleep(swap_pagerwchan, &swap_pagerlock);
+		}
+		swap_pagerwanted = false;
+		swap_pagerrunning = true;
+		spinlock_release(&swap_pagerlock);
+
+		freed = 0;
+		do {
+			n = as_pageout(SWAP_BATCH);
+			freed += n;
+		} while (n > 0 && coremap_countfree() < SWAP_HIWATER);
+
+		spinlock_acquire(&swap_pagerlock);
+		swap_pagerrunning = false;
+		swap_passes++;
+		swap_lastfreed = freed;
+		wchan_wakeall(swap_waitwchan, &swap_pagerlock);
+		spinlock_release(&swap_pagerlock);
+	}
+}
+
+void
+swap_wake(void)
+{
+	if (swap_map == NULL || coremap_countfree() >= SWAP_LOWATER) {
+		return;
+	}
+	spinlock_acquire(&swap_pagerlock);
+	swap_pagerwanted = true;
+	wchan_wakeone(swap_pagerwchan, &swap_pagerlock);
+	spinlock_release(&swap_pagerlock);
+}
+
+bool
+swap_waitforpages(void)
+{
+	unsigned pass;
+	bool freed;
+
+	if (swap_map == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&swap_pagerlock);
+	/* A pass already under way may have missed what we need. */
+	pass = swap_passes + (swap_pagerrunning ? 2 : 1);
+	swap_pagerwanted = true;
+	wchan_wakeone(swap_pagerwchan, &swap_pagerlock);
+	while ((int)(swap_passes - pass) < 0) {
+		wchan_sleep(swap_waitwchan, &swap_pagerlock);
+	}
+	freed = swap_lastfreed > 0;
+	spinlock_release(&swap_pagerlock);
+	return freed;
+}
+
+////////////////////////////////////////////////////////////
+// setup and stats
+
+void
+swap_bootstrap(void)
+{
+	struct bitmap *map;
+	int result;
+
+	swap_pagerwchan = wchan_create("pageout");
+	if (swap_pagerwchan == NULL) {
+		panic("swap: Could not create pageout wchan\n");
+	}
+	swap_waitwchan = wchan_create("pagewait");
+	if (swap_waitwchan == NULL) {
+		panic("swap: Could not create page wait wchan\n");
+	}
+
+	result = vfs_swapon(SWAP_DEVICE, &swap_vn);
+	if (result) {
+		kprintf("swap: %s: %s; not paging\n", SWAP_DEVICE,
+			strerror(result));
+		return;
+	}
+	/* The raw device's vnode is a thin wrapper round the device. */
+	swap_dev = swap_vn->vn_data;
+	KASSERT(PAGE_SIZE % swap_dev->d_blocksize == 0);
+	swap_nslots = swap_dev->d_blocks / (PAGE_SIZE / swap_dev->d_blocksize);
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; not paging\n", SWAP_DEVICE);
+		return;
+	}
+
+	map = bitmap_create(swap_nslots);
+	if (map == NULL) {
+		panic("swap: Could not create slot map\n");
+	}
+	swap_refs = kmalloc(swap_nslots * sizeof(swap_refs[0]));
+	if (swap_refs == NULL) {
+		panic("swap: Could not create slot reference counts\n");
+	}
+	bzero(swap_refs, swap_nslots * sizeof(swap_refs[0]));
+	result = thread_fork("pageout", NULL, swap_pageout, NULL, 0);
+	if (result) {
+		panic("swap: Could not start pageout thread: %s\n",
+		      strerror(result));
+	}
+	/* Everything else checks this to see if swap is on. */
+	swap_map = map;
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+void
+swap_printstats(void)
+{
+	unsigned nused;
+
+	spinlock_acquire(&swap_maplock);
+	nused = swap_nused;
+	spinlock_release(&swap_maplock);
+
+	if (swap_map == NULL) {
+		kprintf("Swap: off\n");
+		return;
+	}
+	kprintf("Swap: %u of %u slots in use\n", nused, swap_nslots);
+}
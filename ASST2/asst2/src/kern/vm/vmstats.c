@@ -0,0 +1,93 @@
+/*
+ * VM event counters.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <vmstats.h>
+
+static const char *const vmstats_names[VMSTAT_NUM] = {
+	"TLB faults",
+	"zero-filled pages",
+	"pages loaded from executables",
+	"copy-on-write faults",
+	"copy-on-write page copies",
+	"page-ins",
+	"page-outs",
+	"pages evicted",
+	"swap write requests",
+	"TLB faults from page table",
+	"TLB flushes for new ASIDs",
+};
+
+static struct spinlock vmstats_lock = SPINLOCK_INITIALIZER;
+static unsigned vmstats_counts[VMSTAT_NUM];
+static struct timespec vmstats_since;
+
+void
+vmstats_inc(unsigned which)
+{
+	KASSERT(which < VMSTAT_NUM);
+
+	spinlock_acquire(&vmstats_lock);
+	vmstats_counts[which]++;
+	spinlock_release(&vmstats_lock);
+}
+
+unsigned
+vmstats_get(unsigned which)
+{
+	unsigned count;
+
+	KASSERT(which < VMSTAT_NUM);
+
+	spinlock_acquire(&vmstats_lock);
+	count = vmstats_counts[which];
+	spinlock_release(&vmstats_lock);
+	return count;
+}
+
+void
+vmstats_print(void)
+{
+	unsigned counts[VMSTAT_NUM];
+	struct timespec now, elapsed;
+	uint64_t msecs;
+	unsigned i;
+
+	spinlock_acquire(&vmstats_lock);
+	for (i=0; i<VMSTAT_NUM; i++) {
+		counts[i] = vmstats_counts[i];
+	}
+	spinlock_release(&vmstats_lock);
+
+	gettime(&now);
+	timespec_sub(&now, &vmstats_since, &elapsed);
+	msecs = (uint64_t)elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	kprintf("VM stats over %llu.%03u seconds:\n",
+		(unsigned long long)(msecs / 1000), (unsigned)(msecs % 1000));
+	for (i=0; i<VMSTAT_NUM; i++) {
+		kprintf("    %10u %-30s (%u/sec)\n", counts[i],
+			vmstats_names[i],
+			(unsigned)(counts[i] * 1000ULL / msecs));
+	}
+}
+
+void
+vmstats_reset(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&vmstats_lock);
+	for (i=0; i<VMSTAT_NUM; i++) {
+		vmstats_counts[i] = 0;
+	}
+	spinlock_release(&vmstats_lock);
+	gettime(&vmstats_since);
+}
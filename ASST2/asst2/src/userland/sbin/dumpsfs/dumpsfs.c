@@ -228,10 +228,17 @@ dumpfreemap(uint32_t fsblocks)
 	printf("\n");
 }
 
+/*
+ * Dump an indirect block LEVEL steps above the data, and the indirect
+ * blocks under it.
+ */
 static
 void
-dumpindirect(uint32_t block)
+dumpindirect(uint32_t block, unsigned level)
 {
+	static const char *const levelnames[] = {
+		NULL, "Indirect", "Double indirect", "Triple indirect",
+	};
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	char tmp[128];
 	unsigned i;
@@ -239,7 +246,7 @@ dumpindirect(uint32_t block)
 	if (block == 0) {
 		return;
 	}
-	printf("Indirect block %u\n", block);
+	printf("%s block %u\n", levelnames[level], block);
 
 	diskread(ib, block);
 	for (i=0; i<ARRAYCOUNT(ib); i++) {
@@ -253,12 +260,17 @@ dumpindirect(uint32_t block)
 			printf("\n");
 		}
 	}
+	if (level > 1) {
+		for (i=0; i<ARRAYCOUNT(ib); i++) {
+			dumpindirect(SWAP32(ib[i]), level - 1);
+		}
+	}
 }
 
 static
 uint32_t
 traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
-	    void (*doblock)(uint32_t, uint32_t))
+	    unsigned level, void (*doblock)(uint32_t, uint32_t))
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	unsigned i;
@@ -270,7 +282,14 @@ traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
 		diskread(ib, block);
 	}
 	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+		if (level > 1) {
+			fileblock = traverse_ib(fileblock, numblocks,
+						SWAP32(ib[i]), level - 1,
+						doblock);
+		}
+		else {
+			doblock(fileblock++, SWAP32(ib[i]));
+		}
 	}
 	return fileblock;
 }
@@ -291,7 +310,15 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 	}
 	if (fileblock < numblocks) {
 		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+					SWAP32(sfi->sfi_indirect), 1, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_dindirect), 2, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_tindirect), 3, doblock);
 	}
 	assert(fileblock == numblocks);
 }
@@ -476,6 +503,10 @@ dumpinode(uint32_t ino, const char *name)
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
+	printf("    Double indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_dindirect), SWAP32(sfi.sfi_dindirect));
+	printf("    Triple indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_tindirect), SWAP32(sfi.sfi_tindirect));
 	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
 		if (sfi.sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
@@ -484,7 +515,9 @@ dumpinode(uint32_t ino, const char *name)
 	}
 
 	if (doindirect) {
-		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi.sfi_indirect), 1);
+		dumpindirect(SWAP32(sfi.sfi_dindirect), 2);
+		dumpindirect(SWAP32(sfi.sfi_tindirect), 3);
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
@@ -498,6 +531,126 @@ dumpinode(uint32_t ino, const char *name)
 	}
 }
 
+////////////////////////////////////////////////////////////
+// fragmentation report
+
+/*
+ * For every regular file reachable from the root directory, count
+ * its data blocks and the extents (runs of consecutive disk blocks)
+ * they fall into. A file in one extent is contiguous. Sparse blocks
+ * don't count, and neither do indirect blocks.
+ */
+
+static uint32_t frag_lastblock;
+static unsigned frag_blocks, frag_extents;
+static unsigned fragtotal_files, fragtotal_contig;
+static unsigned fragtotal_blocks, fragtotal_extents;
+
+static void fraginode(uint32_t ino, const char *name);
+
+static
+void
+fragfileblock(uint32_t fileblock, uint32_t diskblock)
+{
+	(void)fileblock;
+	if (diskblock == 0) {
+		return;
+	}
+	if (frag_blocks == 0 || diskblock != frag_lastblock + 1) {
+		frag_extents++;
+	}
+	frag_blocks++;
+	frag_lastblock = diskblock;
+}
+
+static
+void
+fragdirblock(uint32_t fileblock, uint32_t diskblock)
+{
+	struct sfs_direntry sds[SFS_BLOCKSIZE/sizeof(struct sfs_direntry)];
+	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	int i;
+
+	(void)fileblock;
+	if (diskblock == 0) {
+		return;
+	}
+	diskread(&sds, diskblock);
+
+	for (i=0; i<nsds; i++) {
+		uint32_t ino = SWAP32(sds[i].sfd_ino);
+		if (ino==SFS_NOINO) {
+			continue;
+		}
+		sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
+		if (!strcmp(sds[i].sfd_name, ".") ||
+		    !strcmp(sds[i].sfd_name, "..")) {
+			continue;
+		}
+		fraginode(ino, sds[i].sfd_name);
+	}
+}
+
+static
+void
+fraginode(uint32_t ino, const char *name)
+{
+	struct sfs_dinode sfi;
+
+	diskread(&sfi, ino);
+
+	switch (SWAP16(sfi.sfi_type)) {
+	    case SFS_TYPE_DIR:
+		traverse(&sfi, fragdirblock);
+		break;
+	    case SFS_TYPE_FILE:
+		frag_blocks = frag_extents = 0;
+		traverse(&sfi, fragfileblock);
+		printf("%6u  %-24s %6u blocks %5u extents\n",
+		       ino, name, frag_blocks, frag_extents);
+		fragtotal_files++;
+		fragtotal_blocks += frag_blocks;
+		fragtotal_extents += frag_extents;
+		if (frag_extents <= 1) {
+			fragtotal_contig++;
+		}
+		break;
+	}
+}
+
+static
+void
+dumpfrag(void)
+{
+	printf("Fragmentation report\n");
+	printf("--------------\n");
+	printf("%6s  %-24s\n", "Inode", "Name");
+	fraginode(SFS_ROOTDIR_INO, "/");
+	printf("\n");
+
+	dumpvalf("Files", "%u", fragtotal_files);
+	dumpvalf("Contiguous files", "%u (%u%%)", fragtotal_contig,
+		 fragtotal_files == 0 ? 0 :
+		 fragtotal_contig * 100 / fragtotal_files);
+	dumpvalf("Data blocks", "%u", fragtotal_blocks);
+	dumpvalf("Extents", "%u", fragtotal_extents);
+	if (fragtotal_files > 0) {
+		dumpvalf("Extents per file", "%u.%02u",
+			 fragtotal_extents / fragtotal_files,
+			 fragtotal_extents * 100 / fragtotal_files % 100);
+	}
+	if (fragtotal_extents > 0) {
+		dumpvalf("Blocks per extent", "%u.%02u",
+			 fragtotal_blocks / fragtotal_extents,
+			 fragtotal_blocks * 100 / fragtotal_extents % 100);
+	}
+	if (dumppos % 2 == 1) {
+		printf("\n");
+		dumppos++;
+	}
+	printf("\n");
+}
+
 ////////////////////////////////////////////////////////////
 // main
 
@@ -513,6 +666,7 @@ usage(void)
 	warnx("   -f: dump file contents");
 	warnx("   -d: dump directory contents");
 	warnx("   -r: recurse into directory contents");
+	warnx("   -F: report file fragmentation");
 	warnx("   -a: equivalent to -sbdfr -i 1");
 	errx(1, "   Default is -i 1");
 }
@@ -522,6 +676,7 @@ main(int argc, char **argv)
 {
 	bool dosb = false;
 	bool dofreemap = false;
+	bool dofrag = false;
 	uint32_t dumpino = 0;
 	const char *dumpdisk = NULL;
 
@@ -554,6 +709,7 @@ main(int argc, char **argv)
 				    case 'f': dofiles = true; break;
 				    case 'd': dodirs = true; break;
 				    case 'r': recurse = true; break;
+				    case 'F': dofrag = true; break;
 				    case 'a':
 					dosb = true;
 					dofreemap = true;
@@ -584,7 +740,7 @@ main(int argc, char **argv)
 		usage();
 	}
 
-	if (!dosb && !dofreemap && dumpino == 0) {
+	if (!dosb && !dofreemap && !dofrag && dumpino == 0) {
 		dumpino = SFS_ROOTDIR_INO;
 	}
 
@@ -597,6 +753,9 @@ main(int argc, char **argv)
 	if (dofreemap) {
 		dumpfreemap(nblocks);
 	}
+	if (dofrag) {
+		dumpfrag();
+	}
 	if (dumpino != 0) {
 		dumpinode(dumpino, NULL);
 	}
@@ -32,6 +32,11 @@
  *
  * Your system should survive this (without leaving a corrupted file
  * system behind) once the file system assignment is complete.
+ *
+ * With -b, instead benchmarks one large directory under concurrent
+ * use: NPROCS processes split NENTRIES names (default 5000) between
+ * them and, in three timed rounds, create, look up, and remove them
+ * all in the root of the filesystem.
  */
 
 #include <sys/types.h>
@@ -43,6 +48,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <fcntl.h>
 
 #define NTRIES    100	/* loop count */
 #define NPROCS    5	/* actually totals 4x this +1 processes */
@@ -51,6 +57,8 @@
 #define NNAMES    4
 #define NAMESIZE  32
 
+#define BENCH_ENTRIES	5000
+
 ////////////////////////////////////////////////////////////
 
 static const char *const names[NNAMES] = {
@@ -324,12 +332,134 @@ cleanup(void)
 
 ////////////////////////////////////////////////////////////
 
+enum benchop { BENCH_CREATE, BENCH_LOOKUP, BENCH_REMOVE };
+
+/*
+ * One process's share of a benchmark round: every NPROCS'th name,
+ * starting at WHICH.
+ */
+static
+void
+bench_proc(enum benchop op, unsigned which, unsigned nentries)
+{
+	char name[NAMESIZE];
+	unsigned i;
+	int fd;
+
+	for (i=which; i<nentries; i+=NPROCS) {
+		snprintf(name, sizeof(name), "dc-%u", i);
+		switch (op) {
+		    case BENCH_CREATE:
+			fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+			break;
+		    case BENCH_LOOKUP:
+			fd = open(name, O_RDONLY);
+			break;
+		    default:
+			fd = remove(name);
+			break;
+		}
+		if (fd < 0) {
+			say("pid %d: %s: %s\n", getpid(), name,
+			    strerror(errno));
+			exit(1);
+		}
+		if (op != BENCH_REMOVE) {
+			close(fd);
+		}
+	}
+}
+
+/*
+ * Run one round in NPROCS processes and report how long it took.
+ * Returns nonzero if any of them failed.
+ */
+static
+int
+bench_round(const char *what, enum benchop op, unsigned nentries)
+{
+	pid_t pids[NPROCS];
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned long long usecs;
+	int i, status, failed = 0;
+
+	__time(&s0, &ns0);
+	for (i=0; i<NPROCS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			say("fork: %s\n", strerror(errno));
+			failed = 1;
+			continue;
+		}
+		if (pids[i] == 0) {
+			bench_proc(op, i, nentries);
+			exit(0);
+		}
+	}
+	for (i=0; i<NPROCS; i++) {
+		if (pids[i] < 0) {
+			continue;
+		}
+		if (waitpid(pids[i], &status, 0) < 0) {
+			say("waitpid %d: %s\n", (int) pids[i],
+			    strerror(errno));
+			failed = 1;
+		}
+		else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	__time(&s1, &ns1);
+
+	usecs = (unsigned long long)(s1 - s0) * 1000000ULL;
+	if (ns1 >= ns0) {
+		usecs += (ns1 - ns0) / 1000;
+	}
+	else {
+		usecs -= (ns0 - ns1) / 1000;
+	}
+	say("%-8s %u ops in %llu us, %llu us/op%s\n", what, nentries,
+	    usecs, usecs / nentries, failed ? " (failed)" : "");
+	return failed;
+}
+
+static
+void
+bench(const char *fs, unsigned nentries)
+{
+	if (nentries == 0) {
+		say("Usage: dirconc -b filesystem [nentries]\n");
+		exit(1);
+	}
+	if (chdir(fs)<0) {
+		say("chdir: %s: %s\n", fs, strerror(errno));
+		exit(1);
+	}
+	say("Concurrent directory benchmark, %u entries, %d processes\n",
+	    nentries, NPROCS);
+
+	/* Remove whatever did get created even if creating failed. */
+	if (bench_round("create", BENCH_CREATE, nentries) == 0) {
+		bench_round("lookup", BENCH_LOOKUP, nentries);
+	}
+	bench_round("remove", BENCH_REMOVE, nentries);
+}
+
+////////////////////////////////////////////////////////////
+
 int
 main(int argc, char *argv[])
 {
 	const char *fs;
 	long seed = 0;
 
+	if (argc >= 3 && !strcmp(argv[1], "-b")) {
+		bench(argv[2], argc > 3 ? (unsigned)atoi(argv[3]) :
+		      BENCH_ENTRIES);
+		return 0;
+	}
+
 	say("Concurrent directory ops test\n");
 
 	if (argc==0 || argv==NULL) {
@@ -346,6 +476,7 @@ main(int argc, char *argv[])
 	}
 	else {
 		say("Usage: dirconc filesystem [random-seed]\n");
+		say("       dirconc -b filesystem [nentries]\n");
 		exit(1);
 	}
 
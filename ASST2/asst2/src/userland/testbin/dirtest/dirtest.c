@@ -37,24 +37,131 @@
  *
  *      Intended for the file system assignment. Should run (on SFS)
  *      when that assignment is complete.
+ *
+ *      With -b, instead benchmarks one large directory: creates
+ *      NENTRIES files (default 5000) in the current directory, then
+ *      looks up, renames, and removes each one, printing the time
+ *      per operation for each phase.
  */
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <err.h>
 
 #define MAXLEVELS       5
+#define BENCH_ENTRIES   5000
+
+static time_t bench_s;
+static unsigned long bench_ns;
+
+static
+void
+bench_start(void)
+{
+	__time(&bench_s, &bench_ns);
+}
+
+static
+void
+bench_report(const char *what, unsigned ops)
+{
+	time_t s;
+	unsigned long ns;
+	unsigned long long usecs;
+
+	__time(&s, &ns);
+	usecs = (unsigned long long)(s - bench_s) * 1000000ULL;
+	if (ns >= bench_ns) {
+		usecs += (ns - bench_ns) / 1000;
+	}
+	else {
+		usecs -= (bench_ns - ns) / 1000;
+	}
+	printf("%-8s %u ops in %llu us, %llu us/op\n", what, ops, usecs,
+	       ops > 0 ? usecs / ops : 0);
+}
+
+static
+void
+bench(unsigned nentries)
+{
+	char name[32], name2[32];
+	unsigned i;
+	int fd;
+
+	printf("Directory benchmark, %u entries\n", nentries);
+
+	bench_start();
+	for (i=0; i<nentries; i++) {
+		snprintf(name, sizeof(name), "dt-%u", i);
+		fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			warn("%s: create", name);
+			printf("Stopping at %u entries\n", i);
+			nentries = i;
+			break;
+		}
+		close(fd);
+	}
+	bench_report("create", nentries);
+
+	/* Backwards, so nothing benefits from the last create. */
+	bench_start();
+	for (i=nentries; i-- > 0; ) {
+		snprintf(name, sizeof(name), "dt-%u", i);
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s: open", name);
+		}
+		close(fd);
+	}
+	bench_report("lookup", nentries);
+
+	bench_start();
+	for (i=0; i<nentries; i++) {
+		snprintf(name, sizeof(name), "dt-%u", i);
+		snprintf(name2, sizeof(name2), "dr-%u", i);
+		if (rename(name, name2)) {
+			err(1, "rename %s %s", name, name2);
+		}
+	}
+	bench_report("rename", nentries);
+
+	bench_start();
+	for (i=0; i<nentries; i++) {
+		snprintf(name2, sizeof(name2), "dr-%u", i);
+		if (remove(name2)) {
+			err(1, "%s: remove", name2);
+		}
+	}
+	bench_report("remove", nentries);
+}
 
 int
-main(void)
+main(int argc, char *argv[])
 {
 	int i;
+	unsigned n;
 	const char *onename = "testdir";
 	char dirname[512];
 
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		n = argc > 2 ? (unsigned)atoi(argv[2]) : BENCH_ENTRIES;
+		if (argc > 3 || n == 0) {
+			errx(1, "Usage: dirtest [-b [nentries]]");
+		}
+		bench(n);
+		return 0;
+	}
+	if (argc > 1) {
+		errx(1, "Usage: dirtest [-b [nentries]]");
+	}
+
 	strcpy(dirname, onename);
 
 	for (i=0; i<MAXLEVELS; i++) {
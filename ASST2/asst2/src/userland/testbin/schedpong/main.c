@@ -108,6 +108,12 @@ runtaskgroup(unsigned count,
 		if (mypids[i] == 0) {
 			/* child (of second fork) */
 			task(groupid, i);
+
+			/* Store this task's own end time. */
+			__time(&secs, &nsecs);
+			openresultsfile(O_WRONLY);
+			puttaskresult(groupid, i, secs, nsecs);
+			closeresultsfile();
 			exit(0);
 		}
 		/* parent (of second fork) - continue */
@@ -181,6 +187,22 @@ waitall(pid_t *pids, unsigned numpids)
 	}
 }
 
+/*
+ * secs.nsecs -= startsecs.startnsecs
+ */
+static
+void
+subtime(time_t *secs, unsigned long *nsecs,
+	time_t startsecs, unsigned long startnsecs)
+{
+	if (*nsecs < startnsecs) {
+		*nsecs += 1000000000;
+		(*secs)--;
+	}
+	*nsecs -= startnsecs;
+	*secs -= startsecs;
+}
+
 /*
  * Fetch, compute, and print the timing for one task group.
  */
@@ -193,15 +215,52 @@ calcresult(unsigned groupid, time_t startsecs, unsigned long startnsecs,
 	unsigned long nsecs;
 
 	getresult(groupid, &secs, &nsecs);
+	subtime(&secs, &nsecs, startsecs, startnsecs);
+	snprintf(buf, bufmax, "%lld.%09lu", (long long)secs, nsecs);
+}
 
-	/* secs.nsecs -= startsecs.startnsecs */
-	if (nsecs < startnsecs) {
-		nsecs += 1000000000;
-		secs--;
+/*
+ * Print the latency (start to finish) of the tasks in one group as
+ * percentiles. With few tasks the percentiles coincide; that's fine.
+ */
+static
+void
+calcpercentiles(unsigned groupid, unsigned count,
+		time_t startsecs, unsigned long startnsecs)
+{
+	static const unsigned pcts[] = { 50, 90, 99, 100 };
+	unsigned long long lat[MAXTASKS], tmp;
+	time_t secs;
+	unsigned long nsecs;
+	unsigned i, j, ix;
+
+	if (count == 0) {
+		return;
 	}
-	nsecs -= startnsecs;
-	secs -= startsecs;
-	snprintf(buf, bufmax, "%lld.%09lu", (long long)secs, nsecs);
+	for (i=0; i<count; i++) {
+		gettaskresult(groupid, i, &secs, &nsecs);
+		subtime(&secs, &nsecs, startsecs, startnsecs);
+		lat[i] = (unsigned long long)secs * 1000000000ULL + nsecs;
+	}
+
+	/* insertion sort; count is small */
+	for (i=1; i<count; i++) {
+		tmp = lat[i];
+		for (j=i; j>0 && lat[j-1] > tmp; j--) {
+			lat[j] = lat[j-1];
+		}
+		lat[j] = tmp;
+	}
+
+	printf("   per-task:");
+	for (i=0; i<sizeof(pcts)/sizeof(pcts[0]); i++) {
+		ix = (pcts[i] * count + 99) / 100;
+		ix = ix > 0 ? ix - 1 : 0;
+		printf(" p%u %llu.%03llu", pcts[i],
+		       lat[ix] / 1000000000ULL,
+		       (lat[ix] / 1000000ULL) % 1000);
+	}
+	printf("\n");
 }
 
 /*
@@ -256,16 +315,19 @@ runit(unsigned numthinkers, unsigned numgrinders,
 	if (numthinkers > 0) {
 		calcresult(0, startsecs, startnsecs, buf, sizeof(buf));
 		printf("Thinkers: %s\n", buf);
+		calcpercentiles(0, numthinkers, startsecs, startnsecs);
 	}
 
 	if (numgrinders > 0) {
 		calcresult(1, startsecs, startnsecs, buf, sizeof(buf));
 		printf("Grinders: %s\n", buf);
+		calcpercentiles(1, numgrinders, startsecs, startnsecs);
 	}
 
 	for (i=0; i<numponggroups; i++) {
 		calcresult(i+2, startsecs, startnsecs, buf, sizeof(buf));
 		printf("Pong group %u: %s\n", i, buf);
+		calcpercentiles(i+2, ponggroupsize, startsecs, startnsecs);
 	}
 
 	closeresultsfile();
@@ -314,6 +376,11 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if (numthinkers > MAXTASKS || numgrinders > MAXTASKS ||
+	    ponggroupsize > MAXTASKS) {
+		errx(1, "At most %u tasks per group", MAXTASKS);
+	}
+
 	runit(numthinkers, numgrinders, numponggroups, ponggroupsize);
 	return 0;
 }
@@ -107,17 +107,18 @@ closeresultsfile(void)
 }
 
 /*
- * Write a result into the timing results file.
+ * Write a result into the timing results file at slot SLOT.
  */
+static
 void
-putresult(unsigned groupid, time_t secs, unsigned long nsecs)
+putslot(unsigned slot, time_t secs, unsigned long nsecs)
 {
 	off_t pos;
 	ssize_t r;
 
 	assert(resultsfile >= 0);
 
-	pos = groupid * (sizeof(secs) + sizeof(nsecs));
+	pos = slot * (sizeof(secs) + sizeof(nsecs));
 	if (lseek(resultsfile, pos, SEEK_SET) == -1) {
 		err(1, "%s: lseek", RESULTSFILE);
 	}
@@ -138,17 +139,18 @@ putresult(unsigned groupid, time_t secs, unsigned long nsecs)
 }
 
 /*
- * Read a result from the timing results file.
+ * Read a result from the timing results file at slot SLOT.
  */
+static
 void
-getresult(unsigned groupid, time_t *secs, unsigned long *nsecs)
+getslot(unsigned slot, time_t *secs, unsigned long *nsecs)
 {
 	off_t pos;
 	ssize_t r;
 
 	assert(resultsfile >= 0);
 
-	pos = groupid * (sizeof(*secs) + sizeof(*nsecs));
+	pos = slot * (sizeof(*secs) + sizeof(*nsecs));
 	if (lseek(resultsfile, pos, SEEK_SET) == -1) {
 		err(1, "%s: lseek", RESULTSFILE);
 	}
@@ -167,3 +169,53 @@ getresult(unsigned groupid, time_t *secs, unsigned long *nsecs)
 		errx(1, "%s: read (nsecs): Unexpected EOF", RESULTSFILE);
 	}
 }
+
+/*
+ * Slot numbering: see results.h.
+ */
+static
+unsigned
+groupslot(unsigned groupid)
+{
+	return groupid * (MAXTASKS + 1);
+}
+
+static
+unsigned
+taskslot(unsigned groupid, unsigned taskid)
+{
+	assert(taskid < MAXTASKS);
+	return groupslot(groupid) + 1 + taskid;
+}
+
+/*
+ * Write/read the end time for a whole task group.
+ */
+void
+putresult(unsigned groupid, time_t secs, unsigned long nsecs)
+{
+	putslot(groupslot(groupid), secs, nsecs);
+}
+
+void
+getresult(unsigned groupid, time_t *secs, unsigned long *nsecs)
+{
+	getslot(groupslot(groupid), secs, nsecs);
+}
+
+/*
+ * Write/read the end time for one task within a group.
+ */
+void
+puttaskresult(unsigned groupid, unsigned taskid,
+	      time_t secs, unsigned long nsecs)
+{
+	putslot(taskslot(groupid, taskid), secs, nsecs);
+}
+
+void
+gettaskresult(unsigned groupid, unsigned taskid,
+	      time_t *secs, unsigned long *nsecs)
+{
+	getslot(taskslot(groupid, taskid), secs, nsecs);
+}
@@ -28,9 +28,19 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * Each task group gets a slot for its end time followed by one slot
+ * per task for that task's own end time.
+ */
+#define MAXTASKS 64
+
 void createresultsfile(void);
 void destroyresultsfile(void);
 void openresultsfile(int openflags);
 void closeresultsfile(void);
 void putresult(unsigned groupid, time_t secs, unsigned long nsecs);
 void getresult(unsigned groupid, time_t *secs, unsigned long *nsecs);
+void puttaskresult(unsigned groupid, unsigned taskid,
+		   time_t secs, unsigned long nsecs);
+void gettaskresult(unsigned groupid, unsigned taskid,
+		   time_t *secs, unsigned long *nsecs);
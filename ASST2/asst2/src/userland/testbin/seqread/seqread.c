@@ -0,0 +1,173 @@
+/*
+ * seqread - sequential read throughput.
+ *
+ * Usage: seqread [megabytes [readsize]]
+ *
+ * Writes MEGABYTES (default 10) of data in the current directory,
+ * syncs it to disk, and reads it all back twice in READSIZE-byte
+ * reads (default 512), printing KB/sec for each pass:
+ *
+ *    sequential - plain read() calls, which the kernel recognizes as
+ *                 sequential and reads ahead for.
+ *    seeking    - the same reads, each preceded by an lseek() to
+ *                 where the file offset already is. The data read is
+ *                 identical, but every lseek resets the read-ahead
+ *                 window, so this is the no-read-ahead baseline.
+ *
+ * The data is spread over 64K files named seqread.N, read one after
+ * the other. Run it on a freshly mounted filesystem, or with a buffer
+ * cache smaller than the data, so the blocks written aren't still
+ * cached.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define DEFAULT_MB	10
+#define DEFAULT_READ	512
+#define FILESIZE	65536
+#define MAXREAD		FILESIZE
+
+static char buf[MAXREAD];
+
+static
+unsigned long long
+elapsed_usecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	unsigned long long usecs;
+
+	usecs = (unsigned long long)(s1 - s0) * 1000000ULL;
+	if (ns1 >= ns0) {
+		usecs += (ns1 - ns0) / 1000;
+	}
+	else {
+		usecs -= (ns0 - ns1) / 1000;
+	}
+	return usecs;
+}
+
+static
+void
+makename(char *name, size_t len, unsigned n)
+{
+	snprintf(name, len, "seqread.%u", n);
+}
+
+static
+void
+writefiles(unsigned nfiles)
+{
+	char name[32];
+	unsigned i, pos;
+	ssize_t r;
+	int fd;
+
+	for (i=0; i<nfiles; i++) {
+		makename(name, sizeof(name), i);
+		fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		memset(buf, 'a' + i % 26, FILESIZE);
+		for (pos = 0; pos < FILESIZE; pos += r) {
+			r = write(fd, buf + pos, FILESIZE - pos);
+			if (r < 0) {
+				err(1, "%s: write", name);
+			}
+		}
+		close(fd);
+	}
+	if (sync() < 0) {
+		err(1, "sync");
+	}
+}
+
+static
+void
+readfiles(unsigned nfiles, size_t readsize, int seeking)
+{
+	char name[32];
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned long long usecs, total = 0;
+	unsigned i;
+	off_t pos;
+	ssize_t r;
+	int fd;
+	char want;
+
+	__time(&s0, &ns0);
+	for (i=0; i<nfiles; i++) {
+		makename(name, sizeof(name), i);
+		want = 'a' + i % 26;
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		pos = 0;
+		while (1) {
+			if (seeking && lseek(fd, pos, SEEK_SET) < 0) {
+				err(1, "%s: lseek", name);
+			}
+			r = read(fd, buf, readsize);
+			if (r < 0) {
+				err(1, "%s: read", name);
+			}
+			if (r == 0) {
+				break;
+			}
+			if (buf[0] != want || buf[r-1] != want) {
+				errx(1, "%s: bad data at offset %ld", name,
+				     (long)pos);
+			}
+			pos += r;
+		}
+		if (pos != FILESIZE) {
+			errx(1, "%s: read %ld bytes, expected %d", name,
+			     (long)pos, FILESIZE);
+		}
+		total += pos;
+		close(fd);
+	}
+	__time(&s1, &ns1);
+
+	usecs = elapsed_usecs(s0, ns0, s1, ns1);
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	printf("%-10s %llu KB in %llu us, %llu KB/sec\n",
+	       seeking ? "seeking" : "sequential", total / 1024, usecs,
+	       total * 1000000ULL / 1024 / usecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char name[32];
+	unsigned mb, nfiles, i;
+	size_t readsize;
+
+	mb = argc > 1 ? (unsigned)atoi(argv[1]) : DEFAULT_MB;
+	readsize = argc > 2 ? (size_t)atoi(argv[2]) : DEFAULT_READ;
+	if (mb == 0 || readsize == 0 || readsize > MAXREAD) {
+		errx(1, "Usage: seqread [megabytes [readsize]]");
+	}
+	nfiles = mb * (1024 * 1024 / FILESIZE);
+
+	printf("seqread: %u MB in %u files, %lu-byte reads\n",
+	       mb, nfiles, (unsigned long)readsize);
+	writefiles(nfiles);
+	readfiles(nfiles, readsize, 0);
+	readfiles(nfiles, readsize, 1);
+
+	for (i=0; i<nfiles; i++) {
+		makename(name, sizeof(name), i);
+		remove(name);
+	}
+	return 0;
+}